@@ -0,0 +1,187 @@
+#include "analyzer.h"
+#include "port.h"
+
+// Periods longer than this are treated as a gap, the cycle counter wraps after ~59s
+#define MAX_PERIOD_MS 30000
+
+#define EXT_ID_FLAG 0x80000000U
+
+typedef struct {
+    uint32_t nKey;          // ID, bit 31 set for extended
+    uint32_t nCount;        // 0 = slot empty
+    uint8_t nDlc;           // Of the last data frame, remote frames carry no payload
+    uint8_t nData[8];
+    bool bHasData;          // A data frame was seen, not only remote frames
+    rtcnt_t nLastRt;
+    uint32_t nLastMs;
+    uint32_t nDataMs;       // SYS_TIME of the last data frame
+    uint32_t nPeriodSumUs;  // Sum of measured periods, wraps into nPeriodSumHi
+    uint32_t nPeriodSumHi;
+    uint32_t nPeriods;
+    uint32_t nMinPeriodUs;
+    uint32_t nMaxPeriodUs;
+} stSlot;
+
+static stSlot table[ANALYZER_SIZE];
+static uint16_t nIdCount;
+static uint32_t nOverflow;
+
+static inline uint32_t Hash(uint32_t nKey)
+{
+    // Fibonacci hashing, top bits of the product index the table
+    return (nKey * 2654435761U) >> (32 - __builtin_ctz(ANALYZER_SIZE));
+}
+
+void InitAnalyzer(void)
+{
+    ClearAnalyzer();
+}
+
+void ClearAnalyzer(void)
+{
+    chSysLock();
+    for (uint16_t i = 0; i < ANALYZER_SIZE; i++)
+        table[i] = {};
+    nIdCount = 0;
+    nOverflow = 0;
+    chSysUnlock();
+}
+
+// Called from the CAN RX interrupt with the system locked
+void AnalyzerRecordI(const CANRxFrame *frame)
+{
+    const uint32_t nKey = (frame->IDE == CAN_IDE_EXT) ? (frame->EID | EXT_ID_FLAG) : frame->SID;
+    const rtcnt_t nNowRt = chSysGetRealtimeCounterX();
+    const uint32_t nNowMs = SYS_TIME;
+
+    uint32_t nIdx = Hash(nKey);
+    stSlot *slot = nullptr;
+
+    for (uint8_t nProbe = 0; nProbe < ANALYZER_MAX_PROBE; nProbe++)
+    {
+        stSlot *s = &table[nIdx];
+        if ((s->nCount == 0) || (s->nKey == nKey))
+        {
+            slot = s;
+            break;
+        }
+        nIdx = (nIdx + 1) & (ANALYZER_SIZE - 1);
+    }
+
+    if (slot == nullptr)
+    {
+        nOverflow++;
+        return;
+    }
+
+    if (slot->nCount == 0)
+    {
+        slot->nKey = nKey;
+        slot->nMinPeriodUs = UINT32_MAX;
+        nIdCount++;
+    }
+    else if ((nNowMs - slot->nLastMs) < MAX_PERIOD_MS)
+    {
+        uint32_t nPeriodUs = (nNowRt - slot->nLastRt) / RT_TICKS_PER_US;
+
+        uint32_t nSum = slot->nPeriodSumUs + nPeriodUs;
+        if (nSum < slot->nPeriodSumUs)
+            slot->nPeriodSumHi++;
+        slot->nPeriodSumUs = nSum;
+        slot->nPeriods++;
+
+        if (nPeriodUs < slot->nMinPeriodUs)
+            slot->nMinPeriodUs = nPeriodUs;
+        if (nPeriodUs > slot->nMaxPeriodUs)
+            slot->nMaxPeriodUs = nPeriodUs;
+    }
+
+    slot->nCount++;
+    if (frame->RTR == CAN_RTR_DATA)
+    {
+        slot->nDlc = frame->DLC;
+        for (uint8_t i = 0; i < 8; i++)
+            slot->nData[i] = frame->data8[i];
+        slot->bHasData = true;
+        slot->nDataMs = nNowMs;
+    }
+    slot->nLastRt = nNowRt;
+    slot->nLastMs = nNowMs;
+}
+
+// Returns false if the slot is empty
+bool GetAnalyzerEntry(uint16_t nSlot, stAnalyzerEntry *entry)
+{
+    if (nSlot >= ANALYZER_SIZE)
+        return false;
+
+    stSlot slot;
+    chSysLock();
+    slot = table[nSlot];
+    chSysUnlock();
+
+    if (slot.nCount == 0)
+        return false;
+
+    entry->nId = slot.nKey;
+    entry->nCount = slot.nCount;
+    entry->nDlc = slot.nDlc;
+    for (uint8_t i = 0; i < 8; i++)
+        entry->nData[i] = slot.nData[i];
+
+    if (slot.nPeriods > 0)
+    {
+        uint64_t nSum = ((uint64_t)slot.nPeriodSumHi << 32) | slot.nPeriodSumUs;
+        entry->nMeanPeriodUs = (uint32_t)(nSum / slot.nPeriods);
+        entry->nJitterUs = slot.nMaxPeriodUs - slot.nMinPeriodUs;
+    }
+    else
+    {
+        entry->nMeanPeriodUs = 0;
+        entry->nJitterUs = 0;
+    }
+
+    return true;
+}
+
+// Last payload of an ID, bit 31 of nId set for extended IDs
+// Returns false if no data frame of the ID has been received since the
+// table was cleared, or the ID didn't fit in the table
+bool GetLastValue(uint32_t nId, stLastValue *value)
+{
+    uint32_t nIdx = Hash(nId);
+    bool bFound = false;
+
+    chSysLock();
+    for (uint8_t nProbe = 0; nProbe < ANALYZER_MAX_PROBE; nProbe++)
+    {
+        const stSlot *s = &table[nIdx];
+        if (s->nCount == 0)
+            break;
+        if (s->nKey == nId)
+        {
+            if (!s->bHasData)
+                break;
+            value->nDlc = s->nDlc;
+            for (uint8_t i = 0; i < 8; i++)
+                value->nData[i] = s->nData[i];
+            value->nTimeMs = s->nDataMs;
+            bFound = true;
+            break;
+        }
+        nIdx = (nIdx + 1) & (ANALYZER_SIZE - 1);
+    }
+    chSysUnlock();
+
+    return bFound;
+}
+
+uint16_t GetAnalyzerIdCount(void)
+{
+    return nIdCount;
+}
+
+uint32_t GetAnalyzerOverflow(void)
+{
+    return nOverflow;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include "hal.h"
+
+// Table slots, must be a power of two
+#define ANALYZER_SIZE 128
+// Longest probe sequence before an ID is counted as overflow
+#define ANALYZER_MAX_PROBE 8
+
+typedef struct {
+    uint32_t nId;           // Bit 31 set for extended IDs
+    uint32_t nCount;
+    uint8_t nDlc;
+    uint8_t nData[8];
+    uint32_t nMeanPeriodUs;
+    uint32_t nJitterUs;     // Max - min period
+} stAnalyzerEntry;
+
+typedef struct {
+    uint8_t nDlc;
+    uint8_t nData[8];
+    uint32_t nTimeMs;       // SYS_TIME when the last data frame was received
+} stLastValue;
+
+void InitAnalyzer(void);
+void ClearAnalyzer(void);
+void AnalyzerRecordI(const CANRxFrame *frame);
+bool GetAnalyzerEntry(uint16_t nSlot, stAnalyzerEntry *entry);
+bool GetLastValue(uint32_t nId, stLastValue *value);
+uint16_t GetAnalyzerIdCount(void);
+uint32_t GetAnalyzerOverflow(void);
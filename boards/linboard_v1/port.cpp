@@ -1,9 +1,13 @@
 #include "port.h"
 
 
+/*
+ TTCM runs the bit-time counter that stamps the SOF of every frame into the
+ mailbox TIME fields, used by the time-triggered schedule (ttcan.cpp)
+*/
 static const CANConfig canConfig1000 =
 {
-    CAN_MCR_ABOM | CAN_MCR_AWUM | CAN_MCR_TXFP,
+    CAN_MCR_ABOM | CAN_MCR_AWUM | CAN_MCR_TXFP | CAN_MCR_TTCM,
     /*
      For 36MHz http://www.bittiming.can-wiki.info/ gives us Pre-scaler=2, Seq 1=15 and Seq 2=2. Subtract '1' for register values
     */
@@ -12,7 +16,7 @@ static const CANConfig canConfig1000 =
 
 static const CANConfig canConfig500 =
 {
-    CAN_MCR_ABOM | CAN_MCR_AWUM | CAN_MCR_TXFP,
+    CAN_MCR_ABOM | CAN_MCR_AWUM | CAN_MCR_TXFP | CAN_MCR_TTCM,
     /*
      For 36MHz http://www.bittiming.can-wiki.info/ gives us Pre-scaler=4, Seq 1=15 and Seq 2=2. Subtract '1' for register values
     */
@@ -21,7 +25,7 @@ static const CANConfig canConfig500 =
 
 static const CANConfig canConfig250 =
 {
-    CAN_MCR_ABOM | CAN_MCR_AWUM | CAN_MCR_TXFP,
+    CAN_MCR_ABOM | CAN_MCR_AWUM | CAN_MCR_TXFP | CAN_MCR_TTCM,
     /*
      For 36MHz http://www.bittiming.can-wiki.info/ gives us Pre-scaler=8, Seq 1=15 and Seq 2=2. Subtract '1' for register values
     */
@@ -30,7 +34,7 @@ static const CANConfig canConfig250 =
 
 static const CANConfig canConfig125 =
 {
-    CAN_MCR_ABOM | CAN_MCR_AWUM | CAN_MCR_TXFP,
+    CAN_MCR_ABOM | CAN_MCR_AWUM | CAN_MCR_TXFP | CAN_MCR_TTCM,
     /*
      For 36MHz http://www.bittiming.can-wiki.info/ gives us Pre-scaler=16, Seq 1=15 and Seq 2=2. Subtract '1' for register values
     */
@@ -5,6 +5,10 @@
 
 #define SYS_TIME TIME_I2MS(chVTGetSystemTimeX())
 
+// DWT cycle counter ticks per microsecond, take differences of
+// chSysGetRealtimeCounterX() before dividing so wraparound is handled
+#define RT_TICKS_PER_US (STM32_HCLK / 1000000U)
+
 const CANConfig &GetCanConfig(CanBitrate bitrate);
 
 const I2CConfig i2cConfig = {
@@ -0,0 +1,432 @@
+#include "boot.h"
+#include "mailbox.h"
+#include "linboard_config.h"
+
+#include <cstring>
+
+// N_Cr, longest gap between consecutive frames before a transfer is dropped
+#define BOOT_CF_TIMEOUT_MS 1000
+
+// Jobs for the flash thread, 0 and 1 are block buffer indexes
+#define JOB_ERASE 2
+#define JOB_VERIFY 3
+#define JOB_RUN 4
+
+enum class BlockState : uint8_t
+{
+    Free,
+    Filling,
+    Full
+};
+
+typedef struct {
+    uint8_t data[BOOT_BLOCK_SIZE];
+    uint16_t nLength;
+    volatile BlockState eState;
+} stBlock;
+
+// Two buffers so one page is programmed while the next block arrives
+static stBlock blocks[2];
+
+static mailbox_t bootMb;
+static msg_t bootMbBuf[4];
+
+static volatile BootState eState = BootState::Idle;
+static volatile BootResult eLastResult = BootResult::Ok;
+static uint32_t nImageSize;
+static uint32_t nImageCrc;
+static uint64_t nPagesWritten; // Bitmap of staging pages holding data
+
+// Reassembly of the multi-frame message in progress
+static int8_t nRxBlock = -1;
+static uint16_t nRxLength;
+static uint16_t nRxPos;
+static uint8_t nRxSn;
+static bool bRxWaiting;
+static uint8_t rxFirstData[6]; // First frame payload held while waiting for a buffer
+static systime_t nRxLastTime;
+
+static_assert(BOOT_PAGE_COUNT <= 64, "Page bitmap holds 64 pages");
+
+static void SendFrame(const uint8_t *data, uint8_t nLength)
+{
+    CANTxFrame msg;
+    msg.SID = BOOT_TX_ID;
+    msg.IDE = CAN_IDE_STD;
+    msg.RTR = CAN_RTR_DATA;
+    msg.DLC = 8;
+    memset(msg.data8, 0xAA, 8);
+    memcpy(msg.data8, data, nLength);
+    PostTxFrame(&msg, CanTxClass::Control);
+}
+
+static void SendFlowControl(uint8_t nFlag)
+{
+    uint8_t data[3] = {(uint8_t)(BOOT_PCI_FC | nFlag), 0, BOOT_STMIN};
+    SendFrame(data, 3);
+}
+
+static void SendResponse(uint8_t nCmd, BootResult eResult)
+{
+    uint8_t data[3] = {2, (uint8_t)(nCmd | 0x40), (uint8_t)eResult};
+    SendFrame(data, 3);
+}
+
+static uint8_t PagesInImage()
+{
+    return (nImageSize + BOOT_PAGE_SIZE - 1) / BOOT_PAGE_SIZE;
+}
+
+// Staging record erased first, an old record never describes new data
+static void EraseRecord()
+{
+    BootFlashUnlock();
+    const bool bOk = BootFlashErasePage(BOOT_STAGING_RECORD);
+    BootFlashLock();
+
+    eLastResult = bOk ? BootResult::Ok : BootResult::FlashError;
+    eState = bOk ? BootState::Receiving : BootState::Error;
+    SendResponse(BOOT_CMD_START, eLastResult);
+}
+
+// Each page is erased just before it is programmed, a single bank stalls
+// every flash fetch during an erase and one page at a time keeps that
+// within what the CAN FIFOs and the flow control cover
+static void WriteBlock(stBlock *block)
+{
+    const uint8_t *d = block->data;
+    const uint32_t nOffset = d[1] | (d[2] << 8) | (d[3] << 16) | ((uint32_t)d[4] << 24);
+    const uint8_t nPage = nOffset / BOOT_PAGE_SIZE;
+
+    // Resent blocks land on pages that already hold the same data
+    if (!(nPagesWritten & (1ULL << nPage)))
+    {
+        BootFlashUnlock();
+        const bool bOk = BootFlashErasePage(BOOT_STAGING_START + nOffset) &&
+                         BootFlashProgram(BOOT_STAGING_START + nOffset, &d[BOOT_BLOCK_HEADER], block->nLength - BOOT_BLOCK_HEADER);
+        BootFlashLock();
+
+        if (bOk)
+            nPagesWritten |= 1ULL << nPage;
+        else
+        {
+            eLastResult = BootResult::FlashError;
+            eState = BootState::Error;
+        }
+    }
+
+    block->eState = BlockState::Free;
+}
+
+static void Verify()
+{
+    const uint64_t nAllPages = (PagesInImage() == 64) ? ~0ULL : ((1ULL << PagesInImage()) - 1);
+
+    if (nPagesWritten != nAllPages)
+        eLastResult = BootResult::BadSequence;
+    else if (BootCrc32((const uint8_t *)(uintptr_t)BOOT_STAGING_START, nImageSize) != nImageCrc)
+        eLastResult = BootResult::CrcMismatch;
+    else if (!BootRecordValid(BOOT_STAGING_RECORD))
+    {
+        // The record is what the loader installs from
+        BootFlashUnlock();
+        const bool bOk = BootWriteRecord(BOOT_STAGING_RECORD, nImageSize, nImageCrc);
+        BootFlashLock();
+        eLastResult = bOk ? BootResult::Ok : BootResult::FlashError;
+    }
+    else
+        eLastResult = BootResult::Ok;
+
+    eState = (eLastResult == BootResult::Ok) ? BootState::Verified : BootState::Error;
+    SendResponse(BOOT_CMD_VERIFY, eLastResult);
+}
+
+// Programs flash off the CAN Rx thread so reception continues meanwhile
+static THD_WORKING_AREA(waBootThread, 256);
+void BootThread(void *)
+{
+    chRegSetThreadName("Boot");
+
+    msg_t nJob;
+
+    while (true)
+    {
+        chMBFetchTimeout(&bootMb, &nJob, TIME_INFINITE);
+
+        switch (nJob)
+        {
+        case 0:
+        case 1:
+            WriteBlock(&blocks[nJob]);
+            break;
+        case JOB_ERASE:
+            EraseRecord();
+            break;
+        case JOB_VERIFY:
+            Verify();
+            break;
+        case JOB_RUN:
+            // Let the response leave before the bus goes quiet, the loader
+            // installs the staged image after the reset
+            chThdSleepMilliseconds(20);
+            NVIC_SystemReset();
+            break;
+        }
+    }
+}
+
+static void HandleMessage(const uint8_t *d, uint16_t nLength, int8_t nBlock)
+{
+    const uint8_t nCmd = d[0];
+
+    switch (nCmd)
+    {
+    case BOOT_CMD_START:
+    {
+        if (nLength < 9)
+        {
+            SendResponse(nCmd, BootResult::BadLength);
+            break;
+        }
+        // A page still programming would land in the new image
+        if ((eState == BootState::Erasing) ||
+            (blocks[0].eState == BlockState::Full) || (blocks[1].eState == BlockState::Full))
+        {
+            SendResponse(nCmd, BootResult::Busy);
+            break;
+        }
+        const uint32_t nSize = d[1] | (d[2] << 8) | (d[3] << 16) | ((uint32_t)d[4] << 24);
+        if ((nSize == 0) || (nSize > BOOT_IMAGE_MAX))
+        {
+            SendResponse(nCmd, BootResult::BadLength);
+            break;
+        }
+        nImageSize = nSize;
+        nImageCrc = d[5] | (d[6] << 8) | (d[7] << 16) | ((uint32_t)d[8] << 24);
+        nPagesWritten = 0;
+        eState = BootState::Erasing;
+        chMBPostTimeout(&bootMb, JOB_ERASE, TIME_IMMEDIATE);
+        break;
+    }
+
+    case BOOT_CMD_DATA:
+    {
+        if (nBlock < 0)
+            break;
+
+        const uint32_t nOffset = d[1] | (d[2] << 8) | (d[3] << 16) | ((uint32_t)d[4] << 24);
+        const uint16_t nData = nLength - BOOT_BLOCK_HEADER;
+
+        // Not acknowledged, the host collects failures with STATUS
+        if ((eState != BootState::Receiving) || (nLength <= BOOT_BLOCK_HEADER) ||
+            (nOffset % BOOT_PAGE_SIZE) || (nOffset + nData > nImageSize))
+        {
+            eLastResult = BootResult::BadOffset;
+            blocks[nBlock].eState = BlockState::Free;
+            break;
+        }
+
+        blocks[nBlock].nLength = nLength;
+        blocks[nBlock].eState = BlockState::Full;
+        chMBPostTimeout(&bootMb, nBlock, TIME_IMMEDIATE);
+        return;
+    }
+
+    case BOOT_CMD_STATUS:
+    {
+        uint8_t nDone = 0;
+        uint8_t nFirstMissing = 0xFF;
+        for (uint8_t p = 0; p < PagesInImage(); p++)
+        {
+            if (nPagesWritten & (1ULL << p))
+                nDone++;
+            else if (nFirstMissing == 0xFF)
+                nFirstMissing = p;
+        }
+        uint8_t data[6] = {5, (uint8_t)(nCmd | 0x40), (uint8_t)eState, (uint8_t)eLastResult, nDone, nFirstMissing};
+        SendFrame(data, 6);
+        break;
+    }
+
+    case BOOT_CMD_VERIFY:
+        if ((eState != BootState::Receiving) && (eState != BootState::Verified))
+        {
+            SendResponse(nCmd, BootResult::BadSequence);
+            break;
+        }
+        chMBPostTimeout(&bootMb, JOB_VERIFY, TIME_IMMEDIATE);
+        break;
+
+    case BOOT_CMD_RUN:
+        if (eState != BootState::Verified)
+        {
+            SendResponse(nCmd, BootResult::BadSequence);
+            break;
+        }
+        SendResponse(nCmd, BootResult::Ok);
+        chMBPostTimeout(&bootMb, JOB_RUN, TIME_IMMEDIATE);
+        break;
+    }
+
+    if (nBlock >= 0)
+        blocks[nBlock].eState = BlockState::Free;
+}
+
+static int8_t ClaimBlock()
+{
+    for (int8_t i = 0; i < 2; i++)
+    {
+        if (blocks[i].eState == BlockState::Free)
+        {
+            blocks[i].eState = BlockState::Filling;
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void AbortRx()
+{
+    if (nRxBlock >= 0)
+        blocks[nRxBlock].eState = BlockState::Free;
+    nRxBlock = -1;
+    bRxWaiting = false;
+}
+
+void InitBoot(void)
+{
+    chMBObjectInit(&bootMb, bootMbBuf, 4);
+
+    for (auto &block : blocks)
+        block.eState = BlockState::Free;
+
+    chThdCreateStatic(waBootThread, sizeof(waBootThread), NORMALPRIO, BootThread, nullptr);
+}
+
+// ISO-TP receiver for BOOT_RX_ID and BOOT_BROADCAST_ID, called from the CAN Rx thread.
+// Broadcast transfers get no flow control, the host paces consecutive
+// frames and resends whatever STATUS reports missing.
+void BootReceive(const CANRxFrame *frame)
+{
+    const uint8_t *d = frame->data8;
+    const bool bBroadcast = frame->SID == BOOT_BROADCAST_ID;
+
+    if (frame->DLC < 1)
+        return;
+
+    switch (d[0] & 0xF0)
+    {
+    case BOOT_PCI_SF:
+    {
+        const uint8_t nLength = d[0] & 0x0F;
+        if ((nLength == 0) || (nLength > 7) || (nLength >= frame->DLC))
+            return;
+        AbortRx();
+        HandleMessage(&d[1], nLength, -1);
+        break;
+    }
+
+    case BOOT_PCI_FF:
+    {
+        const uint16_t nLength = ((d[0] & 0x0F) << 8) | d[1];
+        AbortRx();
+
+        if ((frame->DLC < 8) || (nLength < 8))
+            return;
+
+        if (nLength > BOOT_BLOCK_SIZE)
+        {
+            if (!bBroadcast)
+                SendFlowControl(BOOT_FC_OVFL);
+            return;
+        }
+
+        nRxLength = nLength;
+        nRxPos = 6;
+        nRxSn = 1;
+        nRxLastTime = chVTGetSystemTimeX();
+        nRxBlock = ClaimBlock();
+
+        if (nRxBlock < 0)
+        {
+            // Both pages still programming, hold the sender off
+            if (!bBroadcast)
+            {
+                bRxWaiting = true;
+                memcpy(rxFirstData, &d[2], 6);
+                SendFlowControl(BOOT_FC_WAIT);
+            }
+            return;
+        }
+
+        memcpy(blocks[nRxBlock].data, &d[2], 6);
+        if (!bBroadcast)
+            SendFlowControl(BOOT_FC_CTS);
+        break;
+    }
+
+    case BOOT_PCI_CF:
+    {
+        if (nRxBlock < 0)
+            return;
+
+        if ((d[0] & 0x0F) != nRxSn)
+        {
+            AbortRx();
+            return;
+        }
+        nRxSn = (nRxSn + 1) & 0x0F;
+        nRxLastTime = chVTGetSystemTimeX();
+
+        uint8_t nCopy = nRxLength - nRxPos;
+        if (nCopy > 7)
+            nCopy = 7;
+        if (nCopy > frame->DLC - 1)
+        {
+            AbortRx();
+            return;
+        }
+
+        memcpy(&blocks[nRxBlock].data[nRxPos], &d[1], nCopy);
+        nRxPos += nCopy;
+
+        if (nRxPos == nRxLength)
+        {
+            const int8_t nBlock = nRxBlock;
+            nRxBlock = -1;
+            HandleMessage(blocks[nBlock].data, nRxLength, nBlock);
+        }
+        break;
+    }
+    }
+}
+
+// Called every ms from the CAN Rx thread
+void BootPeriodic(void)
+{
+    if (nRxBlock < 0 && !bRxWaiting)
+        return;
+
+    if (bRxWaiting)
+    {
+        nRxBlock = ClaimBlock();
+        if (nRxBlock >= 0)
+        {
+            bRxWaiting = false;
+            memcpy(blocks[nRxBlock].data, rxFirstData, 6);
+            nRxLastTime = chVTGetSystemTimeX();
+            SendFlowControl(BOOT_FC_CTS);
+        }
+        else if (chTimeI2MS(chVTTimeElapsedSinceX(nRxLastTime)) > BOOT_CF_TIMEOUT_MS)
+            AbortRx();
+        return;
+    }
+
+    if (chTimeI2MS(chVTTimeElapsedSinceX(nRxLastTime)) > BOOT_CF_TIMEOUT_MS)
+        AbortRx();
+}
+
+BootState GetBootState(void)
+{
+    return eState;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+#include "hal.h"
+#include "bootflash.h"
+#include "bootproto.h"
+
+// The application receives an update into the staging area and resets
+// once it is verified, the resident loader (loader/loader.cpp) installs
+// it. The same protocol is served by the loader while no valid
+// application is present.
+
+void InitBoot(void);
+void BootReceive(const CANRxFrame *frame);
+void BootPeriodic(void);
+BootState GetBootState(void);
@@ -0,0 +1,109 @@
+#include "bootflash.h"
+#include "board.h"
+#include "stm32f3xx.h"
+
+#include <cstring>
+
+// Built into both the application and the loader, only registers and
+// the C library are used. The core stalls on flash fetches while a page is
+// erased or a half word programmed.
+
+// CRC-32 (IEEE 802.3), nibble table to keep the flash footprint small
+uint32_t BootCrc32(const uint8_t *data, uint32_t nLength)
+{
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+
+    uint32_t nCrc = 0xFFFFFFFF;
+    for (uint32_t i = 0; i < nLength; i++)
+    {
+        nCrc ^= data[i];
+        nCrc = (nCrc >> 4) ^ table[nCrc & 0x0F];
+        nCrc = (nCrc >> 4) ^ table[nCrc & 0x0F];
+    }
+    return ~nCrc;
+}
+
+void BootFlashUnlock(void)
+{
+    if (FLASH->CR & FLASH_CR_LOCK)
+    {
+        FLASH->KEYR = FLASH_KEY1;
+        FLASH->KEYR = FLASH_KEY2;
+    }
+}
+
+void BootFlashLock(void)
+{
+    FLASH->CR |= FLASH_CR_LOCK;
+}
+
+static bool FlashWait(void)
+{
+    while (FLASH->SR & FLASH_SR_BSY)
+        ;
+
+    const uint32_t nErrors = FLASH->SR & (FLASH_SR_PGERR | FLASH_SR_WRPERR);
+    FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPERR;
+    return nErrors == 0;
+}
+
+// Never erases the loader
+bool BootFlashErasePage(uint32_t nAddr)
+{
+    if (nAddr < BOOT_APP_START)
+        return false;
+
+    FLASH->CR |= FLASH_CR_PER;
+    FLASH->AR = nAddr;
+    FLASH->CR |= FLASH_CR_STRT;
+    const bool bOk = FlashWait();
+    FLASH->CR &= ~FLASH_CR_PER;
+    return bOk;
+}
+
+bool BootFlashProgram(uint32_t nAddr, const uint8_t *data, uint16_t nLength)
+{
+    if (nAddr < BOOT_APP_START)
+        return false;
+
+    bool bOk = true;
+
+    FLASH->CR |= FLASH_CR_PG;
+    for (uint16_t i = 0; (i < nLength) && bOk; i += 2)
+    {
+        // Odd tail padded with the erased value
+        const uint16_t nHalf = data[i] | ((i + 1 < nLength ? data[i + 1] : 0xFF) << 8);
+        *(volatile uint16_t *)(uintptr_t)(nAddr + i) = nHalf;
+        bOk = FlashWait();
+    }
+    FLASH->CR &= ~FLASH_CR_PG;
+
+    return bOk && (memcmp((const void *)(uintptr_t)nAddr, data, nLength) == 0);
+}
+
+// Programs the record into its erased page, flash unlocked by the caller
+bool BootWriteRecord(uint32_t nRecord, uint32_t nSize, uint32_t nCrc)
+{
+    const stBootRecord record = BootMakeRecord(nSize, nCrc);
+    return BootFlashProgram(nRecord, (const uint8_t *)&record, sizeof(record));
+}
+
+bool BootRecordValid(uint32_t nRecord)
+{
+    const stBootRecord *r = (const stBootRecord *)(uintptr_t)nRecord;
+    const stBootRecord expected = BootMakeRecord(r->nSize, r->nCrc);
+
+    return (r->nMagic == expected.nMagic) && (r->nCheck == expected.nCheck) &&
+           (r->nSize != 0) && (r->nSize <= BOOT_IMAGE_MAX);
+}
+
+bool BootImageValid(uint32_t nStart, uint32_t nRecord)
+{
+    if (!BootRecordValid(nRecord))
+        return false;
+
+    const stBootRecord *r = (const stBootRecord *)(uintptr_t)nRecord;
+    return BootCrc32((const uint8_t *)(uintptr_t)nStart, r->nSize) == r->nCrc;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ * Flash layout shared by the resident loader, the application and the
+ * host image tool. The loader owns the first pages and is never written
+ * by an update. The application and the staging area are the same size,
+ * the last page of each holds the record of the image in it.
+ *
+ * An update is received into staging and its record written once the CRC
+ * checked out. At reset the loader copies a staging image whose record
+ * differs from the application's, erasing the application record first
+ * and writing it last, so a copy cut short is redone on the next reset.
+ * Without a valid application the loader stays in its CAN update loop.
+ */
+#define BOOT_PAGE_SIZE 2048
+#define BOOT_LOADER_START 0x08000000U
+#define BOOT_LOADER_SIZE 0x4000U
+#define BOOT_APP_START (BOOT_LOADER_START + BOOT_LOADER_SIZE)
+#define BOOT_REGION_SIZE 0x1E000U
+#define BOOT_STAGING_START (BOOT_APP_START + BOOT_REGION_SIZE)
+#define BOOT_APP_RECORD (BOOT_STAGING_START - BOOT_PAGE_SIZE)
+#define BOOT_STAGING_RECORD (BOOT_STAGING_START + BOOT_REGION_SIZE - BOOT_PAGE_SIZE)
+#define BOOT_IMAGE_MAX (BOOT_REGION_SIZE - BOOT_PAGE_SIZE)
+#define BOOT_PAGE_COUNT (BOOT_IMAGE_MAX / BOOT_PAGE_SIZE)
+
+#define BOOT_RECORD_MAGIC 0x54494D47U
+
+// nCheck is the complement of the other words xored, a record cut short
+// while programming reads back partly erased and fails it
+typedef struct {
+    uint32_t nMagic;
+    uint32_t nSize;
+    uint32_t nCrc;
+    uint32_t nCheck;
+} stBootRecord;
+
+static_assert(BOOT_STAGING_RECORD + BOOT_PAGE_SIZE == 0x08040000U, "Layout fills the 256k of flash");
+
+constexpr stBootRecord BootMakeRecord(uint32_t nSize, uint32_t nCrc)
+{
+    return {BOOT_RECORD_MAGIC, nSize, nCrc, ~(BOOT_RECORD_MAGIC ^ nSize ^ nCrc)};
+}
+
+uint32_t BootCrc32(const uint8_t *data, uint32_t nLength);
+
+// Device side, single bank flash with half word programming
+void BootFlashUnlock(void);
+void BootFlashLock(void);
+bool BootFlashErasePage(uint32_t nAddr);
+bool BootFlashProgram(uint32_t nAddr, const uint8_t *data, uint16_t nLength);
+bool BootWriteRecord(uint32_t nRecord, uint32_t nSize, uint32_t nCrc);
+bool BootRecordValid(uint32_t nRecord);
+bool BootImageValid(uint32_t nStart, uint32_t nRecord);
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include "bootflash.h"
+
+// Update protocol, served by the application (boot.cpp) and by the
+// resident loader (loader/loader.cpp)
+
+// ISO-TP protocol control information
+#define BOOT_PCI_SF 0x00
+#define BOOT_PCI_FF 0x10
+#define BOOT_PCI_CF 0x20
+#define BOOT_PCI_FC 0x30
+
+#define BOOT_FC_CTS 0x00
+#define BOOT_FC_WAIT 0x01
+#define BOOT_FC_OVFL 0x02
+
+// One DATA block is one flash page plus the command and offset header
+#define BOOT_BLOCK_HEADER 5
+#define BOOT_BLOCK_SIZE (BOOT_BLOCK_HEADER + BOOT_PAGE_SIZE)
+
+// Commands, carried as ISO-TP messages on BOOT_RX_ID or BOOT_BROADCAST_ID
+// Responses are sent on BOOT_TX_ID with bit 6 of the command set
+#define BOOT_CMD_START 0x10  // size u32, crc32 u32
+#define BOOT_CMD_DATA 0x11   // offset u32, up to one page of data
+#define BOOT_CMD_STATUS 0x12 // -> state, pages written, first missing page
+#define BOOT_CMD_VERIFY 0x13 // -> result
+#define BOOT_CMD_RUN 0x14    // -> result, then reset into the loader to install the image
+
+enum class BootState : uint8_t
+{
+    Idle,
+    Erasing,
+    Receiving,
+    Verified,
+    Error
+};
+
+enum class BootResult : uint8_t
+{
+    Ok,
+    Busy,
+    BadLength,
+    BadOffset,
+    BadSequence,
+    FlashError,
+    CrcMismatch
+};
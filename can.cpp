@@ -2,6 +2,16 @@
 #include "hal.h"
 #include "port.h"
 #include "mailbox.h"
+#include "txbudget.h"
+#include "txlatency.h"
+#include "analyzer.h"
+#include "j1939.h"
+#include "xcp.h"
+#include "boot.h"
+#include "ttcan.h"
+#include "settings.h"
+#include "sniffer.h"
+#include "lincache.h"
 #include "linboard_config.h"
 
 #include <iterator>
@@ -14,66 +24,186 @@ static bool bFilterExtended[STM32_CAN_MAX_FILTERS * 2];
 
 static uint32_t nLastCanRxTime;
 static bool bCanFilterEnabled = true;
+static CanBitrate eCanBitrate = CanBitrate::Bitrate_500K;
+static bool bCanListenOnly = false;
+
+// Copy of the bitrate table entry, silent mode is added for listen only
+static CANConfig canConfig;
 
 void ConfigureCanFilters();
 
+static const uint32_t nTmeMask[CAN_TX_MAILBOXES] = {CAN_TSR_TME0, CAN_TSR_TME1, CAN_TSR_TME2};
+
+// Hardware mailbox (1 to CAN_TX_MAILBOXES) that is empty, 0 if all are busy
+static uint8_t FindFreeTxMailbox()
+{
+    uint32_t nTsr = CAND1.can->TSR;
+
+    for (uint8_t i = 0; i < CAN_TX_MAILBOXES; i++)
+    {
+        // The time-triggered schedule owns its mailbox while running
+        if ((i + 1 == TTCAN_MAILBOX) && TtcanIsActive())
+            continue;
+
+        if (nTsr & nTmeMask[i])
+            return i + 1;
+    }
+    return 0;
+}
+
+// Signalled whenever a hardware mailbox frees up
+static binary_semaphore_t txMailboxSem;
+
+static void CanTxEmptyCb(CANDriver *, uint32_t flags)
+{
+    TxLatencyCompleteI(flags);
+    TtcanCompleteI(flags);
+
+    osalSysLockFromISR();
+    chBSemSignalI(&txMailboxSem);
+    osalSysUnlockFromISR();
+}
+
 static THD_WORKING_AREA(waCanTxThread, 256);
 void CanTxThread(void *)
 {
     chRegSetThreadName("CAN Tx");
 
     CANTxFrame msg;
+    rtcnt_t nEnqueueTime;
+    stTxClassBudget classBudget;
+
+    // Head frame of each class already counted as deferred
+    bool bHeadDeferred[CAN_TX_CLASS_COUNT] = {};
 
     while (1)
     {
-        // Send all messages in the TX queue
-        msg_t res;
-        do
+        TxBudgetRefill();
+        TxLatencyPoll();
+
+        // Serve the classes in priority order, Control first
+        for (uint8_t c = 0; c < CAN_TX_CLASS_COUNT; c++)
         {
-            res = FetchTxFrame(&msg);
-            if (res == MSG_OK)
-            {
-                msg.IDE = CAN_IDE_STD;
-                msg.RTR = CAN_RTR_DATA;
-                res = canTransmitTimeout(&CAND1, CAN_ANY_MAILBOX, &msg, TIME_IMMEDIATE);
-                // Returns true if mailbox full or nothing connected
-                // TODO: What to do if no tx?
+            const CanTxClass eClass = static_cast<CanTxClass>(c);
 
-                chThdSleepMicroseconds(CAN_TX_MSG_SPLIT);
+            while (PeekTxFrame(&msg, eClass, &nEnqueueTime) == MSG_OK)
+            {
+                const uint32_t nBits = CanFrameBits(&msg);
+
+                if (!TxBudgetAvailable(eClass, nBits))
+                {
+                    GetTxClassBudget(eClass, &classBudget);
+                    if (classBudget.bShed)
+                    {
+                        FetchTxFrame(&msg, eClass);
+                        TxBudgetCountShed(eClass);
+                        continue;
+                    }
+
+                    // Leave it at the head of the queue until tokens are available
+                    if (!bHeadDeferred[c])
+                    {
+                        TxBudgetCountDeferred(eClass);
+                        bHeadDeferred[c] = true;
+                    }
+                    break;
+                }
+
+                // Mailboxes full or nothing connected, try again next pass
+                const uint8_t nMailbox = FindFreeTxMailbox();
+                if (nMailbox == 0)
+                    break;
+
+                TxLatencyLoad(nMailbox, &msg, eClass, nEnqueueTime);
+                if (canTransmitTimeout(&CAND1, nMailbox, &msg, TIME_IMMEDIATE) != MSG_OK)
+                {
+                    TxLatencyCancel(nMailbox);
+                    break;
+                }
+
+                TxBudgetConsume(eClass, nBits);
+                FetchTxFrame(&msg, eClass);
+                bHeadDeferred[c] = false;
             }
-        } while (res == MSG_OK);
+        }
 
         if (chThdShouldTerminateX())
             chThdExit(MSG_OK);
 
-        chThdSleepMicroseconds(30);
+        // Back as soon as a mailbox frees up so the bus never idles with
+        // frames queued, otherwise one tick to pick up new frames
+        chBSemWaitTimeout(&txMailboxSem, 1);
     }
 }
 
-static THD_WORKING_AREA(waCanRxThread, 128);
-void CanRxThread(void *)
+// Frames are taken straight from the hardware FIFO in the interrupt so
+// nothing is lost at full bus load
+static void CanRxFullCb(CANDriver *canp, uint32_t)
 {
     CANRxFrame msg;
+    CANTxFrame reply;
 
-    chRegSetThreadName("CAN Rx");
+    osalSysLockFromISR();
 
-    while (true)
+    // Drain both FIFOs, the driver re-enables the interrupt once they are empty
+    while (!canTryReceiveI(canp, CAN_ANY_MAILBOX, &msg))
     {
+        nLastCanRxTime = SYS_TIME;
 
-        msg_t res = canReceiveTimeout(&CAND1, CAN_ANY_MAILBOX, &msg, TIME_IMMEDIATE);
-        if (res == MSG_OK)
+        AnalyzerRecordI(&msg);
+        SnifferRecordI(&msg);
+        TtcanReferenceI(&msg);
+
+        // Remote requests for LIN data are answered without a trip
+        // through the Rx thread, the TX thread is woken straight away
+        if (!bCanListenOnly && LinRtrAnswerI(&msg, &reply))
         {
-            nLastCanRxTime = SYS_TIME;
+            PostTxFrameI(&reply, CanTxClass::Control);
+            chBSemSignalI(&txMailboxSem);
+        }
 
-            res = PostRxFrame(&msg);
-            //palToggleLine(LINE_E2);
-            // TODO:What to do if mailbox is full?
+        PostRxFrameI(&msg);
+        // TODO:What to do if mailbox is full?
+    }
+
+    osalSysUnlockFromISR();
+}
+
+static void CanErrorCb(CANDriver *, uint32_t flags)
+{
+    osalSysLockFromISR();
+    SnifferErrorI(flags);
+    osalSysUnlockFromISR();
+}
+
+// Hands received frames to the protocol layers, the ISR only queues them
+static THD_WORKING_AREA(waCanRxThread, 512);
+void CanRxThread(void *)
+{
+    chRegSetThreadName("CAN Rx");
+
+    CANRxFrame msg;
+
+    while (true)
+    {
+        // Wakes as soon as a frame is posted, the timeout keeps the protocol timers running
+        while (FetchRxFrame(&msg, chTimeMS2I(1)) == MSG_OK)
+        {
+            if (msg.IDE == CAN_IDE_EXT)
+                J1939Receive(&msg);
+            else if (msg.SID == CAN_BASE_ID - 1)
+                SettingsReceive(&msg);
+            else if (msg.SID == XCP_CRO_ID)
+                XcpReceive(&msg);
+            else if ((msg.SID == BOOT_RX_ID) || (msg.SID == BOOT_BROADCAST_ID))
+                BootReceive(&msg);
         }
 
+        J1939Periodic();
+        BootPeriodic();
+
         if (chThdShouldTerminateX())
             chThdExit(MSG_OK);
-
-        chThdSleepMicroseconds(30);
     }
 }
 
@@ -81,37 +211,87 @@ static thread_t *canCyclicTxThreadRef;
 static thread_t *canTxThreadRef;
 static thread_t *canRxThreadRef;
 
-msg_t InitCan(CanBitrate eBitrate, bool bEnableFilters)
+msg_t InitCan(CanBitrate eBitrate, bool bEnableFilters, bool bListenOnly)
 {
     if (canCyclicTxThreadRef || canTxThreadRef || canRxThreadRef)
     {
         StopCan();
     }
 
+    eCanBitrate = eBitrate;
+    bCanListenOnly = bListenOnly;
+
     SetCanFilterEnabled(bEnableFilters);
 
-    ConfigureCanFilters();
+    // A sniffer has to see everything on the bus
+    if (bListenOnly)
+        canSTM32SetFilters(&CAND1, STM32_CAN_MAX_FILTERS, 0, NULL);
+    else
+        ConfigureCanFilters();
+
+    InitTxBudget(eBitrate);
+    InitTxLatency();
+    InitAnalyzer();
+    SetSnifferActive(bListenOnly);
+
+    chBSemObjectInit(&txMailboxSem, false);
+
+    CAND1.txempty_cb = CanTxEmptyCb;
+    CAND1.rxfull_cb = CanRxFullCb;
+    CAND1.error_cb = CanErrorCb;
+
+    // Silent mode, the controller neither ACKs nor sends error frames
+    canConfig = GetCanConfig(eBitrate);
+    if (bListenOnly)
+        canConfig.btr |= CAN_BTR_SILM;
 
-    msg_t ret = canStart(&CAND1, &GetCanConfig(eBitrate));
+    msg_t ret = canStart(&CAND1, &canConfig);
     if (ret != HAL_RET_SUCCESS)
         return ret;
-    canTxThreadRef = chThdCreateStatic(waCanTxThread, sizeof(waCanTxThread), NORMALPRIO + 1, CanTxThread, nullptr);
+
+    // Nothing may be transmitted while listening, frames posted meanwhile
+    // are shed by their class queues
+    if (!bListenOnly)
+        canTxThreadRef = chThdCreateStatic(waCanTxThread, sizeof(waCanTxThread), NORMALPRIO + 1, CanTxThread, nullptr);
     canRxThreadRef = chThdCreateStatic(waCanRxThread, sizeof(waCanRxThread), NORMALPRIO + 1, CanRxThread, nullptr);
 
+#if J1939_ENABLE
+    if (!bListenOnly)
+        InitJ1939(J1939_NAME, J1939_PREFERRED_ADDRESS);
+#endif
+
     return HAL_RET_SUCCESS;
 }
 
+msg_t SetCanListenOnly(bool bListenOnly)
+{
+    return InitCan(eCanBitrate, bCanFilterEnabled, bListenOnly);
+}
+
+bool GetCanListenOnly()
+{
+    return bCanListenOnly;
+}
+
 void StopCan()
 {
+    TtcanStop();
+
+    thread_t *threads[] = {canCyclicTxThreadRef, canTxThreadRef, canRxThreadRef};
+
     // Signal threads to terminate
-    chThdTerminate(canCyclicTxThreadRef);
-    chThdTerminate(canTxThreadRef);
-    chThdTerminate(canRxThreadRef);
+    for (thread_t *tp : threads)
+    {
+        if (tp)
+            chThdTerminate(tp);
+    }
 
     // Wait for threads to exit
-    chThdWait(canCyclicTxThreadRef);
-    chThdWait(canTxThreadRef);
-    chThdWait(canRxThreadRef);
+    for (thread_t *tp : threads)
+    {
+        if (tp)
+            chThdWait(tp);
+    }
 
     // Stop CAN driver
     canStop(&CAND1);
@@ -165,11 +345,20 @@ void ConfigureCanFilters()
         return;
     }
 
-    uint8_t nCurrentFilter = 0;
+    // Bank 0 always passes the board's own request IDs, 16-bit list mode
+    // holds four standard IDs (STID in bits 15:5)
+    canfilters[0].filter = 0;
+    canfilters[0].assignment = 0;
+    canfilters[0].mode = 1;
+    canfilters[0].scale = 0;
+    canfilters[0].register1 = ((CAN_BASE_ID - 1) << 5) | (XCP_CRO_ID << 21);
+    canfilters[0].register2 = (BOOT_RX_ID << 5) | (BOOT_BROADCAST_ID << 21);
+
+    uint8_t nCurrentFilter = 1;
 
     // Go through nFilterIds and set filter register1 and register2 for each filter if ID is set
     // CANNOT SET ALL FILTERS, MUST USE ONLY THE NUMBER OF REQUIRED FILTERS
-    for (uint8_t i = 0; i < (STM32_CAN_MAX_FILTERS * 2); i += 2)
+    for (uint8_t i = 0; (i < (STM32_CAN_MAX_FILTERS * 2)) && (nCurrentFilter < STM32_CAN_MAX_FILTERS); i += 2)
     {
         if (nFilterIds[i] != 0 || nFilterIds[i + 1] != 0)
         {
@@ -195,7 +384,7 @@ void ConfigureCanFilters()
     }
 
     // Apply all filter configurations
-    // If no CAN inputs are enabled, filter[0].register1 is still set to settings request message ID (BaseId-1)
+    // If no CAN inputs are enabled, filter[0] still passes the settings request message ID (BaseId-1)
     canSTM32SetFilters(&CAND1, STM32_CAN_MAX_FILTERS, nCurrentFilter, canfilters);
 }
 
@@ -4,7 +4,9 @@
 #include "port.h"
 #include "enums.h"
 
-msg_t InitCan(CanBitrate eBitrate, bool bEnableFilters = false);
+msg_t InitCan(CanBitrate eBitrate, bool bEnableFilters = false, bool bListenOnly = false);
+msg_t SetCanListenOnly(bool bListenOnly);
+bool GetCanListenOnly(void);
 void StopCan(void);
 void ClearCanFilters(void);
 void SetCanFilterId(uint8_t nFilterNum, uint32_t nId, bool bExtended);
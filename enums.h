@@ -10,6 +10,15 @@ enum class CanBitrate : uint8_t
     Bitrate_125K
 };
 
+enum class CanTxClass : uint8_t
+{
+    Control,
+    Gateway,
+    Telemetry,
+    Debug,
+    Daq     // XCP DAQ DTOs, after Debug so the class numbers used by the host stay put
+};
+
 enum class FatalErrorType : uint8_t
 {
   NoError = 0,
@@ -34,4 +43,58 @@ enum class LedType
     Status,
     Lin,
     Can
+};
+
+enum class LinDirection : uint8_t
+{
+    Publish,   // Master sends header and response
+    Subscribe  // Master sends the header, a slave responds
+};
+
+enum class LinResult : uint8_t
+{
+    Ok,
+    Busy,       // A frame is already on the bus
+    NoResponse, // Header sent, no response byte seen
+    Timeout,    // Response started but did not finish in time
+    Checksum,
+    BitError,   // Readback differs from the byte sent
+    Framing,
+    Parity,     // Protected identifier parity bits do not match the ID
+    Count
+};
+
+enum class LinMode : uint8_t
+{
+    Master, // Runs the schedule tables
+    Slave,  // Answers headers from the response table
+    Monitor // Receive only, every frame on the bus is recorded
+};
+
+enum class LinChecksumModel : uint8_t
+{
+    Classic, // Data bytes only, LIN 1.x and diagnostic frames
+    Enhanced // PID and data bytes, LIN 2.x
+};
+
+enum class ByteOrder : uint8_t
+{
+    Intel,   // Little endian, start bit is the LSB
+    Motorola // Big endian, start bit is the MSB
+};
+
+enum class LinTpStatus : uint8_t
+{
+    Idle,
+    Pending,  // Queued or in transfer
+    Ok,       // Positive response, or sent when no response is expected
+    Negative, // Slave answered with a negative response
+    Timeout,  // No complete response in time
+    Error     // Malformed or out of sequence response, or too long
+};
+
+enum class LinPowerState : uint8_t
+{
+    Awake,
+    Asleep  // Transceiver in sleep mode, waiting for a wakeup
 };
\ No newline at end of file
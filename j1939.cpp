@@ -0,0 +1,667 @@
+#include "j1939.h"
+#include "port.h"
+#include "mailbox.h"
+#include "enums.h"
+
+#include <cstring>
+
+// TP.CM control bytes
+#define TP_CM_RTS 16
+#define TP_CM_CTS 17
+#define TP_CM_EOMA 19
+#define TP_CM_BAM 32
+#define TP_CM_ABORT 255
+
+// TP.CM abort reasons
+#define TP_ABORT_RESOURCES 2
+#define TP_ABORT_TIMEOUT 3
+
+// Timeouts from J1939-21, ms
+#define TP_T1 750
+#define TP_T2 1250
+#define TP_T3 1250
+#define ADDRESS_CLAIM_WAIT 250
+
+// Gap between BAM data packets, J1939-21 allows 50 to 200ms
+#define TP_BAM_GAP 50
+// Packets we accept per CTS
+#define TP_CTS_WINDOW 16
+// Packets we ask for per CTS when sending, a window fits the Gateway queue
+#define TP_RTS_WINDOW MAILBOX_SIZE
+
+#define TP_DT_SIZE 7
+
+// Range used when picking a new address after losing a claim
+#define DYNAMIC_ADDR_FIRST 128
+#define DYNAMIC_ADDR_LAST 247
+
+enum class TpTxState : uint8_t
+{
+    Idle,
+    BamData,
+    WaitCts,
+    CmdtData,
+    WaitEoma
+};
+
+typedef struct {
+    bool bUsed;
+    bool bBam;
+    uint8_t nSa;
+    uint8_t nDa;
+    uint32_t nPgn;
+    uint16_t nSize;
+    uint8_t nPackets;
+    uint8_t nNextSeq;
+    uint8_t nCtsMax;        // Packets per CTS, limited by the sender's RTS
+    uint8_t nWindowEnd;     // Last sequence number of the current CTS window
+    bool bAfterCts;         // No data packet received since the last CTS
+    uint32_t nLastTime;
+    uint8_t nData[J1939_TP_BUFFER_SIZE];
+} stTpRxSession;
+
+typedef struct {
+    TpTxState eState;
+    uint8_t nDa;
+    uint32_t nPgn;
+    uint16_t nSize;
+    uint8_t nPackets;
+    uint8_t nNextSeq;
+    uint8_t nWindowEnd;
+    uint32_t nLastTime;
+    uint8_t nData[J1939_TP_BUFFER_SIZE];
+} stTpTxSession;
+
+static bool bInitialized = false;
+static J1939AddrState eAddrState = J1939AddrState::Idle;
+static uint64_t nOwnName;
+static uint8_t nOwnAddress;
+static uint32_t nClaimTime;
+
+// Addresses claimed by other nodes, one bit per address
+static uint32_t nUsedAddresses[8];
+
+static stTpRxSession rxSessions[J1939_RX_SESSIONS];
+static stTpTxSession txSession;
+// J1939Send fills the session in the caller's thread, the CAN RX thread
+// runs it and handles CTS, EOMA and aborts
+static mutex_t txMtx;
+
+static J1939RxHandler rxHandler = nullptr;
+
+void J1939DecodeId(uint32_t nEid, stJ1939Id *id)
+{
+    const uint8_t nPf = (nEid >> 16) & 0xFF;
+    const uint8_t nPs = (nEid >> 8) & 0xFF;
+
+    id->nPriority = (nEid >> 26) & 0x07;
+    id->nSa = nEid & 0xFF;
+
+    // PDU1 (PF < 240) carries a destination address in PS, PDU2 a group extension
+    if (nPf < 240)
+    {
+        id->nPgn = (nEid >> 8) & 0x3FF00;
+        id->nDa = nPs;
+    }
+    else
+    {
+        id->nPgn = (nEid >> 8) & 0x3FFFF;
+        id->nDa = J1939_ADDR_GLOBAL;
+    }
+}
+
+uint32_t J1939EncodeId(uint8_t nPriority, uint32_t nPgn, uint8_t nDa, uint8_t nSa)
+{
+    uint32_t nId = ((uint32_t)(nPriority & 0x07) << 26) | ((nPgn & 0x3FFFF) << 8) | nSa;
+
+    if (((nPgn >> 8) & 0xFF) < 240)
+        nId = (nId & ~0xFF00U) | ((uint32_t)nDa << 8);
+
+    return nId;
+}
+
+// Never waits, a full class queue returns an error for the caller to retry
+// and the frame is only mirrored to USB once it is queued
+static msg_t SendFrame(uint8_t nPriority, uint32_t nPgn, uint8_t nDa, uint8_t nSa,
+                       const uint8_t *data, uint8_t nLength, CanTxClass eClass)
+{
+    CANTxFrame msg;
+    msg.EID = J1939EncodeId(nPriority, nPgn, nDa, nSa);
+    msg.IDE = CAN_IDE_EXT;
+    msg.RTR = CAN_RTR_DATA;
+    msg.DLC = nLength;
+    for (uint8_t i = 0; i < nLength; i++)
+        msg.data8[i] = data[i];
+    return PostTxFrameTimeout(&msg, eClass, TIME_IMMEDIATE);
+}
+
+static void SetPgn(uint8_t *data, uint32_t nPgn)
+{
+    data[5] = nPgn & 0xFF;
+    data[6] = (nPgn >> 8) & 0xFF;
+    data[7] = (nPgn >> 16) & 0xFF;
+}
+
+static uint32_t GetPgn(const uint8_t *data)
+{
+    return data[5] | ((uint32_t)data[6] << 8) | ((uint32_t)data[7] << 16);
+}
+
+static msg_t SendTpCm(uint8_t nDa, uint8_t nControl, uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4, uint32_t nPgn)
+{
+    uint8_t data[8] = {nControl, b1, b2, b3, b4, 0, 0, 0};
+    SetPgn(data, nPgn);
+    return SendFrame(7, J1939_PGN_TP_CM, nDa, nOwnAddress, data, 8, CanTxClass::Gateway);
+}
+
+static void SendAbort(uint8_t nDa, uint8_t nReason, uint32_t nPgn)
+{
+    SendTpCm(nDa, TP_CM_ABORT, nReason, 0xFF, 0xFF, 0xFF, nPgn);
+}
+
+/*
+ * Address claim
+ */
+
+static void MarkAddressUsed(uint8_t nAddress)
+{
+    nUsedAddresses[nAddress >> 5] |= (1U << (nAddress & 0x1F));
+}
+
+static bool AddressUsed(uint8_t nAddress)
+{
+    return nUsedAddresses[nAddress >> 5] & (1U << (nAddress & 0x1F));
+}
+
+static void SendAddressClaim()
+{
+    uint8_t data[8];
+    for (uint8_t i = 0; i < 8; i++)
+        data[i] = (nOwnName >> (i * 8)) & 0xFF;
+
+    const uint8_t nSa = (eAddrState == J1939AddrState::CannotClaim) ? J1939_ADDR_NULL : nOwnAddress;
+    SendFrame(J1939_DEFAULT_PRIORITY, J1939_PGN_ADDRESS_CLAIMED, J1939_ADDR_GLOBAL, nSa, data, 8, CanTxClass::Control);
+}
+
+static void StartClaim(uint8_t nAddress)
+{
+    nOwnAddress = nAddress;
+    eAddrState = J1939AddrState::Claiming;
+    nClaimTime = SYS_TIME;
+    SendAddressClaim();
+}
+
+// Lost our address to a node with a lower NAME
+static void ClaimLost()
+{
+    // Arbitrary address capable bit, the NAME's most significant bit
+    if (nOwnName >> 63)
+    {
+        for (uint16_t a = DYNAMIC_ADDR_FIRST; a <= DYNAMIC_ADDR_LAST; a++)
+        {
+            if (!AddressUsed(a) && (a != nOwnAddress))
+            {
+                StartClaim(a);
+                return;
+            }
+        }
+    }
+
+    eAddrState = J1939AddrState::CannotClaim;
+    SendAddressClaim();
+}
+
+static void HandleAddressClaim(const stJ1939Id *id, const CANRxFrame *frame)
+{
+    if (frame->DLC < 8)
+        return;
+
+    uint64_t nName = 0;
+    for (uint8_t i = 0; i < 8; i++)
+        nName |= (uint64_t)frame->data8[i] << (i * 8);
+
+    if (id->nSa < J1939_ADDR_NULL)
+        MarkAddressUsed(id->nSa);
+
+    if ((id->nSa != nOwnAddress) || (eAddrState == J1939AddrState::CannotClaim) ||
+        (eAddrState == J1939AddrState::Idle))
+        return;
+
+    // Lower NAME has priority
+    if (nName < nOwnName)
+        ClaimLost();
+    else if (nName > nOwnName)
+        SendAddressClaim();
+}
+
+static void HandleRequest(const stJ1939Id *id, const CANRxFrame *frame)
+{
+    if (frame->DLC < 3)
+        return;
+
+    uint32_t nPgn = frame->data8[0] | ((uint32_t)frame->data8[1] << 8) | ((uint32_t)frame->data8[2] << 16);
+
+    if (nPgn == J1939_PGN_ADDRESS_CLAIMED)
+    {
+        if (eAddrState != J1939AddrState::Idle)
+            SendAddressClaim();
+        return;
+    }
+
+    if (rxHandler)
+        rxHandler(J1939_PGN_REQUEST, id->nSa, id->nDa, frame->data8, frame->DLC);
+}
+
+/*
+ * Transport protocol, receive
+ */
+
+static stTpRxSession *FindRxSession(uint8_t nSa, bool bBam)
+{
+    for (uint8_t i = 0; i < J1939_RX_SESSIONS; i++)
+    {
+        if (rxSessions[i].bUsed && (rxSessions[i].nSa == nSa) && (rxSessions[i].bBam == bBam))
+            return &rxSessions[i];
+    }
+    return nullptr;
+}
+
+static stTpRxSession *AllocRxSession()
+{
+    for (uint8_t i = 0; i < J1939_RX_SESSIONS; i++)
+    {
+        if (!rxSessions[i].bUsed)
+        {
+            rxSessions[i].bUsed = true;
+            return &rxSessions[i];
+        }
+    }
+    return nullptr;
+}
+
+static void SendCts(stTpRxSession *s)
+{
+    uint8_t nRemaining = s->nPackets - s->nNextSeq + 1;
+    uint8_t nCount = nRemaining < s->nCtsMax ? nRemaining : s->nCtsMax;
+
+    s->nWindowEnd = s->nNextSeq + nCount - 1;
+    s->bAfterCts = true;
+    SendTpCm(s->nSa, TP_CM_CTS, nCount, s->nNextSeq, 0xFF, 0xFF, s->nPgn);
+}
+
+static void HandleTpCm(const stJ1939Id *id, const CANRxFrame *frame)
+{
+    if (frame->DLC < 8)
+        return;
+
+    const uint8_t *d = frame->data8;
+    const uint32_t nPgn = GetPgn(d);
+    const uint16_t nSize = d[1] | (d[2] << 8);
+
+    switch (d[0])
+    {
+    case TP_CM_BAM:
+    case TP_CM_RTS:
+    {
+        const bool bBam = (d[0] == TP_CM_BAM);
+
+        // A new announcement from the same sender replaces the old session
+        stTpRxSession *s = FindRxSession(id->nSa, bBam);
+        if (s == nullptr)
+            s = AllocRxSession();
+
+        // The packet count must match the size exactly, TP.DT offsets are
+        // taken from the sequence number
+        if ((s == nullptr) || (nSize > J1939_TP_BUFFER_SIZE) || (d[3] == 0) ||
+            (d[3] != (nSize + TP_DT_SIZE - 1) / TP_DT_SIZE))
+        {
+            if (s)
+                s->bUsed = false;
+            if (!bBam)
+                SendAbort(id->nSa, TP_ABORT_RESOURCES, nPgn);
+            return;
+        }
+
+        s->bBam = bBam;
+        s->nSa = id->nSa;
+        s->nDa = id->nDa;
+        s->nPgn = nPgn;
+        s->nSize = nSize;
+        s->nPackets = d[3];
+        s->nNextSeq = 1;
+        s->nCtsMax = ((d[4] != 0) && (d[4] < TP_CTS_WINDOW)) ? d[4] : TP_CTS_WINDOW;
+        s->bAfterCts = false;
+        s->nLastTime = SYS_TIME;
+
+        if (!bBam)
+            SendCts(s);
+        break;
+    }
+
+    case TP_CM_ABORT:
+    {
+        stTpRxSession *s = FindRxSession(id->nSa, false);
+        if (s && (s->nPgn == nPgn))
+            s->bUsed = false;
+
+        if ((txSession.eState != TpTxState::Idle) && (txSession.nDa == id->nSa) && (txSession.nPgn == nPgn))
+            txSession.eState = TpTxState::Idle;
+        break;
+    }
+
+    case TP_CM_CTS:
+        if ((txSession.eState != TpTxState::WaitCts) && (txSession.eState != TpTxState::CmdtData))
+            break;
+        if ((txSession.nDa != id->nSa) || (txSession.nPgn != nPgn))
+            break;
+
+        txSession.nLastTime = SYS_TIME;
+
+        // Zero packets means the receiver wants us to hold
+        if (d[1] == 0)
+        {
+            txSession.eState = TpTxState::WaitCts;
+            break;
+        }
+
+        if ((d[2] == 0) || ((uint16_t)d[2] + d[1] - 1 > txSession.nPackets))
+        {
+            SendAbort(txSession.nDa, TP_ABORT_RESOURCES, txSession.nPgn);
+            txSession.eState = TpTxState::Idle;
+            break;
+        }
+        txSession.nNextSeq = d[2];
+        txSession.nWindowEnd = d[2] + d[1] - 1;
+        txSession.eState = TpTxState::CmdtData;
+        break;
+
+    case TP_CM_EOMA:
+        if ((txSession.eState == TpTxState::WaitEoma) && (txSession.nDa == id->nSa) && (txSession.nPgn == nPgn))
+            txSession.eState = TpTxState::Idle;
+        break;
+
+    default:
+        break;
+    }
+}
+
+static void HandleTpDt(const stJ1939Id *id, const CANRxFrame *frame)
+{
+    if (frame->DLC < 8)
+        return;
+
+    const bool bBam = (id->nDa == J1939_ADDR_GLOBAL);
+    stTpRxSession *s = FindRxSession(id->nSa, bBam);
+    if (s == nullptr)
+        return;
+
+    const uint8_t nSeq = frame->data8[0];
+
+    // Out of order packet, J1939-21 says to drop the message
+    if (nSeq != s->nNextSeq)
+    {
+        if (!bBam)
+            SendAbort(s->nSa, TP_ABORT_TIMEOUT, s->nPgn);
+        s->bUsed = false;
+        return;
+    }
+
+    const uint16_t nOffset = (nSeq - 1) * TP_DT_SIZE;
+    if (nOffset >= s->nSize)
+    {
+        if (!bBam)
+            SendAbort(s->nSa, TP_ABORT_RESOURCES, s->nPgn);
+        s->bUsed = false;
+        return;
+    }
+
+    uint16_t nCopy = s->nSize - nOffset;
+    if (nCopy > TP_DT_SIZE)
+        nCopy = TP_DT_SIZE;
+    memcpy(&s->nData[nOffset], &frame->data8[1], nCopy);
+
+    s->nNextSeq++;
+    s->bAfterCts = false;
+    s->nLastTime = SYS_TIME;
+
+    if (nSeq == s->nPackets)
+    {
+        if (!bBam)
+            SendTpCm(s->nSa, TP_CM_EOMA, s->nSize & 0xFF, s->nSize >> 8, s->nPackets, 0xFF, s->nPgn);
+
+        if (rxHandler)
+            rxHandler(s->nPgn, s->nSa, s->nDa, s->nData, s->nSize);
+
+        s->bUsed = false;
+    }
+    else if (!bBam && (nSeq == s->nWindowEnd))
+    {
+        SendCts(s);
+    }
+}
+
+/*
+ * Transport protocol, transmit
+ */
+
+// The sequence number only moves on once the packet is queued
+static msg_t SendNextDt()
+{
+    uint8_t data[8];
+    const uint16_t nOffset = (txSession.nNextSeq - 1) * TP_DT_SIZE;
+
+    data[0] = txSession.nNextSeq;
+    for (uint8_t i = 0; i < TP_DT_SIZE; i++)
+        data[1 + i] = (nOffset + i < txSession.nSize) ? txSession.nData[nOffset + i] : 0xFF;
+
+    const msg_t result = SendFrame(7, J1939_PGN_TP_DT, txSession.nDa, nOwnAddress, data, 8, CanTxClass::Gateway);
+    if (result == MSG_OK)
+    {
+        txSession.nNextSeq++;
+        txSession.nLastTime = SYS_TIME;
+    }
+    return result;
+}
+
+static void TxPeriodic(uint32_t nNow)
+{
+    switch (txSession.eState)
+    {
+    case TpTxState::BamData:
+        if ((nNow - txSession.nLastTime) < TP_BAM_GAP)
+            break;
+        if ((SendNextDt() == MSG_OK) && (txSession.nNextSeq > txSession.nPackets))
+            txSession.eState = TpTxState::Idle;
+        break;
+
+    case TpTxState::CmdtData:
+        // Queue as much of the window as fits, the rest goes out on the
+        // next pass once the TX thread has drained the Gateway queue
+        while (txSession.nNextSeq <= txSession.nWindowEnd)
+        {
+            if (SendNextDt() != MSG_OK)
+                break;
+        }
+        if (txSession.nNextSeq > txSession.nWindowEnd)
+            txSession.eState = (txSession.nNextSeq > txSession.nPackets) ? TpTxState::WaitEoma : TpTxState::WaitCts;
+        break;
+
+    case TpTxState::WaitCts:
+        if ((nNow - txSession.nLastTime) > TP_T3)
+        {
+            SendAbort(txSession.nDa, TP_ABORT_TIMEOUT, txSession.nPgn);
+            txSession.eState = TpTxState::Idle;
+        }
+        break;
+
+    case TpTxState::WaitEoma:
+        if ((nNow - txSession.nLastTime) > TP_T3)
+            txSession.eState = TpTxState::Idle;
+        break;
+
+    default:
+        break;
+    }
+}
+
+static void RxPeriodic(uint32_t nNow)
+{
+    for (uint8_t i = 0; i < J1939_RX_SESSIONS; i++)
+    {
+        stTpRxSession *s = &rxSessions[i];
+        if (!s->bUsed)
+            continue;
+
+        // T2 after a CTS, T1 between data packets
+        const uint32_t nTimeout = s->bAfterCts ? TP_T2 : TP_T1;
+        if ((nNow - s->nLastTime) > nTimeout)
+        {
+            if (!s->bBam)
+                SendAbort(s->nSa, TP_ABORT_TIMEOUT, s->nPgn);
+            s->bUsed = false;
+        }
+    }
+}
+
+void InitJ1939(uint64_t nName, uint8_t nPreferredAddress)
+{
+    // Called again on every CAN restart, a sender may hold the mutex
+    if (!bInitialized)
+        chMtxObjectInit(&txMtx);
+
+    for (uint8_t i = 0; i < 8; i++)
+        nUsedAddresses[i] = 0;
+    for (uint8_t i = 0; i < J1939_RX_SESSIONS; i++)
+        rxSessions[i].bUsed = false;
+
+    chMtxLock(&txMtx);
+    txSession.eState = TpTxState::Idle;
+    chMtxUnlock(&txMtx);
+
+    nOwnName = nName;
+    bInitialized = true;
+
+    StartClaim(nPreferredAddress);
+}
+
+void J1939SetRxHandler(J1939RxHandler handler)
+{
+    rxHandler = handler;
+}
+
+void J1939Receive(const CANRxFrame *frame)
+{
+    if (!bInitialized || (frame->IDE != CAN_IDE_EXT) || (frame->RTR != CAN_RTR_DATA))
+        return;
+
+    stJ1939Id id;
+    J1939DecodeId(frame->EID, &id);
+
+    if (id.nPgn == J1939_PGN_ADDRESS_CLAIMED)
+    {
+        HandleAddressClaim(&id, frame);
+        return;
+    }
+
+    // Everything else only if it is for us
+    if ((id.nDa != J1939_ADDR_GLOBAL) && (id.nDa != nOwnAddress))
+        return;
+
+    switch (id.nPgn)
+    {
+    case J1939_PGN_REQUEST:
+        HandleRequest(&id, frame);
+        break;
+    case J1939_PGN_TP_CM:
+        chMtxLock(&txMtx);
+        HandleTpCm(&id, frame);
+        chMtxUnlock(&txMtx);
+        break;
+    case J1939_PGN_TP_DT:
+        HandleTpDt(&id, frame);
+        break;
+    default:
+        if (rxHandler)
+            rxHandler(id.nPgn, id.nSa, id.nDa, frame->data8, frame->DLC);
+        break;
+    }
+}
+
+// Call at least every few ms for TP pacing and timeouts
+void J1939Periodic(void)
+{
+    if (!bInitialized)
+        return;
+
+    const uint32_t nNow = SYS_TIME;
+
+    if ((eAddrState == J1939AddrState::Claiming) && ((nNow - nClaimTime) >= ADDRESS_CLAIM_WAIT))
+        eAddrState = J1939AddrState::Claimed;
+
+    RxPeriodic(nNow);
+
+    chMtxLock(&txMtx);
+    TxPeriodic(nNow);
+    chMtxUnlock(&txMtx);
+}
+
+msg_t J1939Send(uint32_t nPgn, uint8_t nDa, const uint8_t *data, uint16_t nLength, uint8_t nPriority)
+{
+    if (eAddrState != J1939AddrState::Claimed)
+        return MSG_RESET;
+
+    if (nLength <= 8)
+        return SendFrame(nPriority, nPgn, nDa, nOwnAddress, data, nLength, CanTxClass::Gateway);
+
+    if (nLength > J1939_TP_BUFFER_SIZE)
+        return MSG_TIMEOUT;
+
+    // Held until the state is set, a CTS or abort can't see a half set up session
+    chMtxLock(&txMtx);
+    if (txSession.eState != TpTxState::Idle)
+    {
+        chMtxUnlock(&txMtx);
+        return MSG_TIMEOUT;
+    }
+
+    memcpy(txSession.nData, data, nLength);
+    txSession.nDa = nDa;
+    txSession.nPgn = nPgn;
+    txSession.nSize = nLength;
+    txSession.nPackets = (nLength + TP_DT_SIZE - 1) / TP_DT_SIZE;
+    txSession.nNextSeq = 1;
+    txSession.nLastTime = SYS_TIME;
+
+    // The session stays idle if the announcement couldn't be queued
+    msg_t result;
+    if (nDa == J1939_ADDR_GLOBAL)
+    {
+        result = SendTpCm(J1939_ADDR_GLOBAL, TP_CM_BAM, nLength & 0xFF, nLength >> 8, txSession.nPackets, 0xFF, nPgn);
+        if (result == MSG_OK)
+            txSession.eState = TpTxState::BamData;
+    }
+    else
+    {
+        result = SendTpCm(nDa, TP_CM_RTS, nLength & 0xFF, nLength >> 8, txSession.nPackets, TP_RTS_WINDOW, nPgn);
+        if (result == MSG_OK)
+            txSession.eState = TpTxState::WaitCts;
+    }
+    chMtxUnlock(&txMtx);
+
+    return result;
+}
+
+bool J1939TxBusy(void)
+{
+    return txSession.eState != TpTxState::Idle;
+}
+
+J1939AddrState GetJ1939AddrState(void)
+{
+    return eAddrState;
+}
+
+uint8_t GetJ1939Address(void)
+{
+    return nOwnAddress;
+}
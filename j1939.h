@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include "hal.h"
+
+#define J1939_ADDR_GLOBAL 0xFF
+#define J1939_ADDR_NULL 0xFE
+
+#define J1939_PGN_REQUEST 0xEA00
+#define J1939_PGN_ADDRESS_CLAIMED 0xEE00
+#define J1939_PGN_TP_CM 0xEC00
+#define J1939_PGN_TP_DT 0xEB00
+
+#define J1939_DEFAULT_PRIORITY 6
+
+// Largest transport protocol message that can be sent or reassembled
+#define J1939_TP_BUFFER_SIZE 512
+// Concurrent reassembly sessions, one per BAM sender or CMDT sender/receiver pair
+#define J1939_RX_SESSIONS 4
+
+enum class J1939AddrState : uint8_t
+{
+    Idle,
+    Claiming,
+    Claimed,
+    CannotClaim
+};
+
+typedef struct {
+    uint8_t nPriority;
+    uint32_t nPgn;
+    uint8_t nSa;
+    uint8_t nDa;    // J1939_ADDR_GLOBAL for PDU2 and broadcast PDU1
+} stJ1939Id;
+
+// Called with every complete message addressed to us or global, from the CAN Rx thread
+typedef void (*J1939RxHandler)(uint32_t nPgn, uint8_t nSa, uint8_t nDa, const uint8_t *data, uint16_t nLength);
+
+void InitJ1939(uint64_t nName, uint8_t nPreferredAddress);
+void J1939SetRxHandler(J1939RxHandler handler);
+void J1939Receive(const CANRxFrame *frame);
+void J1939Periodic(void);
+msg_t J1939Send(uint32_t nPgn, uint8_t nDa, const uint8_t *data, uint16_t nLength, uint8_t nPriority = J1939_DEFAULT_PRIORITY);
+bool J1939TxBusy(void);
+J1939AddrState GetJ1939AddrState(void);
+uint8_t GetJ1939Address(void);
+void J1939DecodeId(uint32_t nEid, stJ1939Id *id);
+uint32_t J1939EncodeId(uint8_t nPriority, uint32_t nPgn, uint8_t nDa, uint8_t nSa);
@@ -1,5 +1,17 @@
 #include "lin.h"
 #include "port.h"
+#include "xcp.h"
+#include "lincache.h"
+#include "linschedule.h"
+#include "linslave.h"
+#include "linmonitor.h"
+#include "linframe.h"
+#include "lintp.h"
+#include "linbaud.h"
+#include "linpower.h"
+#include "lincodec.h"
+#include "linstats.h"
+#include "linldf.h"
 #include <cstring>
 
 #define RX_TIMEOUT_MS 500
@@ -18,153 +30,569 @@ uint8_t nIntModeSpeed = 0;
 
 uint32_t nLastRxTime = 0;
 
+// Slot length of the normal schedule, runtime adjustable
+static uint16_t nLinPeriodMs = LIN_PERIOD_MS;
+
+typedef enum {
+    LIN_IDLE,
+    LIN_BREAK,    // Break requested, waiting for it to be read back
+    LIN_READBACK, // Checking sync, PID and master data against the echo
+    LIN_RESPONSE, // Collecting slave data and checksum
+    LIN_SLAVE_SYNC, // Slave mode, break seen
+    LIN_SLAVE_PID,
+    LIN_MONITOR     // Monitor mode, collecting bytes up to the frame end
+} LinState;
+
+// Frame in flight, owned by the UART interrupt until the callback runs
+static volatile LinState eState = LIN_IDLE;
+static volatile LinMode eMode = LinMode::Master;
+static stLinFrame *pFrame;
+static stLinFrame slaveFrame;
+static LinFrameCb frameCb;
+static LinDirection eFrameDir;
+static uint8_t txBuf[11]; // Sync, PID, data and checksum
+static uint8_t nTxLength;
+static uint8_t nIndex;
+static LinChecksum rxSum;
+static LinChecksum sumStart; // Holds the PID for the enhanced checksum
+static rtcnt_t nHeaderTime;  // PID received, start of the response space
+static virtual_timer_t frameTimer;
+
+// Auto-baud, slave and monitor modes take the rate of every header from
+// its sync field, measured by the USART
+static bool bAutoBaud = false;
+static volatile uint16_t nRxBaud = LIN_BAUDRATE; // Rate on the wire
+static uint16_t nSyncBaud;                       // Measured at the last sync, 0 for none
+
+// Monitor mode frame, from break to receiver timeout or the next break
+static uint8_t monBytes[LIN_MONITOR_MAX_BYTES];
+static uint8_t nMonCount;
+static uint8_t nMonErrorAt; // Byte count at the first receive error, 0xFF for none
+static rtcnt_t nMonTime;
+
+static void LinRxCharCb(UARTDriver *, uint16_t c);
+static void LinRxErrCb(UARTDriver *, uartflags_t e);
+static void LinRxTimeoutCb(UARTDriver *);
+
 static UARTConfig lin_config = {
     .txend1_cb = NULL,
     .txend2_cb = NULL,
     .rxend_cb = NULL,
-    .rxchar_cb = NULL,
-    .rxerr_cb = NULL,
-    .timeout_cb = NULL,
-    .timeout = 100,
-    .speed = 19200,
+    .rxchar_cb = LinRxCharCb,
+    .rxerr_cb = LinRxErrCb,
+    .timeout_cb = LinRxTimeoutCb,
+    .timeout = LIN_MONITOR_GAP_BITS,
+    .speed = LIN_BAUDRATE,
     .cr1 = 0,
     .cr2 = USART_CR2_LINEN | USART_CR2_RTOEN,
     .cr3 = 0
 };
 
-static void LinSendBreak(void)
+// Calculate protected ID with parity bits
+uint8_t LinCalculateProtectedId(uint8_t id) {
+    return LinPid(id);
+}
+
+uint8_t calculateLIN2xChecksum(uint8_t protected_id, uint8_t *data, size_t length) {
+    return LinCalculateChecksum(LinChecksumModel::Enhanced, protected_id, data, length);
+}
+
+uint8_t calculateLIN1xChecksum(uint8_t *data, size_t length) {
+    return LinCalculateChecksum(LinChecksumModel::Classic, 0, data, length);
+}
+
+// Idle line, BRR back to the fastest rate for the next break. Only between
+// frames, at that rate a 0x00 byte of a slow frame would read as a break.
+static void LinAutoBaudIdleI(void)
 {
-    UARTD2.usart->RQR |= USART_RQR_SBKRQ;
-    
-    // Wait for break completion
-    while(UARTD2.usart->ISR & USART_ISR_SBKF) {
-        chThdSleepMicroseconds(10);
+    USART_TypeDef *u = UARTD2.usart;
+    const uint32_t nBrr = UARTD2.clock / LIN_AUTOBAUD_MAX;
+
+    if (!(lin_config.cr2 & USART_CR2_ABREN) || (eState != LIN_IDLE) || (u->BRR == nBrr))
+        return;
+
+    // BRR can only be written with the USART disabled
+    u->CR1 &= ~USART_CR1_UE;
+    u->BRR = nBrr;
+    u->CR1 |= USART_CR1_UE;
+}
+
+static void LinCompleteI(LinResult eResult)
+{
+    chVTResetI(&frameTimer);
+    if (eResult != LinResult::Ok)
+        uartStopSendI(&UARTD2);
+
+    eState = LIN_IDLE;
+    LinStatsRecordI(pFrame->nId, eResult);
+
+    if (eResult == LinResult::Ok)
+    {
+        if (eFrameDir == LinDirection::Subscribe)
+            nLastRxTime = SYS_TIME;
+        LinCacheUpdateI(pFrame);
     }
 
+    if (frameCb != nullptr)
+        frameCb(pFrame, eResult);
 }
 
-// Calculate protected ID with parity bits
-static uint8_t LinCalculateProtectedId(uint8_t id) {
-    uint8_t p0 = (id >> 0) ^ (id >> 1) ^ (id >> 2) ^ (id >> 4);
-    uint8_t p1 = ~((id >> 1) ^ (id >> 3) ^ (id >> 4) ^ (id >> 5));
-    
-    return id | ((p0 & 1) << 6) | ((p1 & 1) << 7);
+static void LinFrameTimeoutCb(virtual_timer_t *, void *)
+{
+    chSysLockFromISR();
+    if ((eState == LIN_SLAVE_SYNC) || (eState == LIN_SLAVE_PID))
+        eState = LIN_IDLE; // Incomplete header, not ours to report
+    else if (eState != LIN_IDLE)
+        LinCompleteI(((eState == LIN_RESPONSE) && (nIndex == 0)) ? LinResult::NoResponse : LinResult::Timeout);
+    // The frame slot is over, the receiver timeout may have passed already
+    LinAutoBaudIdleI();
+    chSysUnlockFromISR();
 }
 
-uint8_t calculateLIN2xChecksum(uint8_t protected_id, uint8_t *data, size_t length) {
-    uint16_t sum = protected_id;
-    
-    for(uint8_t i = 0; i < length; i++) {
-        sum += data[i];
+// Header timeout from the break, at the slowest rate while it is unknown
+static sysinterval_t LinHeaderTimeout(void)
+{
+    const uint32_t nBaud = (lin_config.cr2 & USART_CR2_ABREN) ? LIN_AUTOBAUD_MIN : LIN_BAUDRATE;
+    return chTimeUS2I(LIN_FRAME_MAX_US_AT(0, nBaud));
+}
+
+// A break rearms the measurement for the sync field that follows
+static void LinSyncArmI(void)
+{
+    nSyncBaud = 0;
+    if (lin_config.cr2 & USART_CR2_ABREN)
+        UARTD2.usart->RQR |= USART_RQR_ABRRQ;
+}
+
+// Takes the rate measured on the sync field just received, the USART has
+// already switched to it
+static void LinSyncDoneI(void)
+{
+    const uint32_t nIsr = UARTD2.usart->ISR;
+
+    if (!(lin_config.cr2 & USART_CR2_ABREN) || !(nIsr & USART_ISR_ABRF) || (nIsr & USART_ISR_ABRE))
+        return;
+
+    const uint32_t nBaud = UARTD2.clock / UARTD2.usart->BRR;
+    if ((nBaud < LIN_AUTOBAUD_MIN / 2) || (nBaud > UINT16_MAX))
+        return;
+
+    nSyncBaud = nBaud;
+    nRxBaud = nBaud;
+}
+
+// Logs the sync measurement against the frame ID once the PID is in
+static void LinSyncRecordI(uint8_t nPid)
+{
+    if (nSyncBaud != 0)
+        LinBaudRecordI(nPid & 0x3F, nSyncBaud);
+}
+
+// First response byte, the time since the PID less its own 10 bits
+static void LinRecordResponseI(void)
+{
+    const uint32_t nUs = (chSysGetRealtimeCounterX() - nHeaderTime) / RT_TICKS_PER_US;
+    const uint32_t nBits = nUs * nRxBaud / 1000000;
+
+    LinStatsResponseI(pFrame->nId, nBits > 10 ? nBits - 10 : 0);
+}
+
+static void LinSlaveDoneCb(stLinFrame *frame, LinResult eResult)
+{
+    if (eResult == LinResult::Ok)
+        LinSlaveStoreI(frame);
+}
+
+// Slave mode, a valid PID either starts our response straight from the
+// interrupt, well inside the response space, or collects someone else's
+static void LinSlaveHeaderI(uint8_t nPid)
+{
+    const uint8_t nId = nPid & 0x3F;
+    const stLinSlaveEntry *e = LinSlaveLookupI(nId);
+    const stLinFrameDesc *desc = GetLinFrameDesc(nId);
+
+    const bool bPidValid = LinPidValid(nPid);
+    if (!bPidValid)
+        LinStatsRecordI(nId, LinResult::Parity);
+
+    if (!bPidValid || (e == nullptr) || (desc->nLength == 0))
+    {
+        chVTResetI(&frameTimer);
+        eState = LIN_IDLE;
+        return;
+    }
+
+    slaveFrame.nId = nId;
+    slaveFrame.nLength = desc->nLength;
+    pFrame = &slaveFrame;
+    frameCb = LinSlaveDoneCb;
+    eFrameDir = e->eDir;
+    nIndex = 0;
+    sumStart = LinChecksum(desc->eChecksum, nPid);
+
+    chVTSetI(&frameTimer, chTimeUS2I(LIN_FRAME_MAX_US_AT(desc->nLength, nRxBaud)), LinFrameTimeoutCb, nullptr);
+
+    if (e->eDir == LinDirection::Publish)
+    {
+        LinChecksum sum = sumStart;
+        for (uint8_t i = 0; i < desc->nLength; i++)
+        {
+            slaveFrame.nData[i] = e->nData[i];
+            txBuf[i] = e->nData[i];
+        }
+        sum.Add(txBuf, desc->nLength);
+        slaveFrame.nChecksum = sum.Value();
+        txBuf[desc->nLength] = slaveFrame.nChecksum;
+        nTxLength = desc->nLength + 1;
+
+        eState = LIN_READBACK;
+        uartStartSendI(&UARTD2, nTxLength, txBuf);
     }
-    
-    // RFC 1071 style checksum (Internet checksum)
-    while(sum >> 8) {
-        sum = (sum & 0xFF) + (sum >> 8);
+    else
+    {
+        rxSum = sumStart;
+        nHeaderTime = chSysGetRealtimeCounterX();
+        eState = LIN_RESPONSE;
     }
-    
-    return ~sum & 0xFF;
 }
 
-uint8_t calculateLIN1xChecksum(uint8_t *data, size_t length) {
-    uint16_t sum = 0;  // Start with 0, don't include protected_id
-    
-    for(uint8_t i = 0; i < length; i++) {
-        sum += data[i];
+// Break detection on our own transmission starts the rest of the frame,
+// everything after it is sent in one DMA transfer
+static void LinRxErrCb(UARTDriver *, uartflags_t e)
+{
+    osalSysLockFromISR();
+
+    if (eMode == LinMode::Monitor)
+    {
+        if (e & UART_BREAK_DETECTED)
+        {
+            // The next break also ends a frame the timeout did not, the
+            // break character itself was taken in as a last 0x00 byte
+            if (eState == LIN_MONITOR)
+            {
+                if ((nMonCount != 0) && (nMonCount <= LIN_MONITOR_MAX_BYTES) && (monBytes[nMonCount - 1] == 0x00))
+                    nMonCount--;
+                LinMonitorRecordI(nMonTime, monBytes, nMonCount, nMonErrorAt < nMonCount);
+            }
+
+            eState = LIN_MONITOR;
+            nMonTime = chSysGetRealtimeCounterX();
+            nMonCount = 0;
+            nMonErrorAt = 0xFF;
+            LinSyncArmI();
+        }
+        else if ((eState == LIN_MONITOR) && (nMonCount != 0) && (nMonErrorAt == 0xFF))
+        {
+            // Errors before the sync byte belong to the break character
+            nMonErrorAt = nMonCount;
+        }
+    }
+    else if ((eMode == LinMode::Slave) && (e & UART_BREAK_DETECTED))
+    {
+        // A new header ends whatever was going on
+        if (eState != LIN_IDLE)
+            uartStopSendI(&UARTD2);
+
+        eState = LIN_SLAVE_SYNC;
+        chVTSetI(&frameTimer, LinHeaderTimeout(), LinFrameTimeoutCb, nullptr);
+        LinSyncArmI();
+    }
+    else if (eState == LIN_BREAK)
+    {
+        // The break itself reads back as a framing error
+        if (e & UART_BREAK_DETECTED)
+        {
+            eState = LIN_READBACK;
+            nIndex = 0;
+            uartStartSendI(&UARTD2, nTxLength, txBuf);
+        }
+    }
+    else if ((eState == LIN_SLAVE_SYNC) || (eState == LIN_SLAVE_PID))
+    {
+        // Framing error of the break character itself
     }
-    
-    // RFC 1071 style checksum (Internet checksum)
-    while(sum >> 8) {
-        sum = (sum & 0xFF) + (sum >> 8);
+    else if ((eState != LIN_IDLE) && (e & (UART_FRAMING_ERROR | UART_NOISE_ERROR | UART_OVERRUN_ERROR)))
+    {
+        LinCompleteI(LinResult::Framing);
     }
-    
-    return ~sum & 0xFF;
+
+    osalSysUnlockFromISR();
 }
 
-// Send complete LIN frame (master)
-msg_t LinSendFrame(stLinFrame *frame, bool bChecksum) {
-    systime_t timeout = chTimeMS2I(10);
-    size_t size = 0;
+static void LinRxCharCb(UARTDriver *, uint16_t c)
+{
+    const uint8_t nByte = c & 0xFF;
+
+    osalSysLockFromISR();
+
+    switch (eState)
+    {
+    case LIN_READBACK:
+        if (nByte != txBuf[nIndex])
+        {
+            LinCompleteI(LinResult::BitError);
+            break;
+        }
 
-    // 1. Send break field
-    LinSendBreak();
+        if (++nIndex < nTxLength)
+            break;
 
-    // 2. Send sync byte
-    uint8_t sync = 0x55;
-    size = 1;
-    if(uartSendFullTimeout(&UARTD2, &size, &sync, timeout) != MSG_OK) {
-        return MSG_TIMEOUT;
+        if (eFrameDir == LinDirection::Publish)
+        {
+            LinCompleteI(LinResult::Ok);
+        }
+        else
+        {
+            eState = LIN_RESPONSE;
+            nIndex = 0;
+            rxSum = sumStart;
+            nHeaderTime = chSysGetRealtimeCounterX();
+        }
+        break;
+
+    case LIN_RESPONSE:
+        if (nIndex == 0)
+            LinRecordResponseI();
+
+        if (nIndex < pFrame->nLength)
+        {
+            pFrame->nData[nIndex++] = nByte;
+            rxSum.Add(nByte);
+            break;
+        }
+
+        pFrame->nChecksum = nByte;
+        LinCompleteI(rxSum.Check(nByte) ? LinResult::Ok : LinResult::Checksum);
+        break;
+
+    case LIN_SLAVE_SYNC:
+        LinSyncDoneI();
+        if ((nByte == 0x55) || (nSyncBaud != 0))
+        {
+            eState = LIN_SLAVE_PID;
+        }
+        else
+        {
+            chVTResetI(&frameTimer);
+            eState = LIN_IDLE;
+        }
+        break;
+
+    case LIN_SLAVE_PID:
+        LinSyncRecordI(nByte);
+        LinSlaveHeaderI(nByte);
+        break;
+
+    case LIN_MONITOR:
+        if (nMonCount == 0)
+            LinSyncDoneI();
+        else if (nMonCount == 1)
+            LinSyncRecordI(nByte);
+
+        // Bytes past the longest frame are only counted
+        if (nMonCount < LIN_MONITOR_MAX_BYTES)
+            monBytes[nMonCount] = nByte;
+        if (nMonCount < 0xFF)
+            nMonCount++;
+        break;
+
+    default:
+        // Idle line noise and the break character are ignored
+        break;
     }
 
-    uint8_t txData[10];
-    txData[0] = LinCalculateProtectedId(frame->nId);
-    txData[1] = frame->nData[0]; // First data byte
-    txData[2] = frame->nData[1]; // Second data byte
-    txData[3] = frame->nData[2]; // Third data byte
-    txData[4] = frame->nData[3]; // Fourth data byte
-    txData[5] = frame->nData[4]; // Fifth data byte
-    txData[6] = frame->nData[5]; // Sixth data byte
-    txData[7] = frame->nData[6]; // Seventh data byte
-    txData[8] = frame->nData[7]; // Eighth data byte
-    if(bChecksum) {
-        frame->nChecksum = calculateLIN1xChecksum(frame->nData, frame->nLength);
-        txData[1 + frame->nLength] = frame->nChecksum;
-        size = 2 + frame->nLength; // Sync + ID + Data + Checksum
-    } else {
-        size = 1 + frame->nLength; // Sync + ID + Data
+    osalSysUnlockFromISR();
+}
+
+// Receiver timeout, the line has been idle for LIN_MONITOR_GAP_BITS
+static void LinRxTimeoutCb(UARTDriver *)
+{
+    osalSysLockFromISR();
+
+    if (eState == LIN_MONITOR)
+    {
+        LinMonitorRecordI(nMonTime, monBytes, nMonCount, nMonErrorAt != 0xFF);
+        eState = LIN_IDLE;
+    }
+    LinAutoBaudIdleI();
+
+    osalSysUnlockFromISR();
+}
+
+// Starts a frame and returns at once, cb runs from the UART or timer
+// interrupt with the system locked when the frame is done or aborted.
+// Length, direction and checksum come from the frame descriptor, the
+// data of a published frame must be filled in already.
+bool LinStartFrameI(stLinFrame *frame, LinFrameCb cb)
+{
+    const stLinFrameDesc *desc = GetLinFrameDesc(frame->nId);
+
+    if ((eMode != LinMode::Master) || (eState != LIN_IDLE) || (desc->nLength == 0))
+        return false;
+
+    pFrame = frame;
+    frameCb = cb;
+    eFrameDir = desc->eDir;
+
+    frame->nId &= 0x3F;
+    frame->nLength = desc->nLength;
+
+    txBuf[0] = 0x55;
+    txBuf[1] = LinPid(frame->nId);
+    nTxLength = 2;
+    sumStart = LinChecksum(desc->eChecksum, txBuf[1]);
+
+    if (desc->eDir == LinDirection::Publish)
+    {
+        LinChecksum sum = sumStart;
+        sum.Add(frame->nData, frame->nLength);
+        memcpy(&txBuf[nTxLength], frame->nData, frame->nLength);
+        nTxLength += frame->nLength;
+        frame->nChecksum = sum.Value();
+        txBuf[nTxLength++] = frame->nChecksum;
+    }
+    else
+    {
+        memset(frame->nData, 0, sizeof(frame->nData));
     }
 
-    if(uartSendFullTimeout(&UARTD2, &size, &txData, timeout) != MSG_OK) {
-        return MSG_TIMEOUT;
+    eState = LIN_BREAK;
+    chVTSetI(&frameTimer, chTimeUS2I(LIN_FRAME_MAX_US(frame->nLength)), LinFrameTimeoutCb, nullptr);
+    UARTD2.usart->RQR |= USART_RQR_SBKRQ;
+
+    return true;
+}
+
+static thread_reference_t transferRef = nullptr;
+static LinResult eTransferResult;
+
+static void LinTransferDoneCb(stLinFrame *, LinResult eResult)
+{
+    eTransferResult = eResult;
+    chThdResumeI(&transferRef, MSG_OK);
+}
+
+// Blocks the calling thread until the frame is done, the CPU is free
+// while the bytes are on the wire
+LinResult LinTransferFrame(stLinFrame *frame)
+{
+    chSysLock();
+    if (!LinStartFrameI(frame, LinTransferDoneCb))
+    {
+        chSysUnlock();
+        return LinResult::Busy;
     }
+    chThdSuspendS(&transferRef);
+    chSysUnlock();
 
-    return MSG_OK;
+    return eTransferResult;
 }
 
-msg_t LinGetResponse(uint8_t id, stLinFrame *rxFrame) {
-    stLinFrame frame;
-    uint8_t rxData[10];
+// Wiper cluster signals, layouts from linboard.ldf
+using WiperCmdFrame = SignalFrame<LDF_LENGTH_WIPER_CMD,
+                                  LinSignal<LDF_SIGNAL_WIPER_ALIVE>,
+                                  LinSignal<LDF_SIGNAL_WIPER_CONTROL>,
+                                  LinSignal<LDF_SIGNAL_WIPER_PARAM>>;
+using WiperStatusFrame = SignalFrame<LDF_LENGTH_WIPER_STATUS,
+                                     LinSignal<LDF_SIGNAL_WIPER_POSITION>,
+                                     LinSignal<LDF_SIGNAL_WIPER_MOVING>>;
+
+// Fills the data of a publish slot, false leaves the slot empty
+static bool LinPreparePublish(LinScheduleId eTable, stLinFrame *frame)
+{
+    switch (frame->nId)
+    {
+    case LDF_ID_WIPER_CMD:
+        nCounter++;
+        if (nCounter > 15)    
+            nCounter = 0;
+
+        WiperCmdFrame::Encode(frame->nData, 0x30 + (nCounter * 0x0F), nData1, nData2);
 
-    rxFrame->nData[0] = 0;
-    rxFrame->nData[1] = 0;
-    rxFrame->nData[2] = 0;
-    rxFrame->nData[3] = 0;
-    rxFrame->nData[4] = 0;
-    rxFrame->nData[5] = 0;
-    rxFrame->nData[6] = 0;
-    rxFrame->nData[7] = 0;
+        // A wiper switched on keeps the bus awake
+        if (nData1 != 0)
+            LinPowerActivity();
+        return true;
 
-    // Send diagnostic frame
-    frame.nId = 0xB1;
-    frame.nLength = 0;
+    case LIN_ID_MASTER_REQUEST:
+        // Diagnostic requests, or the go-to-sleep command in the sleep table
+        if (eTable == LinScheduleId::Diagnostic)
+            return LinTpPrepareRequest(frame);
+        if (eTable != LinScheduleId::Sleep)
+            return false;
 
-    if (LinSendFrame(&frame, false) == MSG_OK) {
-        // Frame sent successfully
+        memset(frame->nData, 0xFF, sizeof(frame->nData));
+        frame->nData[0] = 0x00;
+        return true;
+
+    default:
+        return false;
     }
+}
+
+static void LinHandleResponse(const stLinFrame *frame)
+{
+    if (frame->nId == LDF_ID_WIPER_STATUS)
+    {
+        uint32_t nMoving;
+        uint32_t nPos;
+        WiperStatusFrame::Decode(frame->nData, nPos, nMoving);
+
+        if ((nMoving == 1) || (nPos != nWiperPos))
+            LinPowerActivity();
 
-    chThdSleepMicroseconds(100);
-    
-    // Receive response (data + checksum)
-    size_t response_length = 6; // Data + Checksum
-    if (uartReceiveTimeout(&UARTD2, &response_length, rxData, chTimeMS2I(50)) != MSG_OK) {
-        return MSG_TIMEOUT;
+        bMoving = nMoving == 1;
+        nWiperPos = nPos;
     }
-    
-    // Copy data and verify checksum
-    memcpy(rxFrame->nData, rxData, rxFrame->nLength);
-    uint8_t expected_checksum = calculateLIN1xChecksum(rxFrame->nData, rxFrame->nLength);
+}
+
+// Fills the highest priority frame of a sporadic slot whose data was
+// updated through the slave table, false leaves the slot empty
+static bool LinPrepareSporadic(uint8_t nSporadic, stLinFrame *frame)
+{
+    if (nSporadic >= LDF_SPORADIC_FRAME_COUNT)
+        return false;
+
+    const stLdfSporadicFrame *sporadic = &LDF_SPORADIC_FRAMES[nSporadic];
+
+    for (uint8_t i = 0; i < sporadic->nCount; i++)
+    {
+        frame->nId = sporadic->frames[i];
+        frame->nLength = GetLinFrameDesc(frame->nId)->nLength;
 
-    if (expected_checksum != rxData[rxFrame->nLength]) {
-        return MSG_RESET; // Checksum error
+        if ((frame->nLength != 0) && LinSlaveTakeUpdate(frame->nId, frame->nData, frame->nLength))
+            return true;
     }
 
-    nLastRxTime = SYS_TIME;
-    
-    rxFrame->nId = id;
-    rxFrame->nChecksum = rxData[rxFrame->nLength];
-    return MSG_OK;
+    return false;
 }
 
+// A single answering slave puts the PID of its associated frame in the
+// first byte, a garbled response means more than one answered
+static void LinHandleEvent(const stLdfEventFrame *event, stLinFrame *frame, LinResult eResult, uint16_t nDelayMs)
+{
+    if (eResult == LinResult::Ok)
+    {
+        const uint8_t nId = frame->nData[0] & 0x3F;
+        if (!LinPidValid(frame->nData[0]))
+            return;
+
+        for (uint8_t i = 0; i < event->nCount; i++)
+        {
+            if (event->frames[i] != nId)
+                continue;
+
+            frame->nId = nId;
+            LinCacheUpdate(frame);
+            LinHandleResponse(frame);
+            return;
+        }
+    }
+    else if ((eResult != LinResult::NoResponse) && (eResult != LinResult::Busy))
+    {
+        LinScheduleResolveCollision(event->frames, event->nCount, nDelayMs);
+    }
+}
 
 // LIN master thread
 static THD_WORKING_AREA(lin_master_wa, 512);
@@ -173,48 +601,173 @@ static THD_FUNCTION(lin_master_thread, arg) {
     chRegSetThreadName("lin_master");
 
     stLinFrame frame;
+    const stLinSlot *slot;
+    LinScheduleId eTable;
 
     nCounter = 0;
 
     while (true) {
 
-        nCounter++;
-        if (nCounter > 15)    
-            nCounter = 0;
+        // Slot starts come from the schedule time base, the frame time
+        // no longer adds to the cycle. Diagnostic requests can't finish
+        // while the schedule is stopped.
+        if (LinScheduleWaitSlot(&slot, &eTable, TIME_MS2I(LIN_TP_TIMEOUT_MS)) != MSG_OK)
+        {
+            if (GetLinMode() != LinMode::Master)
+                LinTpCancel();
+            continue;
+        }
 
-        // Send periodic frame
-        frame.nId = 0xF0;
-        frame.nLength = 5;
-        frame.nData[0] = 0x30 + (nCounter * 0x0F);;
-        frame.nData[1] = nData1;// 0x08;// (bSlowSpeed << 7) | (bFastSpeed << 6) | (bIntMode << 5) | (bSwipeMode << 4) | (nIntModeSpeed & 0x0F);
-        frame.nData[2] = nData2;//0x01;
-        frame.nData[3] = 0x00;
-        frame.nData[4] = 0x00;
+        const stLinFrameDesc *desc;
+        const bool bSporadic = slot->nId & LIN_SLOT_SPORADIC;
 
-        if (LinSendFrame(&frame, true) == MSG_OK) {
-            // Frame sent successfully
+        frame.nChecksum = 0x00;
 
+        if (bSporadic)
+        {
+            if (!LinPrepareSporadic(slot->nId & ~LIN_SLOT_SPORADIC, &frame))
+                continue;
+            desc = GetLinFrameDesc(frame.nId);
+        }
+        else
+        {
+            desc = GetLinFrameDesc(slot->nId);
+            frame.nId = slot->nId;
+            frame.nLength = desc->nLength;
+
+            if ((desc->eDir == LinDirection::Publish) && !LinPreparePublish(eTable, &frame))
+                continue;
         }
 
-        chThdSleepMilliseconds(120);
+        // Slave responses are only polled for an outstanding request
+        if ((slot->nId == LIN_ID_SLAVE_RESPONSE) && !LinTpResponseWanted())
+            continue;
 
-        frame.nId = 0x00;
-        frame.nLength = 5;
-        frame.nData[0] = 0x00;
-        frame.nData[1] = 0x00;
-        frame.nData[2] = 0x00;
-        frame.nData[3] = 0x00;
-        frame.nData[4] = 0x00;
+        LinScheduleMarkStart();
+        const LinResult eResult = LinTransferFrame(&frame);
+        const stLdfEventFrame *event = GetLinEventFrame(frame.nId);
 
-        frame.nChecksum = 0x00;
+        if (frame.nId >= LIN_ID_MASTER_REQUEST)
+        {
+            LinTpHandleFrame(&frame, eResult);
+        }
+        else if (event != nullptr)
+        {
+            LinHandleEvent(event, &frame, eResult, slot->nDelayMs);
+        }
+        else if (bSporadic)
+        {
+            if (eResult != LinResult::Ok)
+                LinSlaveRestoreUpdate(frame.nId);
+        }
+        else if ((eResult == LinResult::Ok) && (desc->eDir == LinDirection::Subscribe))
+        {
+            LinHandleResponse(&frame);
+        }
+
+        XcpEvent(XCP_EVENT_LIN_SLOT);
+    }
+}
+
+void SetLinPeriod(uint16_t nPeriodMs)
+{
+    nLinPeriodMs = nPeriodMs;
+
+    for (uint8_t i = 0; i < LDF_SCHEDULE_NORMAL_COUNT; i++)
+        SetLinScheduleDelay(LinScheduleId::Normal, i, nPeriodMs);
+}
+
+uint16_t GetLinPeriod(void)
+{
+    return nLinPeriodMs;
+}
 
-        LinGetResponse(0xB1, &frame);
+// Restarts the USART when auto-baud is switched on or off, it measures
+// the sync field only as slave or monitor and the master sends at
+// LIN_BAUDRATE
+static void LinConfigureUart(LinMode eNewMode)
+{
+    uint32_t nCr2 = USART_CR2_LINEN | USART_CR2_RTOEN;
+    if (bAutoBaud && (eNewMode != LinMode::Master))
+        nCr2 |= USART_CR2_ABREN | USART_CR2_ABRMOD_0 | USART_CR2_ABRMOD_1;
 
-        bMoving = ((frame.nData[3] >> 5 ) & 0x01) == 1;
-        nWiperPos = frame.nData[1];
+    if ((nCr2 == lin_config.cr2) && (nRxBaud == LIN_BAUDRATE))
+        return;
+
+    uartStop(&UARTD2);
+    lin_config.cr2 = nCr2;
+    // Auto-baud waits for the first break at the fastest rate, as when idle
+    lin_config.speed = (nCr2 & USART_CR2_ABREN) ? LIN_AUTOBAUD_MAX : LIN_BAUDRATE;
+    nRxBaud = LIN_BAUDRATE;
+    uartStart(&UARTD2, &lin_config);
+}
 
-        chThdSleepMilliseconds(120);
+// The schedule only runs as master, a frame in flight is let finish
+static void LinSwitchMode(LinMode eNewMode)
+{
+    if (eMode == LinMode::Master)
+        StopLinSchedule();
+
+    // Headers and monitored frames are dropped, a response on the wire is
+    // let finish. Master mode with the schedule stopped starts nothing new.
+    chSysLock();
+    if ((eState == LIN_SLAVE_SYNC) || (eState == LIN_SLAVE_PID) || (eState == LIN_MONITOR))
+    {
+        chVTResetI(&frameTimer);
+        eState = LIN_IDLE;
     }
+    eMode = LinMode::Master;
+    chSysUnlock();
+
+    while (eState != LIN_IDLE)
+        chThdSleepMilliseconds(1);
+
+    if (eNewMode == LinMode::Monitor)
+        ResetLinMonitor();
+
+    LinConfigureUart(eNewMode);
+    eMode = eNewMode;
+
+    if (eNewMode == LinMode::Master)
+        StartLinSchedule();
+}
+
+// A sleeping bus is woken first, only the master puts it to sleep
+void SetLinMode(LinMode eNewMode)
+{
+    if (eNewMode == eMode)
+        return;
+
+    LinPowerWake();
+    LinSwitchMode(eNewMode);
+}
+
+LinMode GetLinMode(void)
+{
+    return eMode;
+}
+
+// Takes effect in slave and monitor mode, the current mode is reentered
+// to restart the USART
+void SetLinAutoBaud(bool bEnabled)
+{
+    if (bEnabled == bAutoBaud)
+        return;
+
+    bAutoBaud = bEnabled;
+    if (eMode != LinMode::Master)
+        LinSwitchMode(eMode);
+}
+
+bool GetLinAutoBaud(void)
+{
+    return bAutoBaud;
+}
+
+// Last rate measured as slave or monitor, else LIN_BAUDRATE
+uint16_t GetLinBaud(void)
+{
+    return nRxBaud;
 }
 
 bool LinRxIsActive(void)
@@ -222,7 +775,7 @@ bool LinRxIsActive(void)
     return (SYS_TIME - nLastRxTime) < RX_TIMEOUT_MS;
 }
 
-// Put LIN transceiver to sleep
+// Put LIN transceiver to sleep, used by the power manager
 void LinSleep(void) {
     uartStop(&UARTD2);
     palClearLine(LINE_LIN_STANDBY); // Put TJA1029T to sleep
@@ -235,9 +788,14 @@ void LinWakeup(void) {
 }
 
 void InitLin(void) {
+    chVTObjectInit(&frameTimer);
+    InitLinFrames();
+    InitLinTp();
     LinWakeup();
 
-    // Start LIN master thread
+    // Start LIN master thread, then the time base that paces it
     chThdCreateStatic(lin_master_wa, sizeof(lin_master_wa), NORMALPRIO, lin_master_thread, nullptr);
-    
+    InitLinSchedule();
+    InitLinPower();
+
 }
\ No newline at end of file
@@ -2,6 +2,24 @@
 
 #include <cstdint>
 #include "port.h"
+#include "enums.h"
+#include "linldf.h"
+
+#define LIN_BAUDRATE LDF_BAUDRATE
+
+// Longest frame time for nLength data bytes, nominal 34 bit header and
+// 10 bits per data and checksum byte plus 40%
+#define LIN_FRAME_MAX_US_AT(nLength, nBaud) ((34 + ((nLength) + 1) * 10) * 1400000UL / (nBaud))
+#define LIN_FRAME_MAX_US(nLength) LIN_FRAME_MAX_US_AT(nLength, LIN_BAUDRATE)
+
+// Receiver timeout that ends a frame in monitor mode, in bit times. Longer
+// than the response space the 40% frame time tolerance allows, a frame
+// followed more closely by the next one is ended by its break instead.
+#define LIN_MONITOR_GAP_BITS 60
+
+#define LIN_PERIOD_MS 120
+#define LIN_PERIOD_MIN_MS 10
+#define LIN_PERIOD_MAX_MS 10000
 
 typedef struct {
     uint8_t nId;
@@ -10,6 +28,8 @@ typedef struct {
     uint8_t nChecksum;
 } stLinFrame;
 
+typedef void (*LinFrameCb)(stLinFrame *frame, LinResult eResult);
+
 extern bool bOn;
 
 extern uint8_t nData1;
@@ -18,4 +38,18 @@ extern bool bMoving;
 extern uint8_t nWiperPos;
 
 void InitLin(void);
-bool LinRxIsActive(void);
\ No newline at end of file
+uint8_t LinCalculateProtectedId(uint8_t id);
+uint8_t calculateLIN2xChecksum(uint8_t protected_id, uint8_t *data, size_t length);
+uint8_t calculateLIN1xChecksum(uint8_t *data, size_t length);
+bool LinRxIsActive(void);
+void LinSleep(void);
+void LinWakeup(void);
+void SetLinPeriod(uint16_t nPeriodMs);
+uint16_t GetLinPeriod(void);
+void SetLinMode(LinMode eMode);
+LinMode GetLinMode(void);
+void SetLinAutoBaud(bool bEnabled);
+bool GetLinAutoBaud(void);
+uint16_t GetLinBaud(void);
+bool LinStartFrameI(stLinFrame *frame, LinFrameCb cb);
+LinResult LinTransferFrame(stLinFrame *frame);
\ No newline at end of file
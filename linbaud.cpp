@@ -0,0 +1,63 @@
+#include "linbaud.h"
+#include "linframe.h"
+
+// Rates in use on LIN clusters
+static const uint16_t nominalRates[] = {2400, 4800, 9600, 10417, 19200, 20000};
+
+static stLinBaudStats stats[LIN_FRAME_IDS];
+
+// Standard rate closest to nBaud, relative to the rate
+uint16_t LinNominalBaud(uint32_t nBaud)
+{
+    uint16_t nBest = nominalRates[0];
+    uint32_t nBestError = UINT32_MAX;
+
+    for (uint16_t nRate : nominalRates)
+    {
+        const uint32_t nDiff = nBaud > nRate ? nBaud - nRate : nRate - nBaud;
+        const uint32_t nError = nDiff * 1000 / nRate;
+        if (nError < nBestError)
+        {
+            nBest = nRate;
+            nBestError = nError;
+        }
+    }
+
+    return nBest;
+}
+
+// Called from the UART interrupt with the rate measured from the sync
+// field of a header of frame nId
+void LinBaudRecordI(uint8_t nId, uint32_t nBaud)
+{
+    stLinBaudStats *s = &stats[nId & 0x3F];
+    const int32_t nNominal = LinNominalBaud(nBaud);
+
+    s->nBaud = nBaud;
+    s->nDeviation = (static_cast<int32_t>(nBaud) - nNominal) * 1000 / nNominal;
+    if ((s->nCount == 0) || (s->nDeviation < s->nMinDeviation))
+        s->nMinDeviation = s->nDeviation;
+    if ((s->nCount == 0) || (s->nDeviation > s->nMaxDeviation))
+        s->nMaxDeviation = s->nDeviation;
+    s->nCount++;
+}
+
+bool GetLinBaudStats(uint8_t nId, stLinBaudStats *pStats)
+{
+    if (nId >= LIN_FRAME_IDS)
+        return false;
+
+    chSysLock();
+    *pStats = stats[nId];
+    chSysUnlock();
+
+    return true;
+}
+
+void ResetLinBaudStats(void)
+{
+    chSysLock();
+    for (stLinBaudStats &s : stats)
+        s = {};
+    chSysUnlock();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include "hal.h"
+
+// Slowest rate auto-baud follows, header timeouts assume it until the sync
+// field is measured
+#define LIN_AUTOBAUD_MIN 2400
+// Fastest rate, BRR goes back to it whenever the line is idle so a break
+// at any LIN rate is detected, slower breaks are only longer. The sync
+// field then measures the rate of the frame.
+#define LIN_AUTOBAUD_MAX 20000
+
+/*
+ * Sync field measurements, indexed by the frame ID of the header. The
+ * sync is always sent by the master, so every entry tracks the master
+ * clock as seen by the frames it schedules. Deviations are in 0.1% of
+ * the nearest standard LIN rate.
+ */
+typedef struct {
+    uint32_t nCount;
+    uint16_t nBaud; // Last measured
+    int16_t nDeviation;
+    int16_t nMinDeviation;
+    int16_t nMaxDeviation;
+} stLinBaudStats;
+
+uint16_t LinNominalBaud(uint32_t nBaud);
+void LinBaudRecordI(uint8_t nId, uint32_t nBaud);
+bool GetLinBaudStats(uint8_t nId, stLinBaudStats *stats);
+void ResetLinBaudStats(void);
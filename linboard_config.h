@@ -6,6 +6,35 @@
 
 #define CAN_BASE_ID 0x340
 
-#define CAN_TX_MSG_SPLIT 30 //us
+#define USB_TX_MSG_SPLIT 30 //us
 
-#define USB_TX_MSG_SPLIT 30 //us
\ No newline at end of file
+// CAN TX traffic classes, see CanTxClass
+#define CAN_TX_CLASS_COUNT 5
+
+// Total share of the bus bitrate the board may use for its own frames, the
+// class shares add up to it
+#define CAN_TX_BUS_BUDGET_PCT 60
+// Bucket depth of the bit budgets, in ms of traffic at the budgeted rate
+#define CAN_TX_BUDGET_BURST_MS 10
+
+// J1939 node, address claim starts at InitCan when enabled
+#define J1939_ENABLE 0
+// Arbitrary address capable, industry group 0, function 0x80, identity 1
+#define J1939_NAME 0x8000800000000001ULL
+#define J1939_PREFERRED_ADDRESS 0x80
+
+// XCP on CAN, command (CRO) and response/DAQ (DTO) identifiers
+#define XCP_CRO_ID (CAN_BASE_ID + 0x10)
+#define XCP_DTO_ID (CAN_BASE_ID + 0x11)
+
+// CAN firmware update, requests on BOOT_RX_ID and responses on BOOT_TX_ID.
+// BOOT_BROADCAST_ID is shared by every board so one image flashes a whole bus.
+#define BOOT_RX_ID (CAN_BASE_ID + 0x20)
+#define BOOT_TX_ID (CAN_BASE_ID + 0x21)
+#define BOOT_BROADCAST_ID 0x7F0
+// STmin requested in flow control, 0 sends consecutive frames back to back
+#define BOOT_STMIN 0
+
+// Frames seen by the LIN monitor, forwarded as extended IDs with the
+// monitor flags in bits 8-11 and the LIN frame ID in bits 0-5
+#define LIN_MONITOR_CAN_EID ((uint32_t)CAN_BASE_ID << 16)
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "lincache.h"
+
+typedef struct {
+    stLinRtrMap map;
+    bool bValid;
+    uint8_t nLength;
+    uint8_t nData[8];
+} stLinCacheEntry;
+
+static stLinCacheEntry cache[LIN_RTR_MAP_SIZE];
+
+// Called by the LIN master after every complete frame
+void LinCacheUpdateI(const stLinFrame *frame)
+{
+    for (uint8_t i = 0; i < LIN_RTR_MAP_SIZE; i++)
+    {
+        stLinCacheEntry *e = &cache[i];
+        if (!e->map.bEnabled || (e->map.nLinId != frame->nId))
+            continue;
+
+        e->nLength = frame->nLength > 8 ? 8 : frame->nLength;
+        for (uint8_t j = 0; j < e->nLength; j++)
+            e->nData[j] = frame->nData[j];
+        e->bValid = true;
+    }
+}
+
+void LinCacheUpdate(const stLinFrame *frame)
+{
+    chSysLock();
+    LinCacheUpdateI(frame);
+    chSysUnlock();
+}
+
+bool SetLinRtrMap(uint8_t nIndex, const stLinRtrMap *map)
+{
+    if ((nIndex >= LIN_RTR_MAP_SIZE) || (map->nLinId > 0x3F))
+        return false;
+
+    chSysLock();
+    cache[nIndex].map = *map;
+    cache[nIndex].bValid = false; // Wait for data of the new LIN ID
+    chSysUnlock();
+
+    return true;
+}
+
+bool GetLinRtrMap(uint8_t nIndex, stLinRtrMap *map)
+{
+    if (nIndex >= LIN_RTR_MAP_SIZE)
+        return false;
+
+    *map = cache[nIndex].map;
+    return true;
+}
+
+// Called from the CAN RX interrupt, fills reply when the remote request
+// maps to a LIN frame that has been seen
+bool LinRtrAnswerI(const CANRxFrame *request, CANTxFrame *reply)
+{
+    if (request->RTR != CAN_RTR_REMOTE)
+        return false;
+
+    const uint32_t nKey = (request->IDE == CAN_IDE_EXT) ? (request->EID | 0x80000000) : request->SID;
+
+    for (uint8_t i = 0; i < LIN_RTR_MAP_SIZE; i++)
+    {
+        const stLinCacheEntry *e = &cache[i];
+        if (!e->map.bEnabled || !e->bValid || (e->map.nCanId != nKey))
+            continue;
+
+        reply->IDE = request->IDE;
+        if (request->IDE == CAN_IDE_EXT)
+            reply->EID = request->EID;
+        else
+            reply->SID = request->SID;
+        reply->RTR = CAN_RTR_DATA;
+        reply->DLC = e->nLength;
+        for (uint8_t j = 0; j < 8; j++)
+            reply->data8[j] = j < e->nLength ? e->nData[j] : 0;
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include "hal.h"
+#include "lin.h"
+
+// CAN remote requests answered from the latest LIN data
+#define LIN_RTR_MAP_SIZE 8
+
+typedef struct {
+    bool bEnabled;
+    uint32_t nCanId;   // Bit 31 set for extended
+    uint8_t nLinId;
+} stLinRtrMap;
+
+void LinCacheUpdate(const stLinFrame *frame);
+void LinCacheUpdateI(const stLinFrame *frame);
+bool SetLinRtrMap(uint8_t nIndex, const stLinRtrMap *map);
+bool GetLinRtrMap(uint8_t nIndex, stLinRtrMap *map);
+bool LinRtrAnswerI(const CANRxFrame *request, CANTxFrame *reply);
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "enums.h"
+
+/*
+ * LIN protocol codec. Everything is constexpr and only depends on
+ * enums.h, constant frames are encoded at compile time and the same code
+ * builds on the host.
+ *
+ * The checksum is the inverted 8 bit sum with carry, each carry out of
+ * bit 7 is added back into bit 0. Folding the carry after every byte
+ * keeps the running sum within 8 bits, so bytes can be added one at a
+ * time as they are received.
+ */
+
+// P0 = ID0 ^ ID1 ^ ID2 ^ ID4, P1 = !(ID1 ^ ID3 ^ ID4 ^ ID5)
+constexpr uint8_t LinPidParity(uint8_t nId)
+{
+    const uint8_t p0 = (nId ^ (nId >> 1) ^ (nId >> 2) ^ (nId >> 4)) & 1;
+    const uint8_t p1 = ~((nId >> 1) ^ (nId >> 3) ^ (nId >> 4) ^ (nId >> 5)) & 1;
+
+    return (p0 << 6) | (p1 << 7);
+}
+
+struct LinPidTable
+{
+    uint8_t pid[64];
+
+    constexpr uint8_t operator[](uint8_t nId) const { return pid[nId & 0x3F]; }
+};
+
+constexpr LinPidTable LinMakePidTable(void)
+{
+    LinPidTable table = {};
+    for (uint8_t nId = 0; nId < 64; nId++)
+        table.pid[nId] = nId | LinPidParity(nId);
+    return table;
+}
+
+inline constexpr LinPidTable LIN_PID_TABLE = LinMakePidTable();
+
+// Protected identifier of a frame ID, bits 6 and 7 of nId are ignored
+constexpr uint8_t LinPid(uint8_t nId)
+{
+    return LIN_PID_TABLE[nId];
+}
+
+constexpr bool LinPidValid(uint8_t nPid)
+{
+    return LIN_PID_TABLE[nPid] == nPid;
+}
+
+class LinChecksum
+{
+public:
+    constexpr LinChecksum() : nSum(0) {}
+
+    // Enhanced sums start with the PID, classic ones with 0
+    constexpr LinChecksum(LinChecksumModel eModel, uint8_t nPid) :
+        nSum(eModel == LinChecksumModel::Enhanced ? nPid : 0) {}
+
+    constexpr void Add(uint8_t nByte)
+    {
+        const uint16_t s = nSum + nByte;
+        nSum = (s & 0xFF) + (s >> 8);
+    }
+
+    // Sums the block first and folds once at the end, at most 256 bytes
+    // so the sum fits 16 bits and two folds take it back to 8
+    constexpr void Add(const uint8_t *data, size_t nLength)
+    {
+        uint16_t s = nSum;
+        for (size_t i = 0; i < nLength; i++)
+            s += data[i];
+
+        s = (s & 0xFF) + (s >> 8);
+        nSum = (s & 0xFF) + (s >> 8);
+    }
+
+    // Checksum byte to send
+    constexpr uint8_t Value(void) const { return ~nSum & 0xFF; }
+
+    constexpr bool Check(uint8_t nChecksum) const { return nChecksum == Value(); }
+
+private:
+    uint8_t nSum;
+};
+
+constexpr uint8_t LinCalculateChecksum(LinChecksumModel eModel, uint8_t nPid, const uint8_t *data, size_t nLength)
+{
+    LinChecksum sum(eModel, nPid);
+    sum.Add(data, nLength);
+    return sum.Value();
+}
+
+// Checks a received frame, parity first as the checksum model depends on
+// the ID. Returns LinResult::Ok, Parity or Checksum.
+constexpr LinResult LinCheckFrame(LinChecksumModel eModel, uint8_t nPid, const uint8_t *data, size_t nLength,
+                                  uint8_t nChecksum)
+{
+    if (!LinPidValid(nPid))
+        return LinResult::Parity;
+
+    if (LinCalculateChecksum(eModel, nPid, data, nLength) != nChecksum)
+        return LinResult::Checksum;
+
+    return LinResult::Ok;
+}
+
+static_assert(LinPid(0x3C) == 0x3C, "PID table");
+static_assert(LinPid(0x3D) == 0x7D, "PID table");
+static_assert(LinPid(0x30) == 0xF0, "PID table");
@@ -0,0 +1,44 @@
+#include "linframe.h"
+#include "linldf.h"
+
+// Indexed by frame ID, read from the UART interrupt
+static stLinFrameDesc descs[LIN_FRAME_IDS];
+
+void InitLinFrames(void)
+{
+    for (uint8_t i = 0; i < LIN_FRAME_IDS; i++)
+        descs[i] = {0, LinDirection::Subscribe, LinChecksumModel::Classic};
+
+    for (const stLdfFrame &frame : LDF_FRAMES)
+        descs[frame.nId] = frame.desc;
+}
+
+bool SetLinFrameDesc(uint8_t nId, const stLinFrameDesc *desc)
+{
+    if ((nId >= LIN_FRAME_IDS) || (desc->nLength > 8))
+        return false;
+
+    // Diagnostic frames always use the classic checksum
+    if ((nId >= LIN_ID_MASTER_REQUEST) && (desc->eChecksum != LinChecksumModel::Classic))
+        return false;
+
+    chSysLock();
+    descs[nId] = *desc;
+    chSysUnlock();
+
+    return true;
+}
+
+const stLinFrameDesc *GetLinFrameDesc(uint8_t nId)
+{
+    return &descs[nId & 0x3F];
+}
+
+// Null for frames that are not event triggered
+const stLdfEventFrame *GetLinEventFrame(uint8_t nId)
+{
+    for (uint8_t i = 0; i < LDF_EVENT_FRAME_COUNT; i++)
+        if (LDF_EVENT_FRAMES[i].nId == nId)
+            return &LDF_EVENT_FRAMES[i];
+    return nullptr;
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include "hal.h"
+#include "enums.h"
+#include "sigcodec.h"
+
+#define LIN_FRAME_IDS 64
+
+// Diagnostic frames, fixed by the specification
+#define LIN_ID_MASTER_REQUEST 0x3C
+#define LIN_ID_SLAVE_RESPONSE 0x3D
+
+// Unconditional frames behind an event triggered or sporadic frame
+#define LIN_ASSOCIATED_MAX 8
+
+// Schedule slot ID of a sporadic frame, low bits index LDF_SPORADIC_FRAMES
+#define LIN_SLOT_SPORADIC 0x40
+
+typedef struct {
+    uint8_t nLength;   // Data bytes, 0 for an unknown frame
+    LinDirection eDir; // Seen from the master
+    LinChecksumModel eChecksum;
+} stLinFrameDesc;
+
+// Cluster frames and signals are generated from linboard.ldf into linldf.h
+typedef struct {
+    uint8_t nId;
+    stLinFrameDesc desc;
+} stLdfFrame;
+
+typedef struct {
+    uint8_t nFrameId;
+    uint8_t nOffset; // Bit offset in the frame, bit 0 is the LSB of byte 0
+    uint8_t nSize;   // Bits
+    uint32_t nInit;
+} stLinSignal;
+
+// Slaves answer only when an associated frame has new data, with its PID
+// in the first data byte. More than one answering is a collision.
+typedef struct {
+    uint8_t nId;
+    uint8_t nCount;
+    uint8_t frames[LIN_ASSOCIATED_MAX];
+} stLdfEventFrame;
+
+// The slot carries the first associated frame with updated data, written
+// through the slave table (SetLinSlaveData)
+typedef struct {
+    uint8_t nCount;
+    uint8_t frames[LIN_ASSOCIATED_MAX]; // By priority, highest first
+} stLdfSporadicFrame;
+
+// Codec of a signal from the generated LDF tables, LIN is little endian
+template <stLinSignal sig, bool bSigned = false>
+using LinSignal = Signal<sig.nOffset, sig.nSize, ByteOrder::Intel, bSigned>;
+
+void InitLinFrames(void);
+bool SetLinFrameDesc(uint8_t nId, const stLinFrameDesc *desc);
+const stLinFrameDesc *GetLinFrameDesc(uint8_t nId);
+const stLdfEventFrame *GetLinEventFrame(uint8_t nId);
@@ -0,0 +1,68 @@
+// Generated by tools/ldfgen from linboard.ldf, do not edit
+#pragma once
+
+#include <cstdint>
+#include "linframe.h"
+#include "linschedule.h"
+
+#define LDF_BAUDRATE 19200
+
+// Frame IDs
+constexpr uint8_t LDF_ID_WIPER_CMD = 0x30;
+constexpr uint8_t LDF_ID_WIPER_STATUS = 0x31;
+constexpr uint8_t LDF_ID_MASTER_REQ = 0x3C;
+constexpr uint8_t LDF_ID_SLAVE_RESP = 0x3D;
+
+// Frame lengths
+constexpr uint8_t LDF_LENGTH_WIPER_CMD = 5;
+constexpr uint8_t LDF_LENGTH_WIPER_STATUS = 5;
+constexpr uint8_t LDF_LENGTH_MASTER_REQ = 8;
+constexpr uint8_t LDF_LENGTH_SLAVE_RESP = 8;
+
+// Frame descriptors
+constexpr stLdfFrame LDF_FRAMES[] = {
+    {LDF_ID_WIPER_CMD, {5, LinDirection::Publish, LinChecksumModel::Classic}},
+    {LDF_ID_WIPER_STATUS, {5, LinDirection::Subscribe, LinChecksumModel::Classic}},
+    {LDF_ID_MASTER_REQ, {8, LinDirection::Publish, LinChecksumModel::Classic}},
+    {LDF_ID_SLAVE_RESP, {8, LinDirection::Subscribe, LinChecksumModel::Classic}},
+};
+constexpr uint8_t LDF_FRAME_COUNT = 4;
+
+// Signal layouts, frame ID, bit offset, size in bits and initial value
+constexpr stLinSignal LDF_SIGNAL_WIPER_ALIVE = {LDF_ID_WIPER_CMD, 0, 8, 48};
+constexpr stLinSignal LDF_SIGNAL_WIPER_CONTROL = {LDF_ID_WIPER_CMD, 8, 8, 0};
+constexpr stLinSignal LDF_SIGNAL_WIPER_PARAM = {LDF_ID_WIPER_CMD, 16, 8, 0};
+constexpr stLinSignal LDF_SIGNAL_WIPER_POSITION = {LDF_ID_WIPER_STATUS, 8, 8, 0};
+constexpr stLinSignal LDF_SIGNAL_WIPER_MOVING = {LDF_ID_WIPER_STATUS, 29, 1, 0};
+
+// Event triggered frames, ID and associated unconditional frames
+constexpr const stLdfEventFrame *LDF_EVENT_FRAMES = nullptr;
+constexpr uint8_t LDF_EVENT_FRAME_COUNT = 0;
+
+// Sporadic frames, slot constants and associated frames by priority
+constexpr const stLdfSporadicFrame *LDF_SPORADIC_FRAMES = nullptr;
+constexpr uint8_t LDF_SPORADIC_FRAME_COUNT = 0;
+
+// Schedule table Normal
+constexpr stLinSlot LDF_SCHEDULE_NORMAL[] = {
+    {LDF_ID_WIPER_CMD, 120},
+    {LDF_ID_WIPER_STATUS, 120},
+};
+constexpr uint8_t LDF_SCHEDULE_NORMAL_COUNT = 2;
+
+// Schedule table Diagnostic
+constexpr stLinSlot LDF_SCHEDULE_DIAGNOSTIC[] = {
+    {LDF_ID_MASTER_REQ, 10},
+    {LDF_ID_SLAVE_RESP, 10},
+    {LDF_ID_WIPER_CMD, 10},
+    {LDF_ID_MASTER_REQ, 10},
+    {LDF_ID_SLAVE_RESP, 10},
+    {LDF_ID_WIPER_STATUS, 10},
+};
+constexpr uint8_t LDF_SCHEDULE_DIAGNOSTIC_COUNT = 6;
+
+// Schedule table Sleep
+constexpr stLinSlot LDF_SCHEDULE_SLEEP[] = {
+    {LDF_ID_MASTER_REQ, 10},
+};
+constexpr uint8_t LDF_SCHEDULE_SLEEP_COUNT = 1;
@@ -0,0 +1,163 @@
+#include "linmonitor.h"
+#include "port.h"
+#include "lin.h"
+#include "lincodec.h"
+#include "mailbox.h"
+#include "linboard_config.h"
+
+typedef struct {
+    rtcnt_t nTime;
+    uint8_t nId;
+    uint8_t nLength;
+    uint8_t nFlags;
+    uint8_t nData[8];
+} stLinMonitorRecord;
+
+static stLinMonitorRecord ring[LIN_MONITOR_RING_SIZE];
+static volatile uint16_t nHead; // Written by the UART interrupt
+static volatile uint16_t nTail; // Written by the USB thread
+
+static volatile uint32_t nLost;
+static uint32_t nLostReported;
+static bool bForwardCan = false;
+
+// Microsecond timestamp extended from the cycle counter
+static rtcnt_t nLastCycles;
+static uint32_t nTimeUs;
+static uint32_t nCycleRemainder;
+
+static uint32_t ToUs(rtcnt_t nCycles)
+{
+    const uint32_t nDelta = nCycles - nLastCycles + nCycleRemainder;
+    nLastCycles = nCycles;
+    nTimeUs += nDelta / RT_TICKS_PER_US;
+    nCycleRemainder = nDelta % RT_TICKS_PER_US;
+    return nTimeUs;
+}
+
+// Write nDigits upper case hex characters, most significant first
+static uint8_t *PutHex(uint8_t *buf, uint32_t nValue, uint8_t nDigits)
+{
+    for (int8_t i = nDigits - 1; i >= 0; i--)
+    {
+        uint8_t nNibble = (nValue >> (i * 4)) & 0xF;
+        *buf++ = nNibble < 0xA ? nNibble + 0x30 : nNibble + 0x37;
+    }
+    return buf;
+}
+
+// Called before the monitor mode starts
+void ResetLinMonitor(void)
+{
+    nHead = 0;
+    nTail = 0;
+    nLost = 0;
+    nLostReported = 0;
+    nLastCycles = chSysGetRealtimeCounterX();
+    nTimeUs = 0;
+    nCycleRemainder = 0;
+}
+
+void SetLinMonitorCan(bool bEnabled)
+{
+    bForwardCan = bEnabled;
+}
+
+bool GetLinMonitorCan(void)
+{
+    return bForwardCan;
+}
+
+/*
+ * Called from the UART interrupt with everything received between a break
+ * and the receiver timeout or the next break. bytes[0] is the sync field,
+ * a response is only decoded when it has at least one data byte and the
+ * checksum.
+ */
+void LinMonitorRecordI(rtcnt_t nTime, const uint8_t *bytes, uint8_t nCount, bool bError)
+{
+    if (nCount < 2)
+        return; // Break without a header, nothing to show
+
+    const uint16_t nNext = (nHead + 1) & (LIN_MONITOR_RING_SIZE - 1);
+    if (nNext == nTail)
+    {
+        nLost++;
+        return;
+    }
+
+    stLinMonitorRecord *r = &ring[nHead];
+    const uint8_t nPid = bytes[1];
+
+    r->nTime = nTime;
+    r->nId = nPid & 0x3F;
+    r->nFlags = 0;
+    r->nLength = 0;
+
+    if (bError || (bytes[0] != 0x55) || (nCount > LIN_MONITOR_MAX_BYTES))
+        r->nFlags |= LIN_MON_FLAG_ERROR;
+    if (!LinPidValid(nPid))
+        r->nFlags |= LIN_MON_FLAG_PARITY;
+
+    if (nCount >= 4)
+    {
+        r->nLength = (nCount > LIN_MONITOR_MAX_BYTES ? LIN_MONITOR_MAX_BYTES : nCount) - 3;
+        for (uint8_t i = 0; i < r->nLength; i++)
+            r->nData[i] = bytes[2 + i];
+
+        const uint8_t nChecksum = bytes[2 + r->nLength];
+        if (LinCalculateChecksum(LinChecksumModel::Enhanced, nPid, r->nData, r->nLength) == nChecksum)
+            r->nFlags |= LIN_MON_FLAG_ENHANCED;
+        else if (LinCalculateChecksum(LinChecksumModel::Classic, nPid, r->nData, r->nLength) != nChecksum)
+            r->nFlags |= LIN_MON_FLAG_CHECKSUM;
+    }
+
+    nHead = nNext;
+
+    if (bForwardCan)
+    {
+        CANTxFrame msg;
+        msg.IDE = CAN_IDE_EXT;
+        msg.EID = LIN_MONITOR_CAN_EID | (r->nFlags << 8) | r->nId;
+        msg.RTR = CAN_RTR_DATA;
+        msg.DLC = r->nLength;
+        for (uint8_t i = 0; i < r->nLength; i++)
+            msg.data8[i] = r->nData[i];
+        PostTxFrameI(&msg, CanTxClass::Telemetry);
+    }
+}
+
+// Fills buf with as many whole lines as fit, called from the USB thread
+size_t LinMonitorEncode(uint8_t *buf, size_t nSize)
+{
+    uint8_t *p = buf;
+    uint8_t *pEnd = buf + nSize;
+
+    if ((nLost != nLostReported) && (p + LIN_MONITOR_LINE_MAX <= pEnd))
+    {
+        nLostReported = nLost;
+        *p++ = 'J';
+        p = PutHex(p, nLostReported, 8);
+        *p++ = '\r';
+    }
+
+    uint16_t nIndex = nTail;
+    while ((nIndex != nHead) && (p + LIN_MONITOR_LINE_MAX <= pEnd))
+    {
+        const stLinMonitorRecord *r = &ring[nIndex];
+
+        *p++ = 'j';
+        p = PutHex(p, ToUs(r->nTime), 8);
+        p = PutHex(p, r->nId, 2);
+        p = PutHex(p, r->nLength, 1);
+        for (uint8_t i = 0; i < r->nLength; i++)
+            p = PutHex(p, r->nData[i], 2);
+        p = PutHex(p, r->nFlags, 1);
+        *p++ = '\r';
+
+        nIndex = (nIndex + 1) & (LIN_MONITOR_RING_SIZE - 1);
+    }
+    nTail = nIndex;
+
+    return p - buf;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include "hal.h"
+
+// Power of two, frames buffered between the UART interrupt and USB
+#define LIN_MONITOR_RING_SIZE 64
+
+// Sync, PID, 8 data bytes and checksum
+#define LIN_MONITOR_MAX_BYTES 11
+
+/*
+ * Monitor frames are sent to USB as
+ * 'j' TTTTTTTT II L DD.. F '\r'
+ * with the break time in us, frame ID, number of data bytes (0 for a
+ * header nobody answered), the data and LIN_MON_FLAG_* flags. A
+ * 'J' NNNNNNNN '\r' line carries the total of frames lost to a full ring.
+ */
+#define LIN_MON_FLAG_PARITY 0x01   // PID parity bits wrong
+#define LIN_MON_FLAG_CHECKSUM 0x02 // Neither classic nor enhanced checksum matched
+#define LIN_MON_FLAG_ENHANCED 0x04 // Enhanced checksum matched
+#define LIN_MON_FLAG_ERROR 0x08    // Bad sync, framing or noise error, or too long
+
+// Longest encoded line
+#define LIN_MONITOR_LINE_MAX 30
+
+void ResetLinMonitor(void);
+void SetLinMonitorCan(bool bEnabled);
+bool GetLinMonitorCan(void);
+void LinMonitorRecordI(rtcnt_t nTime, const uint8_t *bytes, uint8_t nCount, bool bError);
+size_t LinMonitorEncode(uint8_t *buf, size_t nSize);
@@ -0,0 +1,179 @@
+#include "linpower.h"
+#include "port.h"
+#include "lin.h"
+#include "can.h"
+#include "linschedule.h"
+#include "lintp.h"
+
+static volatile LinPowerState eState = LinPowerState::Awake;
+static volatile uint32_t nLastActivity; // SYS_TIME of the last LIN activity
+static uint32_t nSleepIdleMs = LIN_SLEEP_IDLE_MS;
+static uint32_t nSleepCanTime;          // Last CAN frame before the bus slept
+static volatile bool bRemoteWake;
+
+// Sleep and wakeup run under the mutex, the semaphore wakes the power
+// thread while asleep
+static mutex_t powerMtx;
+static binary_semaphore_t wakeSem;
+
+// In sleep mode the TJA1029T pulls RXD low on a wakeup pulse from a slave
+static void LinWakePulseCb(void *)
+{
+    chSysLockFromISR();
+    palDisableLineEventI(LINE_LIN_RX);
+    bRemoteWake = true;
+    chBSemSignalI(&wakeSem);
+    chSysUnlockFromISR();
+}
+
+static bool LinBusIdle(void)
+{
+    if ((nSleepIdleMs == 0) || (GetLinMode() != LinMode::Master))
+        return false;
+
+    const uint32_t nNow = SYS_TIME;
+    return ((nNow - GetLastCanRxTime()) >= nSleepIdleMs) && ((nNow - nLastActivity) >= nSleepIdleMs);
+}
+
+// Diagnostic requests posted while the sleep table ran are still queued
+static void LinResumeSchedule(void)
+{
+    chSysLock();
+    SetLinSchedule(LinTpPendingI() ? LinScheduleId::Diagnostic : LinScheduleId::Normal);
+    chSysUnlock();
+}
+
+// Sends the go-to-sleep command, then powers down the transceiver and
+// arms the wakeup detection. Activity meanwhile keeps the bus awake.
+static void LinGoToSleep(void)
+{
+    const uint32_t nActivity = nLastActivity;
+    const uint32_t nStart = SYS_TIME;
+
+    // The current slot has to end first, it can be up to LIN_PERIOD_MAX_MS
+    SetLinSchedule(LinScheduleId::Sleep);
+    while ((GetLinSchedule() != LinScheduleId::Sleep) || !LinScheduleIdle())
+    {
+        if ((nLastActivity != nActivity) || (GetLinMode() != LinMode::Master) ||
+            ((SYS_TIME - nStart) > LIN_PERIOD_MAX_MS + 100))
+        {
+            LinResumeSchedule();
+            return;
+        }
+        chThdSleepMilliseconds(1);
+    }
+
+    StopLinSchedule();
+    LinSleep();
+
+    chBSemReset(&wakeSem, true);
+    bRemoteWake = false;
+    nSleepCanTime = GetLastCanRxTime();
+    eState = LinPowerState::Asleep;
+
+    palSetLineMode(LINE_LIN_RX, PAL_MODE_INPUT_PULLUP);
+    palSetLineCallback(LINE_LIN_RX, LinWakePulseCb, nullptr);
+    palEnableLineEvent(LINE_LIN_RX, PAL_EVENT_MODE_FALLING_EDGE);
+}
+
+// A local wakeup sends the dominant pulse itself, the schedule starts once
+// the slaves are ready
+static void LinWakeBus(bool bLocal)
+{
+    palDisableLineEvent(LINE_LIN_RX);
+    palSetLineMode(LINE_LIN_RX, PAL_MODE_ALTERNATE(7));
+
+    if (bLocal)
+    {
+        palSetLine(LINE_LIN_STANDBY);
+        palSetLineMode(LINE_LIN_TX, PAL_MODE_OUTPUT_PUSHPULL);
+        palClearLine(LINE_LIN_TX);
+        chThdSleepMilliseconds(LIN_WAKEUP_PULSE_MS);
+        palSetLine(LINE_LIN_TX);
+        palSetLineMode(LINE_LIN_TX, PAL_MODE_ALTERNATE(7));
+    }
+
+    LinWakeup();
+    eState = LinPowerState::Awake;
+    nLastActivity = SYS_TIME;
+
+    chThdSleepMilliseconds(LIN_WAKEUP_READY_MS);
+
+    LinResumeSchedule();
+    if (GetLinMode() == LinMode::Master)
+        StartLinSchedule();
+}
+
+static THD_WORKING_AREA(lin_power_wa, 256);
+static THD_FUNCTION(lin_power_thread, arg)
+{
+    (void)arg;
+    chRegSetThreadName("lin_power");
+
+    while (true)
+    {
+        if (eState == LinPowerState::Awake)
+        {
+            chThdSleepMilliseconds(LIN_POWER_POLL_MS);
+
+            chMtxLock(&powerMtx);
+            if ((eState == LinPowerState::Awake) && LinBusIdle())
+                LinGoToSleep();
+            chMtxUnlock(&powerMtx);
+        }
+        else
+        {
+            // Slave wakeup pulse, local activity or CAN traffic
+            const bool bSignalled = chBSemWaitTimeout(&wakeSem, TIME_MS2I(LIN_POWER_POLL_MS)) == MSG_OK;
+
+            chMtxLock(&powerMtx);
+            if ((eState == LinPowerState::Asleep) &&
+                (bSignalled || (GetLastCanRxTime() != nSleepCanTime)))
+                LinWakeBus(!bRemoteWake);
+            chMtxUnlock(&powerMtx);
+        }
+    }
+}
+
+void InitLinPower(void)
+{
+    chMtxObjectInit(&powerMtx);
+    chBSemObjectInit(&wakeSem, true);
+    nLastActivity = SYS_TIME;
+
+    chThdCreateStatic(lin_power_wa, sizeof(lin_power_wa), NORMALPRIO - 1, lin_power_thread, nullptr);
+}
+
+// Signals changing or commanded, keeps the bus awake and wakes it from
+// sleep without waiting for it
+void LinPowerActivity(void)
+{
+    nLastActivity = SYS_TIME;
+    if (eState == LinPowerState::Asleep)
+        chBSemSignal(&wakeSem);
+}
+
+// Wakes the bus and returns once it is up
+void LinPowerWake(void)
+{
+    chMtxLock(&powerMtx);
+    nLastActivity = SYS_TIME;
+    if (eState == LinPowerState::Asleep)
+        LinWakeBus(true);
+    chMtxUnlock(&powerMtx);
+}
+
+void SetLinSleepIdle(uint32_t nIdleMs)
+{
+    nSleepIdleMs = nIdleMs;
+}
+
+uint32_t GetLinSleepIdle(void)
+{
+    return nSleepIdleMs;
+}
+
+LinPowerState GetLinPowerState(void)
+{
+    return eState;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include "hal.h"
+#include "enums.h"
+
+// CAN and LIN idle time before the master puts the bus to sleep, 0 never
+#define LIN_SLEEP_IDLE_MS 60000
+#define LIN_SLEEP_IDLE_MAX_MS 3600000
+
+#define LIN_POWER_POLL_MS 50
+#define LIN_WAKEUP_PULSE_MS 1   // Dominant pulse of a local wakeup, 250 us to 5 ms
+#define LIN_WAKEUP_READY_MS 100 // Slaves are ready this long after the pulse
+
+void InitLinPower(void);
+void LinPowerActivity(void);
+void LinPowerWake(void);
+void SetLinSleepIdle(uint32_t nIdleMs);
+uint32_t GetLinSleepIdle(void);
+LinPowerState GetLinPowerState(void);
@@ -0,0 +1,234 @@
+#include "linschedule.h"
+#include "port.h"
+#include "lin.h"
+#include "linldf.h"
+
+static_assert(LDF_SCHEDULE_NORMAL_COUNT <= LIN_SCHEDULE_MAX_SLOTS, "Normal schedule too long");
+static_assert(LDF_SCHEDULE_DIAGNOSTIC_COUNT <= LIN_SCHEDULE_MAX_SLOTS, "Diagnostic schedule too long");
+static_assert(LDF_SCHEDULE_SLEEP_COUNT <= LIN_SCHEDULE_MAX_SLOTS, "Sleep schedule too long");
+
+// Filled from the LDF tables, delays are runtime adjustable
+static stLinSlot normalSlots[LDF_SCHEDULE_NORMAL_COUNT];
+static stLinSlot diagnosticSlots[LDF_SCHEDULE_DIAGNOSTIC_COUNT];
+static stLinSlot sleepSlots[LDF_SCHEDULE_SLEEP_COUNT];
+static stLinSlot collisionSlots[LIN_ASSOCIATED_MAX];
+
+// The sleep table sends the go-to-sleep command once, the collision table
+// runs once and then resumes the table it interrupted
+static stLinSchedule schedules[static_cast<uint8_t>(LinScheduleId::Count)] = {
+    {normalSlots, LDF_SCHEDULE_NORMAL_COUNT, false},
+    {diagnosticSlots, LDF_SCHEDULE_DIAGNOSTIC_COUNT, false},
+    {sleepSlots, LDF_SCHEDULE_SLEEP_COUNT, true},
+    {collisionSlots, 0, true},
+};
+
+static stLinSlotStats stats[static_cast<uint8_t>(LinScheduleId::Count)][LIN_SCHEDULE_MAX_SLOTS];
+
+// Timer interrupt state
+static volatile LinScheduleId eActive = LinScheduleId::Normal;
+static volatile LinScheduleId ePending = LinScheduleId::Normal;
+static uint8_t nSlot;
+static uint16_t nTicksLeft;
+static bool bIdle;
+static LinScheduleId eResume;  // Table interrupted by the collision table
+static uint8_t nResumeSlot;
+
+// Slot handed to the master thread
+static thread_reference_t linThreadRef = nullptr;
+static LinScheduleId eStartedTable;
+static uint8_t nStartedSlot;
+static rtcnt_t nSlotStartTime;
+
+static void LinTimeBaseCb(GPTDriver *);
+
+static const GPTConfig gptConfig = {
+    .frequency = 1000000U,
+    .callback = LinTimeBaseCb,
+    .cr2 = 0,
+    .dier = 0
+};
+
+// Runs every time base tick, starts a slot when the previous one has
+// run its full delay so frame times never push the schedule back
+static void LinTimeBaseCb(GPTDriver *)
+{
+    osalSysLockFromISR();
+
+    if (nTicksLeft > 0)
+        nTicksLeft--;
+
+    if ((nTicksLeft == 0) && !(bIdle && (ePending == eActive)))
+    {
+        // Table switches only take effect at a slot boundary
+        if (ePending != eActive)
+        {
+            if (ePending == LinScheduleId::Collision)
+                nResumeSlot = nSlot;
+            nSlot = ((eActive == LinScheduleId::Collision) && (ePending == eResume)) ? nResumeSlot : 0;
+            eActive = ePending;
+            bIdle = false;
+        }
+
+        const uint8_t t = static_cast<uint8_t>(eActive);
+        const stLinSchedule *schedule = &schedules[t];
+
+        if (linThreadRef != nullptr)
+        {
+            eStartedTable = eActive;
+            nStartedSlot = nSlot;
+            nSlotStartTime = chSysGetRealtimeCounterX();
+            chThdResumeI(&linThreadRef, MSG_OK);
+        }
+        else
+        {
+            stats[t][nSlot].nOverruns++;
+        }
+
+        nTicksLeft = schedule->slots[nSlot].nDelayMs / LIN_TIME_BASE_MS;
+
+        if (++nSlot >= schedule->nCount)
+        {
+            nSlot = 0;
+            if (eActive != LinScheduleId::Collision)
+                bIdle = schedule->bRunOnce;
+            else if (ePending == eActive)
+                ePending = eResume;
+        }
+    }
+
+    osalSysUnlockFromISR();
+}
+
+void InitLinSchedule(void)
+{
+    for (uint8_t i = 0; i < LDF_SCHEDULE_NORMAL_COUNT; i++)
+        normalSlots[i] = LDF_SCHEDULE_NORMAL[i];
+    for (uint8_t i = 0; i < LDF_SCHEDULE_DIAGNOSTIC_COUNT; i++)
+        diagnosticSlots[i] = LDF_SCHEDULE_DIAGNOSTIC[i];
+    for (uint8_t i = 0; i < LDF_SCHEDULE_SLEEP_COUNT; i++)
+        sleepSlots[i] = LDF_SCHEDULE_SLEEP[i];
+
+    eActive = LinScheduleId::Normal;
+    ePending = LinScheduleId::Normal;
+
+    gptStart(&GPTD15, &gptConfig);
+    StartLinSchedule();
+}
+
+// Restarts the active table from its first slot
+void StartLinSchedule(void)
+{
+    chSysLock();
+    if (eActive == LinScheduleId::Collision)
+    {
+        eActive = eResume;
+        ePending = eResume;
+    }
+    nSlot = 0;
+    nTicksLeft = 0;
+    bIdle = false;
+    chSysUnlock();
+
+    gptStartContinuous(&GPTD15, LIN_TIME_BASE_MS * 1000U);
+}
+
+void StopLinSchedule(void)
+{
+    gptStopTimer(&GPTD15);
+}
+
+// Takes effect when the current slot ends, the collision table is only
+// started by LinScheduleResolveCollision
+void SetLinSchedule(LinScheduleId eId)
+{
+    if (eId < LinScheduleId::Collision)
+        ePending = eId;
+}
+
+LinScheduleId GetLinSchedule(void)
+{
+    return eActive;
+}
+
+// True once a run-once table has completed
+bool LinScheduleIdle(void)
+{
+    return bIdle && (nTicksLeft == 0);
+}
+
+// Blocks the master thread until the next slot starts
+msg_t LinScheduleWaitSlot(const stLinSlot **pSlot, LinScheduleId *pTable, sysinterval_t timeout)
+{
+    chSysLock();
+    msg_t ret = chThdSuspendTimeoutS(&linThreadRef, timeout);
+    *pTable = eStartedTable;
+    *pSlot = &schedules[static_cast<uint8_t>(eStartedTable)].slots[nStartedSlot];
+    chSysUnlock();
+
+    return ret;
+}
+
+// Polls the associated frames of a collided event triggered frame, one
+// slot each, from the next slot boundary. The interrupted table then
+// continues with the slot after the event triggered frame.
+void LinScheduleResolveCollision(const uint8_t *ids, uint8_t nCount, uint16_t nDelayMs)
+{
+    if ((nCount == 0) || (nCount > LIN_ASSOCIATED_MAX))
+        return;
+
+    chSysLock();
+    // Already resolving, or a table switch is due anyway
+    if ((eActive == LinScheduleId::Collision) || (ePending != eActive))
+    {
+        chSysUnlock();
+        return;
+    }
+
+    for (uint8_t i = 0; i < nCount; i++)
+        collisionSlots[i] = {ids[i], nDelayMs};
+    schedules[static_cast<uint8_t>(LinScheduleId::Collision)].nCount = nCount;
+
+    eResume = eActive;
+    ePending = LinScheduleId::Collision;
+    chSysUnlock();
+}
+
+// Called by the master thread right before the break of the slot frame
+void LinScheduleMarkStart(void)
+{
+    const uint32_t nUs = (chSysGetRealtimeCounterX() - nSlotStartTime) / RT_TICKS_PER_US;
+    stLinSlotStats *s = &stats[static_cast<uint8_t>(eStartedTable)][nStartedSlot];
+
+    s->nLastUs = nUs > 0xFFFF ? 0xFFFF : nUs;
+    if ((s->nCount == 0) || (s->nLastUs < s->nMinUs))
+        s->nMinUs = s->nLastUs;
+    if (s->nLastUs > s->nMaxUs)
+        s->nMaxUs = s->nLastUs;
+    s->nCount++;
+}
+
+void SetLinScheduleDelay(LinScheduleId eId, uint8_t nSlotIndex, uint16_t nDelayMs)
+{
+    if ((eId >= LinScheduleId::Count) || (nDelayMs < LIN_TIME_BASE_MS))
+        return;
+
+    const stLinSchedule *schedule = &schedules[static_cast<uint8_t>(eId)];
+    if (nSlotIndex >= schedule->nCount)
+        return;
+
+    chSysLock();
+    schedule->slots[nSlotIndex].nDelayMs = nDelayMs;
+    chSysUnlock();
+}
+
+bool GetLinSlotStats(LinScheduleId eId, uint8_t nSlotIndex, stLinSlotStats *pStats)
+{
+    if ((eId >= LinScheduleId::Count) || (nSlotIndex >= schedules[static_cast<uint8_t>(eId)].nCount))
+        return false;
+
+    chSysLock();
+    *pStats = stats[static_cast<uint8_t>(eId)][nSlotIndex];
+    chSysUnlock();
+
+    return true;
+}
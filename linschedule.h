@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include "hal.h"
+#include "enums.h"
+
+// Slot delays are counted in ticks of the LIN time base
+#define LIN_TIME_BASE_MS 1
+#define LIN_SCHEDULE_MAX_SLOTS 16
+
+enum class LinScheduleId : uint8_t
+{
+    Normal,
+    Diagnostic,
+    Sleep,
+    Collision, // Built at runtime to poll the frames of a collided event triggered frame
+    Count
+};
+
+// Length, direction and checksum of the frame come from its descriptor
+typedef struct {
+    uint8_t nId;
+    uint16_t nDelayMs; // Slot length, time to the next slot start
+} stLinSlot;
+
+typedef struct {
+    stLinSlot *slots;
+    uint8_t nCount;
+    bool bRunOnce; // Stop after the last slot instead of wrapping
+} stLinSchedule;
+
+typedef struct {
+    uint32_t nCount;
+    uint32_t nOverruns; // Slot start found the previous frame still running
+    uint16_t nLastUs;   // Slot start to break, microseconds
+    uint16_t nMinUs;
+    uint16_t nMaxUs;
+} stLinSlotStats;
+
+void InitLinSchedule(void);
+void StartLinSchedule(void);
+void StopLinSchedule(void);
+void SetLinSchedule(LinScheduleId eId);
+LinScheduleId GetLinSchedule(void);
+bool LinScheduleIdle(void);
+msg_t LinScheduleWaitSlot(const stLinSlot **pSlot, LinScheduleId *pTable, sysinterval_t timeout);
+void LinScheduleMarkStart(void);
+void LinScheduleResolveCollision(const uint8_t *ids, uint8_t nCount, uint16_t nDelayMs);
+void SetLinScheduleDelay(LinScheduleId eId, uint8_t nSlot, uint16_t nDelayMs);
+bool GetLinSlotStats(LinScheduleId eId, uint8_t nSlot, stLinSlotStats *stats);
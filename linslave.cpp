@@ -0,0 +1,91 @@
+#include "linslave.h"
+
+#include <cstring>
+
+static stLinSlaveEntry entries[LIN_SLAVE_IDS];
+
+bool SetLinSlaveEntry(uint8_t nId, bool bEnabled, LinDirection eDir)
+{
+    if (nId >= LIN_SLAVE_IDS)
+        return false;
+
+    chSysLock();
+    entries[nId].bEnabled = bEnabled;
+    entries[nId].eDir = eDir;
+    chSysUnlock();
+
+    return true;
+}
+
+// Takes effect from the next header, a response already started keeps its data
+bool SetLinSlaveData(uint8_t nId, uint8_t nOffset, const uint8_t *data, uint8_t nLength)
+{
+    if ((nId >= LIN_SLAVE_IDS) || (nOffset + nLength > 8))
+        return false;
+
+    chSysLock();
+    memcpy(&entries[nId].nData[nOffset], data, nLength);
+    entries[nId].bUpdated = true;
+    chSysUnlock();
+
+    return true;
+}
+
+bool GetLinSlaveEntry(uint8_t nId, stLinSlaveEntry *entry)
+{
+    if (nId >= LIN_SLAVE_IDS)
+        return false;
+
+    chSysLock();
+    *entry = entries[nId];
+    chSysUnlock();
+
+    return true;
+}
+
+// Called from the UART interrupt once the PID is in, nullptr when
+// the board does not take part in the frame
+const stLinSlaveEntry *LinSlaveLookupI(uint8_t nId)
+{
+    const stLinSlaveEntry *e = &entries[nId & 0x3F];
+    return e->bEnabled ? e : nullptr;
+}
+
+// Called from the UART interrupt with a complete subscribed frame
+void LinSlaveStoreI(const stLinFrame *frame)
+{
+    stLinSlaveEntry *e = &entries[frame->nId & 0x3F];
+    if (e->bEnabled && (e->eDir == LinDirection::Subscribe))
+        memcpy(e->nData, frame->nData, frame->nLength);
+}
+
+// Copies the data of a published frame for a sporadic slot and clears its
+// update flag, false when nothing was written since it was last taken
+bool LinSlaveTakeUpdate(uint8_t nId, uint8_t *data, uint8_t nLength)
+{
+    if ((nId >= LIN_SLAVE_IDS) || (nLength > 8))
+        return false;
+
+    chSysLock();
+    stLinSlaveEntry *e = &entries[nId];
+    const bool bTaken = e->bEnabled && (e->eDir == LinDirection::Publish) && e->bUpdated;
+    if (bTaken)
+    {
+        memcpy(data, e->nData, nLength);
+        e->bUpdated = false;
+    }
+    chSysUnlock();
+
+    return bTaken;
+}
+
+// The sporadic slot failed to send the data, the next one tries again
+void LinSlaveRestoreUpdate(uint8_t nId)
+{
+    if (nId >= LIN_SLAVE_IDS)
+        return;
+
+    chSysLock();
+    entries[nId].bUpdated = true;
+    chSysUnlock();
+}
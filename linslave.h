@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include "hal.h"
+#include "lin.h"
+
+// Response table indexed by frame ID, one entry per possible ID
+#define LIN_SLAVE_IDS 64
+
+// Length and checksum model come from the frame descriptor. As master the
+// published entries are the data of the frames behind sporadic slots.
+typedef struct {
+    bool bEnabled;
+    LinDirection eDir; // Publish: this board responds, Subscribe: response is read
+    bool bUpdated;     // Data written since a sporadic slot last sent it
+    uint8_t nData[8];
+} stLinSlaveEntry;
+
+bool SetLinSlaveEntry(uint8_t nId, bool bEnabled, LinDirection eDir);
+bool SetLinSlaveData(uint8_t nId, uint8_t nOffset, const uint8_t *data, uint8_t nLength);
+bool GetLinSlaveEntry(uint8_t nId, stLinSlaveEntry *entry);
+const stLinSlaveEntry *LinSlaveLookupI(uint8_t nId);
+void LinSlaveStoreI(const stLinFrame *frame);
+bool LinSlaveTakeUpdate(uint8_t nId, uint8_t *data, uint8_t nLength);
+void LinSlaveRestoreUpdate(uint8_t nId);
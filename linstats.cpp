@@ -0,0 +1,59 @@
+#include "linstats.h"
+#include "linframe.h"
+
+static stLinFrameStats stats[LIN_FRAME_IDS];
+
+static void Increment(uint16_t *pCount)
+{
+    if (*pCount < UINT16_MAX)
+        (*pCount)++;
+}
+
+static uint8_t BucketIndex(uint32_t nBits)
+{
+    // Position of the highest set bit picks the power of two bucket
+    const uint32_t nScaled = nBits >> 1;
+    if (nScaled == 0)
+        return 0;
+
+    const uint8_t nBucket = 32 - __builtin_clz(nScaled);
+    return nBucket >= LIN_RESPONSE_BUCKETS ? LIN_RESPONSE_BUCKETS - 1 : nBucket;
+}
+
+// Called with the result of every frame, from the UART interrupt or the
+// frame timeout
+void LinStatsRecordI(uint8_t nId, LinResult eResult)
+{
+    stLinFrameStats *s = &stats[nId & 0x3F];
+
+    if (eResult == LinResult::Ok)
+        s->nFrames++;
+    else if (eResult < LinResult::Count)
+        Increment(&s->nErrors[static_cast<uint8_t>(eResult)]);
+}
+
+// Called from the UART interrupt with the first response byte
+void LinStatsResponseI(uint8_t nId, uint32_t nSpaceBits)
+{
+    Increment(&stats[nId & 0x3F].nBuckets[BucketIndex(nSpaceBits)]);
+}
+
+bool GetLinFrameStats(uint8_t nId, stLinFrameStats *pStats)
+{
+    if (nId >= LIN_FRAME_IDS)
+        return false;
+
+    chSysLock();
+    *pStats = stats[nId];
+    chSysUnlock();
+
+    return true;
+}
+
+void ResetLinFrameStats(void)
+{
+    chSysLock();
+    for (stLinFrameStats &s : stats)
+        s = {};
+    chSysUnlock();
+}
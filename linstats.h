@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include "hal.h"
+#include "enums.h"
+
+// Response space histogram buckets, bucket n counts spaces below 2^(n+1)
+// bit times, the last one everything longer
+#define LIN_RESPONSE_BUCKETS 8
+
+/*
+ * Result counters and response times, indexed by frame ID. Counts the
+ * frames this node takes part in, as master or slave. No response is
+ * expected from event triggered frames without news and from diagnostic
+ * responses polled while the slave is busy. Error counters saturate.
+ *
+ * The response space is measured from the PID to the first response
+ * byte, less the 10 bits of that byte, so it is in bit times at the
+ * rate of the frame.
+ */
+typedef struct {
+    uint32_t nFrames; // Completed without error
+    uint16_t nErrors[static_cast<uint8_t>(LinResult::Count)]; // By LinResult, Ok and Busy unused
+    uint16_t nBuckets[LIN_RESPONSE_BUCKETS];
+} stLinFrameStats;
+
+void LinStatsRecordI(uint8_t nId, LinResult eResult);
+void LinStatsResponseI(uint8_t nId, uint32_t nSpaceBits);
+bool GetLinFrameStats(uint8_t nId, stLinFrameStats *stats);
+void ResetLinFrameStats(void);
@@ -0,0 +1,357 @@
+#include "lintp.h"
+#include "port.h"
+#include "linframe.h"
+#include "linschedule.h"
+#include "linpower.h"
+#include <cstring>
+
+// Posted requests, owned by the LIN master thread until their callback
+static mailbox_t queue;
+static msg_t queueBuf[LIN_TP_QUEUE_SIZE];
+
+// Request in transfer, only touched by the LIN master thread
+static stLinTpRequest *active = nullptr;
+static uint8_t nTxOffset;      // Request bytes sent
+static uint8_t nTxSn;          // Sequence number of the next consecutive frame
+static bool bTxInFlight;       // Master request frame prepared, result pending
+static bool bAwaitResponse;
+static uint16_t nRxExpected;   // Response length from the first frame
+static uint8_t nRxOffset;      // Response bytes received, 0 before the first segment
+static uint8_t nRxSn;
+static uint32_t nRxStartTime;  // Request sent, last segment or response pending
+
+void InitLinTp(void)
+{
+    chMBObjectInit(&queue, queueBuf, LIN_TP_QUEUE_SIZE);
+}
+
+// Queues a request, the diagnostic table runs until the queue is empty.
+// The request must stay valid until its callback.
+bool LinTpPost(stLinTpRequest *request)
+{
+    if ((request->req.nLength == 0) || (request->req.nLength > LIN_TP_MAX_PDU) ||
+        (GetLinMode() != LinMode::Master))
+        return false;
+
+    request->eStatus = LinTpStatus::Pending;
+    request->resp.nLength = 0;
+
+    chSysLock();
+    if (chMBPostI(&queue, reinterpret_cast<msg_t>(request)) != MSG_OK)
+    {
+        chSysUnlock();
+        request->eStatus = LinTpStatus::Idle;
+        return false;
+    }
+
+    // Locked against the master thread switching back on an empty queue
+    if (GetLinSchedule() != LinScheduleId::Sleep)
+        SetLinSchedule(LinScheduleId::Diagnostic);
+    chSysUnlock();
+
+    LinPowerActivity();
+
+    return true;
+}
+
+// A request is queued or in transfer, the table to resume after sleep
+bool LinTpPendingI(void)
+{
+    return (active != nullptr) || (chMBGetUsedCountI(&queue) > 0);
+}
+
+static void LinTpSignalCb(stLinTpRequest *request)
+{
+    chBSemSignal(static_cast<binary_semaphore_t *>(request->pArg));
+}
+
+// Blocks the calling thread until the request is done
+LinTpStatus LinTpTransfer(stLinTpRequest *request)
+{
+    binary_semaphore_t done;
+    chBSemObjectInit(&done, true);
+
+    request->cb = LinTpSignalCb;
+    request->pArg = &done;
+
+    if (!LinTpPost(request))
+        return LinTpStatus::Error;
+
+    chBSemWait(&done);
+    return request->eStatus;
+}
+
+// Reads 5 bytes of identifier nId, 0 is the product identification
+LinTpStatus LinReadById(uint8_t nNad, uint8_t nId, uint16_t nSupplier, uint16_t nFunction, uint8_t *data)
+{
+    stLinTpRequest request;
+    request.req.nNad = nNad;
+    request.req.nLength = 6;
+    request.req.nData[0] = LIN_TP_SID_READ_BY_ID;
+    request.req.nData[1] = nId;
+    request.req.nData[2] = nSupplier & 0xFF;
+    request.req.nData[3] = nSupplier >> 8;
+    request.req.nData[4] = nFunction & 0xFF;
+    request.req.nData[5] = nFunction >> 8;
+
+    LinTpStatus eStatus = LinTpTransfer(&request);
+    if (eStatus != LinTpStatus::Ok)
+        return eStatus;
+
+    if (request.resp.nLength < 6)
+        return LinTpStatus::Error;
+
+    memcpy(data, &request.resp.nData[1], 5);
+    return LinTpStatus::Ok;
+}
+
+LinTpStatus LinAssignNad(uint8_t nNad, uint16_t nSupplier, uint16_t nFunction, uint8_t nNewNad)
+{
+    stLinTpRequest request;
+    request.req.nNad = nNad;
+    request.req.nLength = 6;
+    request.req.nData[0] = LIN_TP_SID_ASSIGN_NAD;
+    request.req.nData[1] = nSupplier & 0xFF;
+    request.req.nData[2] = nSupplier >> 8;
+    request.req.nData[3] = nFunction & 0xFF;
+    request.req.nData[4] = nFunction >> 8;
+    request.req.nData[5] = nNewNad;
+
+    return LinTpTransfer(&request);
+}
+
+static void LinTpComplete(LinTpStatus eStatus)
+{
+    stLinTpRequest *request = active;
+
+    active = nullptr;
+    bTxInFlight = false;
+    bAwaitResponse = false;
+
+    request->eStatus = eStatus;
+    if (request->cb != nullptr)
+        request->cb(request);
+}
+
+// Fills the next master request segment of the queued requests, false
+// leaves the slot empty. Switches back to the normal table once the
+// queue is empty.
+bool LinTpPrepareRequest(stLinFrame *frame)
+{
+    if (active == nullptr)
+    {
+        msg_t msg;
+
+        chSysLock();
+        if (chMBFetchI(&queue, &msg) != MSG_OK)
+        {
+            if (GetLinSchedule() == LinScheduleId::Diagnostic)
+                SetLinSchedule(LinScheduleId::Normal);
+            chSysUnlock();
+            return false;
+        }
+        chSysUnlock();
+
+        active = reinterpret_cast<stLinTpRequest *>(msg);
+        nTxOffset = 0;
+        nTxSn = 1;
+        bAwaitResponse = false;
+    }
+
+    // Slave response slots poll for the answer meanwhile
+    if (bAwaitResponse)
+        return false;
+
+    const stLinTpPdu *req = &active->req;
+    uint8_t *d = frame->nData;
+    uint8_t nPos;
+
+    memset(d, 0xFF, sizeof(frame->nData));
+    d[0] = req->nNad;
+
+    if (req->nLength <= 6)
+    {
+        // Single frame
+        d[1] = req->nLength;
+        nPos = 2;
+    }
+    else if (nTxOffset == 0)
+    {
+        // First frame
+        d[1] = 0x10;
+        d[2] = req->nLength;
+        nPos = 3;
+    }
+    else
+    {
+        // Consecutive frame
+        d[1] = 0x20 | nTxSn;
+        nTxSn = (nTxSn + 1) & 0x0F;
+        nPos = 2;
+    }
+
+    while ((nPos < 8) && (nTxOffset < req->nLength))
+        d[nPos++] = req->nData[nTxOffset++];
+
+    bTxInFlight = true;
+    return true;
+}
+
+// Polls the slave response only while a response is outstanding
+bool LinTpResponseWanted(void)
+{
+    if (!bAwaitResponse)
+        return false;
+
+    if ((SYS_TIME - nRxStartTime) > LIN_TP_TIMEOUT_MS)
+    {
+        LinTpComplete(LinTpStatus::Timeout);
+        return false;
+    }
+
+    return true;
+}
+
+static void LinTpResponseDone(void)
+{
+    const stLinTpPdu *resp = &active->resp;
+
+    if (resp->nData[0] == LIN_TP_RSID_NEGATIVE)
+    {
+        // Response pending restarts the timeout and keeps polling
+        if ((resp->nLength >= 3) && (resp->nData[2] == LIN_TP_NRC_PENDING))
+        {
+            nRxOffset = 0;
+            nRxStartTime = SYS_TIME;
+            return;
+        }
+        LinTpComplete(LinTpStatus::Negative);
+    }
+    else if (resp->nData[0] == static_cast<uint8_t>(active->req.nData[0] + 0x40))
+    {
+        LinTpComplete(LinTpStatus::Ok);
+    }
+    else
+    {
+        LinTpComplete(LinTpStatus::Error);
+    }
+}
+
+static void LinTpRequestSent(LinResult eResult)
+{
+    bTxInFlight = false;
+
+    if (eResult != LinResult::Ok)
+    {
+        LinTpComplete(LinTpStatus::Error);
+        return;
+    }
+
+    if (nTxOffset < active->req.nLength)
+        return;
+
+    if (active->req.nNad == LIN_TP_NAD_FUNCTIONAL)
+    {
+        LinTpComplete(LinTpStatus::Ok);
+        return;
+    }
+
+    bAwaitResponse = true;
+    nRxOffset = 0;
+    nRxStartTime = SYS_TIME;
+}
+
+static void LinTpResponseReceived(const stLinFrame *frame, LinResult eResult)
+{
+    // A slave still processing does not answer, polled again until the timeout
+    if (eResult != LinResult::Ok)
+        return;
+
+    const uint8_t *d = frame->nData;
+    stLinTpPdu *resp = &active->resp;
+
+    if ((d[0] != active->req.nNad) && (active->req.nNad != LIN_TP_NAD_WILDCARD))
+        return;
+
+    nRxStartTime = SYS_TIME;
+
+    switch (d[1] >> 4)
+    {
+    case 0x0: // Single frame
+    {
+        const uint8_t nLength = d[1] & 0x0F;
+        if ((nRxOffset != 0) || (nLength == 0) || (nLength > 6))
+            break;
+
+        resp->nNad = d[0];
+        resp->nLength = nLength;
+        memcpy(resp->nData, &d[2], nLength);
+        LinTpResponseDone();
+        return;
+    }
+
+    case 0x1: // First frame
+        nRxExpected = ((d[1] & 0x0F) << 8) | d[2];
+        if ((nRxOffset != 0) || (nRxExpected <= 6) || (nRxExpected > LIN_TP_MAX_PDU))
+            break;
+
+        resp->nNad = d[0];
+        memcpy(resp->nData, &d[3], 5);
+        nRxOffset = 5;
+        nRxSn = 1;
+        return;
+
+    case 0x2: // Consecutive frame
+    {
+        if ((nRxOffset == 0) || ((d[1] & 0x0F) != nRxSn))
+            break;
+
+        uint8_t nCount = nRxExpected - nRxOffset;
+        if (nCount > 6)
+            nCount = 6;
+
+        memcpy(&resp->nData[nRxOffset], &d[2], nCount);
+        nRxOffset += nCount;
+        nRxSn = (nRxSn + 1) & 0x0F;
+
+        if (nRxOffset >= nRxExpected)
+        {
+            resp->nLength = nRxExpected;
+            LinTpResponseDone();
+        }
+        return;
+    }
+
+    default:
+        break;
+    }
+
+    LinTpComplete(LinTpStatus::Error);
+}
+
+// Result of a diagnostic frame run by the LIN master thread
+void LinTpHandleFrame(const stLinFrame *frame, LinResult eResult)
+{
+    if (active == nullptr)
+        return;
+
+    if ((frame->nId == LIN_ID_MASTER_REQUEST) && bTxInFlight)
+        LinTpRequestSent(eResult);
+    else if ((frame->nId == LIN_ID_SLAVE_RESPONSE) && bAwaitResponse)
+        LinTpResponseReceived(frame, eResult);
+}
+
+// Fails the request in transfer and every queued one, used while the
+// schedule is stopped
+void LinTpCancel(void)
+{
+    if (active != nullptr)
+        LinTpComplete(LinTpStatus::Timeout);
+
+    msg_t msg;
+    while (chMBFetchTimeout(&queue, &msg, TIME_IMMEDIATE) == MSG_OK)
+    {
+        active = reinterpret_cast<stLinTpRequest *>(msg);
+        LinTpComplete(LinTpStatus::Timeout);
+    }
+}
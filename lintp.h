@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include "hal.h"
+#include "lin.h"
+
+/*
+ * LIN diagnostic transport. Requests are carried in master request (0x3C)
+ * frames and answered in slave response (0x3D) frames as
+ * NAD, PCI, data, padded with 0xFF. Single frames carry up to 6 bytes,
+ * longer PDUs a first frame with the length followed by consecutive frames.
+ */
+#define LIN_TP_MAX_PDU 64      // SID and data bytes of a request or response
+#define LIN_TP_QUEUE_SIZE 4
+#define LIN_TP_TIMEOUT_MS 1000 // Request sent to response complete, restarted by response pending
+
+#define LIN_TP_NAD_FUNCTIONAL 0x7E // No response expected
+#define LIN_TP_NAD_WILDCARD 0x7F
+
+#define LIN_TP_SID_ASSIGN_NAD 0xB0
+#define LIN_TP_SID_READ_BY_ID 0xB2
+#define LIN_TP_RSID_NEGATIVE 0x7F
+#define LIN_TP_NRC_PENDING 0x78
+
+typedef struct {
+    uint8_t nNad;
+    uint8_t nLength; // SID and data bytes
+    uint8_t nData[LIN_TP_MAX_PDU];
+} stLinTpPdu;
+
+typedef struct stLinTpRequest stLinTpRequest;
+
+// Called from the LIN master thread once the request is done
+typedef void (*LinTpCb)(stLinTpRequest *request);
+
+struct stLinTpRequest {
+    stLinTpPdu req;
+    stLinTpPdu resp;
+    volatile LinTpStatus eStatus;
+    LinTpCb cb;
+    void *pArg;
+};
+
+bool LinTpPost(stLinTpRequest *request);
+LinTpStatus LinTpTransfer(stLinTpRequest *request);
+bool LinTpPendingI(void);
+LinTpStatus LinReadById(uint8_t nNad, uint8_t nId, uint16_t nSupplier, uint16_t nFunction, uint8_t *data);
+LinTpStatus LinAssignNad(uint8_t nNad, uint16_t nSupplier, uint16_t nFunction, uint8_t nNewNad);
+
+// LIN master thread side
+void InitLinTp(void);
+bool LinTpPrepareRequest(stLinFrame *frame);
+bool LinTpResponseWanted(void);
+void LinTpHandleFrame(const stLinFrame *frame, LinResult eResult);
+void LinTpCancel(void);
@@ -0,0 +1,484 @@
+/*
+ * Resident CAN loader, linked at BOOT_LOADER_START and never written by
+ * an update. At reset it installs a verified staging image whose record
+ * differs from the application's, checks the application CRC and jumps
+ * to it. Without a valid application it serves the update protocol of
+ * boot.cpp on its own, polled, until an image is verified and run.
+ *
+ * Bare metal: registers only, no interrupts and no ChibiOS. The copy and
+ * the checks run on the reset clock, CAN is only started for the update
+ * loop.
+ */
+
+#include "bootflash.h"
+#include "bootproto.h"
+#include "linboard_config.h"
+#include "board.h"
+#include "stm32f3xx.h"
+
+#include <cstring>
+
+// bxCAN at 500k from a 36MHz PCLK1, the application's canConfig500 timing
+#define LOADER_CAN_BTR ((3U << CAN_BTR_BRP_Pos) | (14U << CAN_BTR_TS1_Pos) | (1U << CAN_BTR_TS2_Pos))
+
+// Polls of a busy transmit mailbox before the frame is dropped, a node
+// alone on the bus never gets its frame acknowledged
+#define LOADER_TX_POLLS 100000
+
+extern "C" {
+extern uint32_t __data_start__, __data_end__, __data_load__;
+extern uint32_t __bss_start__, __bss_end__;
+extern uint32_t __stack_end__;
+void Reset_Handler(void);
+}
+
+static void FaultHandler(void)
+{
+    NVIC_SystemReset();
+}
+
+typedef void (*VectorHandler)(void);
+
+__attribute__((section(".vectors"), used))
+static const VectorHandler vectors[16] = {
+    (VectorHandler)&__stack_end__,
+    Reset_Handler,
+    FaultHandler, // NMI
+    FaultHandler, // HardFault
+    FaultHandler, // MemManage
+    FaultHandler, // BusFault
+    FaultHandler, // UsageFault
+};
+
+static BootState eState = BootState::Idle;
+static BootResult eLastResult = BootResult::Ok;
+static uint32_t nImageSize;
+static uint32_t nImageCrc;
+static uint64_t nPagesWritten;
+
+// One block, programmed before the next first frame is taken from the FIFO
+static uint8_t block[BOOT_BLOCK_SIZE];
+static bool bRxActive;
+static uint16_t nRxLength;
+static uint16_t nRxPos;
+static uint8_t nRxSn;
+
+static_assert(BOOT_PAGE_COUNT <= 64, "Page bitmap holds 64 pages");
+
+/*
+ * Install and start
+ */
+
+// The application record is erased first and written last, an install
+// cut short leaves no valid application and is redone at the next reset
+static void InstallStaging(void)
+{
+    const stBootRecord *staging = (const stBootRecord *)(uintptr_t)BOOT_STAGING_RECORD;
+    const uint32_t nPages = (staging->nSize + BOOT_PAGE_SIZE - 1) / BOOT_PAGE_SIZE;
+
+    BootFlashUnlock();
+    bool bOk = BootFlashErasePage(BOOT_APP_RECORD);
+    for (uint32_t p = 0; (p < nPages) && bOk; p++)
+    {
+        const uint32_t nOffset = p * BOOT_PAGE_SIZE;
+        bOk = BootFlashErasePage(BOOT_APP_START + nOffset) &&
+              BootFlashProgram(BOOT_APP_START + nOffset, (const uint8_t *)(uintptr_t)(BOOT_STAGING_START + nOffset),
+                               BOOT_PAGE_SIZE);
+    }
+    if (bOk && (BootCrc32((const uint8_t *)(uintptr_t)BOOT_APP_START, staging->nSize) == staging->nCrc))
+        BootWriteRecord(BOOT_APP_RECORD, staging->nSize, staging->nCrc);
+    BootFlashLock();
+}
+
+static bool InstallPending(void)
+{
+    return memcmp((const void *)(uintptr_t)BOOT_APP_RECORD, (const void *)(uintptr_t)BOOT_STAGING_RECORD,
+                  sizeof(stBootRecord)) != 0;
+}
+
+static void StartApplication(void)
+{
+    const uint32_t *appVectors = (const uint32_t *)(uintptr_t)BOOT_APP_START;
+
+    SCB->VTOR = BOOT_APP_START;
+    __set_MSP(appVectors[0]);
+    ((VectorHandler)appVectors[1])();
+}
+
+/*
+ * Clock and CAN
+ */
+
+// 72MHz from the 8MHz HSE like the application, 36MHz from the HSI when
+// the crystal does not start. PCLK1 is 36MHz either way.
+static void InitClock(void)
+{
+    RCC->CR |= RCC_CR_HSEON;
+    uint32_t nPolls = 0;
+    while (!(RCC->CR & RCC_CR_HSERDY) && (++nPolls < 100000))
+        ;
+
+    if (RCC->CR & RCC_CR_HSERDY)
+    {
+        FLASH->ACR = FLASH_ACR_PRFTBE | FLASH_ACR_LATENCY_1;
+        RCC->CFGR = RCC_CFGR_PLLSRC_HSE_PREDIV | RCC_CFGR_PLLMUL9 | RCC_CFGR_PPRE1_DIV2;
+    }
+    else
+    {
+        RCC->CR &= ~RCC_CR_HSEON;
+        FLASH->ACR = FLASH_ACR_PRFTBE | FLASH_ACR_LATENCY_0;
+        RCC->CFGR = RCC_CFGR_PLLSRC_HSI_DIV2 | RCC_CFGR_PLLMUL9;
+    }
+
+    RCC->CR |= RCC_CR_PLLON;
+    while (!(RCC->CR & RCC_CR_PLLRDY))
+        ;
+    RCC->CFGR |= RCC_CFGR_SW_PLL;
+    while ((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_PLL)
+        ;
+}
+
+// CAN on PB8/PB9, transceiver out of standby on LINE_CAN_STANDBY (PC13).
+// Only BOOT_RX_ID and BOOT_BROADCAST_ID are let into FIFO 0, a busy bus
+// can't overrun it while a page is programmed.
+static void InitCan(void)
+{
+    RCC->AHBENR |= RCC_AHBENR_GPIOBEN | RCC_AHBENR_GPIOCEN;
+    RCC->APB1ENR |= RCC_APB1ENR_CANEN;
+
+    GPIOB->AFR[1] = (GPIOB->AFR[1] & ~0xFFU) | 0x99U;
+    GPIOB->MODER = (GPIOB->MODER & ~(0xFU << 16)) | (0xAU << 16);
+    GPIOC->MODER = (GPIOC->MODER & ~(0x3U << 26)) | (0x1U << 26);
+    GPIOC->BRR = 1U << 13;
+
+    CAN->MCR = CAN_MCR_INRQ;
+    while (!(CAN->MSR & CAN_MSR_INAK))
+        ;
+    CAN->MCR = CAN_MCR_INRQ | CAN_MCR_ABOM | CAN_MCR_TXFP;
+    CAN->BTR = LOADER_CAN_BTR;
+
+    // Bank 0, two 16 bit list entries per register, FIFO 0
+    CAN->FMR |= CAN_FMR_FINIT;
+    CAN->FA1R = 0;
+    CAN->FS1R &= ~1U;
+    CAN->FM1R |= 1U;
+    CAN->FFA1R &= ~1U;
+    CAN->sFilterRegister[0].FR1 = ((uint32_t)BOOT_BROADCAST_ID << 21) | ((uint32_t)BOOT_RX_ID << 5);
+    CAN->sFilterRegister[0].FR2 = ((uint32_t)BOOT_BROADCAST_ID << 21) | ((uint32_t)BOOT_RX_ID << 5);
+    CAN->FA1R = 1U;
+    CAN->FMR &= ~CAN_FMR_FINIT;
+
+    CAN->MCR &= ~CAN_MCR_INRQ;
+    while (CAN->MSR & CAN_MSR_INAK)
+        ;
+}
+
+static void SendFrame(const uint8_t *data, uint8_t nLength)
+{
+    uint8_t frame[8];
+    memset(frame, 0xAA, 8);
+    memcpy(frame, data, nLength);
+
+    uint32_t nPolls = 0;
+    while (!(CAN->TSR & CAN_TSR_TME0) && (++nPolls < LOADER_TX_POLLS))
+        ;
+    if (!(CAN->TSR & CAN_TSR_TME0))
+    {
+        CAN->TSR = CAN_TSR_ABRQ0;
+        return;
+    }
+
+    CAN->sTxMailBox[0].TDTR = 8;
+    CAN->sTxMailBox[0].TDLR = frame[0] | (frame[1] << 8) | (frame[2] << 16) | ((uint32_t)frame[3] << 24);
+    CAN->sTxMailBox[0].TDHR = frame[4] | (frame[5] << 8) | (frame[6] << 16) | ((uint32_t)frame[7] << 24);
+    CAN->sTxMailBox[0].TIR = ((uint32_t)BOOT_TX_ID << CAN_TI0R_STID_Pos) | CAN_TI0R_TXRQ;
+}
+
+static void WaitSent(void)
+{
+    uint32_t nPolls = 0;
+    while (!(CAN->TSR & CAN_TSR_TME0) && (++nPolls < LOADER_TX_POLLS))
+        ;
+}
+
+static void SendFlowControl(uint8_t nFlag)
+{
+    const uint8_t data[3] = {(uint8_t)(BOOT_PCI_FC | nFlag), 0, BOOT_STMIN};
+    SendFrame(data, 3);
+}
+
+static void SendResponse(uint8_t nCmd, BootResult eResult)
+{
+    const uint8_t data[3] = {2, (uint8_t)(nCmd | 0x40), (uint8_t)eResult};
+    SendFrame(data, 3);
+}
+
+/*
+ * Update protocol, as in boot.cpp but programmed in line
+ */
+
+static uint32_t GetU32(const uint8_t *d)
+{
+    return d[0] | (d[1] << 8) | (d[2] << 16) | ((uint32_t)d[3] << 24);
+}
+
+static uint8_t PagesInImage(void)
+{
+    return (nImageSize + BOOT_PAGE_SIZE - 1) / BOOT_PAGE_SIZE;
+}
+
+static void Start(const uint8_t *d, uint16_t nLength)
+{
+    const uint32_t nSize = (nLength >= 9) ? GetU32(&d[1]) : 0;
+    if ((nSize == 0) || (nSize > BOOT_IMAGE_MAX))
+    {
+        SendResponse(BOOT_CMD_START, BootResult::BadLength);
+        return;
+    }
+
+    nImageSize = nSize;
+    nImageCrc = GetU32(&d[5]);
+    nPagesWritten = 0;
+
+    BootFlashUnlock();
+    const bool bOk = BootFlashErasePage(BOOT_STAGING_RECORD);
+    BootFlashLock();
+
+    eLastResult = bOk ? BootResult::Ok : BootResult::FlashError;
+    eState = bOk ? BootState::Receiving : BootState::Error;
+    SendResponse(BOOT_CMD_START, eLastResult);
+}
+
+static void Data(const uint8_t *d, uint16_t nLength)
+{
+    const uint32_t nOffset = GetU32(&d[1]);
+    const uint16_t nData = nLength - BOOT_BLOCK_HEADER;
+
+    if ((eState != BootState::Receiving) || (nLength <= BOOT_BLOCK_HEADER) ||
+        (nOffset % BOOT_PAGE_SIZE) || (nOffset + nData > nImageSize))
+    {
+        eLastResult = BootResult::BadOffset;
+        return;
+    }
+
+    const uint8_t nPage = nOffset / BOOT_PAGE_SIZE;
+    if (nPagesWritten & (1ULL << nPage))
+        return;
+
+    BootFlashUnlock();
+    const bool bOk = BootFlashErasePage(BOOT_STAGING_START + nOffset) &&
+                     BootFlashProgram(BOOT_STAGING_START + nOffset, &d[BOOT_BLOCK_HEADER], nData);
+    BootFlashLock();
+
+    if (bOk)
+        nPagesWritten |= 1ULL << nPage;
+    else
+    {
+        eLastResult = BootResult::FlashError;
+        eState = BootState::Error;
+    }
+}
+
+static void Status(void)
+{
+    uint8_t nDone = 0;
+    uint8_t nFirstMissing = 0xFF;
+    for (uint8_t p = 0; p < PagesInImage(); p++)
+    {
+        if (nPagesWritten & (1ULL << p))
+            nDone++;
+        else if (nFirstMissing == 0xFF)
+            nFirstMissing = p;
+    }
+    const uint8_t data[6] = {5, BOOT_CMD_STATUS | 0x40, (uint8_t)eState, (uint8_t)eLastResult, nDone, nFirstMissing};
+    SendFrame(data, 6);
+}
+
+static void Verify(void)
+{
+    if ((eState != BootState::Receiving) && (eState != BootState::Verified))
+    {
+        SendResponse(BOOT_CMD_VERIFY, BootResult::BadSequence);
+        return;
+    }
+
+    const uint64_t nAllPages = (PagesInImage() == 64) ? ~0ULL : ((1ULL << PagesInImage()) - 1);
+
+    if (nPagesWritten != nAllPages)
+        eLastResult = BootResult::BadSequence;
+    else if (BootCrc32((const uint8_t *)(uintptr_t)BOOT_STAGING_START, nImageSize) != nImageCrc)
+        eLastResult = BootResult::CrcMismatch;
+    else if (!BootRecordValid(BOOT_STAGING_RECORD))
+    {
+        BootFlashUnlock();
+        const bool bOk = BootWriteRecord(BOOT_STAGING_RECORD, nImageSize, nImageCrc);
+        BootFlashLock();
+        eLastResult = bOk ? BootResult::Ok : BootResult::FlashError;
+    }
+    else
+        eLastResult = BootResult::Ok;
+
+    eState = (eLastResult == BootResult::Ok) ? BootState::Verified : BootState::Error;
+    SendResponse(BOOT_CMD_VERIFY, eLastResult);
+}
+
+// The install happens after the reset like for an update the application took
+static void Run(void)
+{
+    if (eState != BootState::Verified)
+    {
+        SendResponse(BOOT_CMD_RUN, BootResult::BadSequence);
+        return;
+    }
+
+    SendResponse(BOOT_CMD_RUN, BootResult::Ok);
+    WaitSent();
+    NVIC_SystemReset();
+}
+
+static void HandleMessage(const uint8_t *d, uint16_t nLength)
+{
+    switch (d[0])
+    {
+    case BOOT_CMD_START:
+        Start(d, nLength);
+        break;
+    case BOOT_CMD_DATA:
+        Data(d, nLength);
+        break;
+    case BOOT_CMD_STATUS:
+        Status();
+        break;
+    case BOOT_CMD_VERIFY:
+        Verify();
+        break;
+    case BOOT_CMD_RUN:
+        Run();
+        break;
+    }
+}
+
+// ISO-TP receiver, flow control only for BOOT_RX_ID
+static void Receive(uint32_t nId, const uint8_t *d, uint8_t nDlc)
+{
+    const bool bBroadcast = nId == BOOT_BROADCAST_ID;
+
+    if (nDlc < 1)
+        return;
+
+    switch (d[0] & 0xF0)
+    {
+    case BOOT_PCI_SF:
+    {
+        const uint8_t nLength = d[0] & 0x0F;
+        bRxActive = false;
+        if ((nLength != 0) && (nLength <= 7) && (nLength < nDlc))
+            HandleMessage(&d[1], nLength);
+        break;
+    }
+
+    case BOOT_PCI_FF:
+    {
+        const uint16_t nLength = ((d[0] & 0x0F) << 8) | d[1];
+        bRxActive = false;
+
+        if ((nDlc < 8) || (nLength < 8))
+            return;
+        if (nLength > BOOT_BLOCK_SIZE)
+        {
+            if (!bBroadcast)
+                SendFlowControl(BOOT_FC_OVFL);
+            return;
+        }
+
+        memcpy(block, &d[2], 6);
+        nRxLength = nLength;
+        nRxPos = 6;
+        nRxSn = 1;
+        bRxActive = true;
+        if (!bBroadcast)
+            SendFlowControl(BOOT_FC_CTS);
+        break;
+    }
+
+    case BOOT_PCI_CF:
+    {
+        if (!bRxActive)
+            return;
+
+        uint8_t nCopy = nRxLength - nRxPos;
+        if (nCopy > 7)
+            nCopy = 7;
+        if (((d[0] & 0x0F) != nRxSn) || (nCopy > nDlc - 1))
+        {
+            bRxActive = false;
+            return;
+        }
+        nRxSn = (nRxSn + 1) & 0x0F;
+
+        memcpy(&block[nRxPos], &d[1], nCopy);
+        nRxPos += nCopy;
+
+        if (nRxPos == nRxLength)
+        {
+            bRxActive = false;
+            HandleMessage(block, nRxLength);
+        }
+        break;
+    }
+    }
+}
+
+static void UpdateLoop(void)
+{
+    InitClock();
+    InitCan();
+
+    while (true)
+    {
+        if (!(CAN->RF0R & CAN_RF0R_FMP0))
+            continue;
+
+        const uint32_t nRir = CAN->sFIFOMailBox[0].RIR;
+        const uint8_t nDlc = CAN->sFIFOMailBox[0].RDTR & CAN_RDT0R_DLC;
+        const uint32_t nLow = CAN->sFIFOMailBox[0].RDLR;
+        const uint32_t nHigh = CAN->sFIFOMailBox[0].RDHR;
+        CAN->RF0R = CAN_RF0R_RFOM0;
+
+        if (nRir & (CAN_RI0R_IDE | CAN_RI0R_RTR))
+            continue;
+
+        const uint8_t data[8] = {(uint8_t)nLow, (uint8_t)(nLow >> 8), (uint8_t)(nLow >> 16), (uint8_t)(nLow >> 24),
+                                 (uint8_t)nHigh, (uint8_t)(nHigh >> 8), (uint8_t)(nHigh >> 16), (uint8_t)(nHigh >> 24)};
+        Receive(nRir >> CAN_RI0R_STID_Pos, data, nDlc > 8 ? 8 : nDlc);
+    }
+}
+
+static void LoaderMain(void)
+{
+    bool bApp = BootImageValid(BOOT_APP_START, BOOT_APP_RECORD);
+
+    if ((!bApp || InstallPending()) && BootImageValid(BOOT_STAGING_START, BOOT_STAGING_RECORD))
+    {
+        InstallStaging();
+        bApp = BootImageValid(BOOT_APP_START, BOOT_APP_RECORD);
+    }
+
+    if (bApp)
+        StartApplication();
+
+    UpdateLoop();
+}
+
+void Reset_Handler(void)
+{
+    uint32_t *pSrc = &__data_load__;
+    for (uint32_t *pDst = &__data_start__; pDst < &__data_end__;)
+        *pDst++ = *pSrc++;
+    for (uint32_t *pDst = &__bss_start__; pDst < &__bss_end__;)
+        *pDst++ = 0;
+
+    LoaderMain();
+    while (true)
+        ;
+}
@@ -6,84 +6,183 @@
 //static chibios_rt::Mailbox<CANTxFrame*, MAILBOX_SIZE> txUsbMb;
 
 static mailbox_t rxMb;
-static mailbox_t txMb;
+static mailbox_t txMb[CAN_TX_CLASS_COUNT]; // One queue per CanTxClass
 static mailbox_t txUsbMb;
 
 //Mailbox pointer buffers
 static msg_t rxMbBuf[MAILBOX_SIZE];
-static msg_t txMbBuf[MAILBOX_SIZE];
+static msg_t txMbBuf[CAN_TX_CLASS_COUNT][MAILBOX_SIZE];
 static msg_t txUsbMbBuf[MAILBOX_SIZE];
 
 //Mailbox storage of CAN frames
 //Not managed by mailbox
 CANRxFrame rxFrames[MAILBOX_SIZE];
-CANTxFrame txFrames[MAILBOX_SIZE];
+CANTxFrame txFrames[CAN_TX_CLASS_COUNT][MAILBOX_SIZE];
 CANTxFrame txUsbFrames[MAILBOX_SIZE];
 
 //Used to manage the memory used by the mailbox
 bool rxMsgUsed[MAILBOX_SIZE];
-bool txMsgUsed[MAILBOX_SIZE];
+bool txMsgUsed[CAN_TX_CLASS_COUNT][MAILBOX_SIZE];
 bool txUsbMsgUsed[MAILBOX_SIZE];
 
+//Cycle counter at the time each TX frame was posted
+static rtcnt_t txEnqueueTime[CAN_TX_CLASS_COUNT][MAILBOX_SIZE];
+
+//Frames dropped because the class queue was full
+static uint32_t nTxShed[CAN_TX_CLASS_COUNT];
+
 void InitMailboxes()
 {
     //Initialize the mailboxes
     chMBObjectInit(&rxMb, rxMbBuf, MAILBOX_SIZE);
-    chMBObjectInit(&txMb, txMbBuf, MAILBOX_SIZE);
     chMBObjectInit(&txUsbMb, txUsbMbBuf, MAILBOX_SIZE);
+    for (int c = 0; c < CAN_TX_CLASS_COUNT; c++) {
+        chMBObjectInit(&txMb[c], txMbBuf[c], MAILBOX_SIZE);
+        nTxShed[c] = 0;
+    }
 
     //Initialize the used arrays
     for (int i = 0; i < MAILBOX_SIZE; i++) {
         rxMsgUsed[i] = false;
-        txMsgUsed[i] = false;
         txUsbMsgUsed[i] = false;
+        for (int c = 0; c < CAN_TX_CLASS_COUNT; c++)
+            txMsgUsed[c][i] = false;
     }
 }
 
-msg_t PostTxFrame(CANTxFrame *frame)
+// Stores the frame in a free slot of its class queue, system must be locked
+static msg_t PostTxFrameS(const CANTxFrame *frame, uint8_t c)
 {
-    PostTxUsbFrame(frame);  // Post to USB mailbox first
-
     for (int i = 0; i < MAILBOX_SIZE; i++) {
-        if (!txMsgUsed[i]) {
+        if (!txMsgUsed[c][i]) {
             // Find a free slot in can_messages[] to store the data
-            txFrames[i] = *frame;
-            txMsgUsed[i] = true;
+            txFrames[c][i] = *frame;
+            txEnqueueTime[c][i] = chSysGetRealtimeCounterX();
+            txMsgUsed[c][i] = true;
 
             // Try to post the pointer to the mailbox
-            msg_t result = chMBPostTimeout(&txMb, (msg_t)&txFrames[i], TIME_IMMEDIATE);
-            if (result == MSG_OK) {
-                return result;  // Successfully posted
-            } else {
-                txMsgUsed[i] = false;  // Free the slot if mailbox is full
-                return result;
+            msg_t result = chMBPostI(&txMb[c], (msg_t)&txFrames[c][i]);
+            if (result != MSG_OK) {
+                txMsgUsed[c][i] = false;  // Free the slot if mailbox is full
             }
+            return result;
         }
     }
 
     return MSG_TIMEOUT;  // No free slots
 }
 
-msg_t FetchTxFrame(CANTxFrame *frame)
+msg_t PostTxFrame(CANTxFrame *frame, CanTxClass eClass)
+{
+    const uint8_t c = static_cast<uint8_t>(eClass);
+
+    PostTxUsbFrame(frame);  // Post to USB mailbox first
+
+    // Several threads post frames, the slot search must not be interrupted
+    chSysLock();
+    msg_t result = PostTxFrameS(frame, c);
+    if (result != MSG_OK)
+        nTxShed[c]++;
+    chSysUnlock();
+
+    return result;
+}
+
+// I-class version for interrupt handlers, system must be locked
+msg_t PostTxFrameI(const CANTxFrame *frame, CanTxClass eClass)
 {
+    const uint8_t c = static_cast<uint8_t>(eClass);
+
+    PostTxUsbFrameI(frame);
+
+    msg_t result = PostTxFrameS(frame, c);
+    if (result != MSG_OK)
+        nTxShed[c]++;
+
+    return result;
+}
+
+// Holds the caller off while the class queue is full instead of shedding,
+// for producers that can be paced such as the USB host
+msg_t PostTxFrameTimeout(CANTxFrame *frame, CanTxClass eClass, sysinterval_t timeout)
+{
+    const uint8_t c = static_cast<uint8_t>(eClass);
+    const systime_t nStart = chVTGetSystemTimeX();
+
+    while (true) {
+        chSysLock();
+        msg_t result = PostTxFrameS(frame, c);
+        if ((result != MSG_OK) && (chVTTimeElapsedSinceX(nStart) >= timeout))
+            nTxShed[c]++;
+        chSysUnlock();
+
+        if (result == MSG_OK) {
+            PostTxUsbFrame(frame);
+            return result;
+        }
+
+        if (chVTTimeElapsedSinceX(nStart) >= timeout)
+            return result;
+
+        // The CAN TX thread frees a slot per frame sent
+        chThdSleep(1);
+    }
+}
+
+msg_t PeekTxFrame(CANTxFrame *frame, CanTxClass eClass, rtcnt_t *pEnqueueTime)
+{
+    const uint8_t c = static_cast<uint8_t>(eClass);
+    msg_t result = MSG_TIMEOUT;
+    CANTxFrame *txFrame = nullptr;
+
+    // Copy the oldest frame without removing it from the mailbox
+    chSysLock();
+    if (chMBGetUsedCountI(&txMb[c]) > 0) {
+        txFrame = (CANTxFrame *)chMBPeekI(&txMb[c]);
+        *frame = *txFrame;
+        result = MSG_OK;
+    }
+    chSysUnlock();
+
+    if ((result == MSG_OK) && (pEnqueueTime != nullptr)) {
+        *pEnqueueTime = txEnqueueTime[c][txFrame - txFrames[c]];
+    }
+
+    return result;
+}
+
+msg_t FetchTxFrame(CANTxFrame *frame, CanTxClass eClass)
+{
+    const uint8_t c = static_cast<uint8_t>(eClass);
     CANTxFrame *txFrame;
     // Fetch a pointer from the mailbox
-    msg_t result = chMBFetchTimeout(&txMb, (msg_t*)&txFrame, TIME_IMMEDIATE);
+    msg_t result = chMBFetchTimeout(&txMb[c], (msg_t*)&txFrame, TIME_IMMEDIATE);
     if (result == MSG_OK) {
+        // Copy before the slot is freed, another thread may reuse it
+        *frame = *txFrame;
+
         // Mark the slot in memory as free
         for (int i = 0; i < MAILBOX_SIZE; i++) {
-            if (txFrame == &txFrames[i]) {
-                txMsgUsed[i] = false;
+            if (txFrame == &txFrames[c][i]) {
+                txMsgUsed[c][i] = false;
                 break;
             }
         }
-        *frame = *txFrame;
         return result;
     }
     return result;
 }
 
 msg_t PostTxUsbFrame(CANTxFrame *frame)
+{
+    chSysLock();
+    msg_t result = PostTxUsbFrameI(frame);
+    chSysUnlock();
+
+    return result;
+}
+
+msg_t PostTxUsbFrameI(const CANTxFrame *frame)
 {
     for (int i = 0; i < MAILBOX_SIZE; i++) {
         if (!txUsbMsgUsed[i]) {
@@ -92,13 +191,11 @@ msg_t PostTxUsbFrame(CANTxFrame *frame)
             txUsbMsgUsed[i] = true;
 
             // Try to post the pointer to the mailbox
-            msg_t result = chMBPostTimeout(&txUsbMb, (msg_t)&txUsbFrames[i], TIME_IMMEDIATE);
-            if (result == MSG_OK) {
-                return result;  // Successfully posted
-            } else {
+            msg_t result = chMBPostI(&txUsbMb, (msg_t)&txUsbFrames[i]);
+            if (result != MSG_OK) {
                 txUsbMsgUsed[i] = false;  // Free the slot if mailbox is full
-                return result;
             }
+            return result;
         }
     }
 
@@ -111,6 +208,9 @@ msg_t FetchTxUsbFrame(CANTxFrame *frame)
     // Fetch a pointer from the mailbox
     msg_t result = chMBFetchTimeout(&txUsbMb, (msg_t*)&txFrame, TIME_IMMEDIATE);
     if (result == MSG_OK) {
+        // Copy before the slot is freed, another thread may reuse it
+        *frame = *txFrame;
+
         // Mark the slot in memory as free
         for (int i = 0; i < MAILBOX_SIZE; i++) {
             if (txFrame == &txUsbFrames[i]) {
@@ -118,13 +218,23 @@ msg_t FetchTxUsbFrame(CANTxFrame *frame)
                 break;
             }
         }
-        *frame = *txFrame;
         return result;
     }
     return result;
 }
 
 msg_t PostRxFrame(CANRxFrame *frame)
+{
+    // Shares the slots with the CAN RX interrupt
+    chSysLock();
+    msg_t result = PostRxFrameI(frame);
+    chSysUnlock();
+
+    return result;
+}
+
+// I-class version for the CAN RX interrupt, system must be locked
+msg_t PostRxFrameI(const CANRxFrame *frame)
 {
     for (int i = 0; i < MAILBOX_SIZE; i++) {
         if (!rxMsgUsed[i]) {
@@ -133,25 +243,26 @@ msg_t PostRxFrame(CANRxFrame *frame)
             rxMsgUsed[i] = true;
 
             // Try to post the pointer to the mailbox
-            msg_t result = chMBPostTimeout(&rxMb, (msg_t)&rxFrames[i], TIME_IMMEDIATE);
-            if (result == MSG_OK) {
-                return result;  // Successfully posted
-            } else {
+            msg_t result = chMBPostI(&rxMb, (msg_t)&rxFrames[i]);
+            if (result != MSG_OK) {
                 rxMsgUsed[i] = false;  // Free the slot if mailbox is full
-                return result;
             }
+            return result;
         }
     }
 
     return MSG_TIMEOUT;  // No free slots
 }
 
-msg_t FetchRxFrame(CANRxFrame *frame)
+msg_t FetchRxFrame(CANRxFrame *frame, sysinterval_t timeout)
 {
     CANRxFrame *rxFrame;
     // Fetch a pointer from the mailbox
-    msg_t result = chMBFetchTimeout(&rxMb, (msg_t*)&rxFrame, TIME_IMMEDIATE);
+    msg_t result = chMBFetchTimeout(&rxMb, (msg_t*)&rxFrame, timeout);
     if (result == MSG_OK) {
+        // Copy before the slot is freed, another thread may reuse it
+        *frame = *rxFrame;
+
         // Mark the slot in memory as free
         for (int i = 0; i < MAILBOX_SIZE; i++) {
             if (rxFrame == &rxFrames[i]) {
@@ -159,7 +270,6 @@ msg_t FetchRxFrame(CANRxFrame *frame)
                 break;
             }
         }
-        *frame = *rxFrame;
         return result;
     }
     return result;
@@ -168,4 +278,9 @@ msg_t FetchRxFrame(CANRxFrame *frame)
 bool RxFramesEmpty()
 {
     return (rxMb.cnt == 0);
+}
+
+uint32_t GetTxShedCount(CanTxClass eClass)
+{
+    return nTxShed[static_cast<uint8_t>(eClass)];
 }
\ No newline at end of file
@@ -2,14 +2,22 @@
 
 #include <cstdint>
 #include "hal.h"
+#include "enums.h"
+#include "linboard_config.h"
 
 #define MAILBOX_SIZE 16
 
 void InitMailboxes();
-msg_t PostTxFrame(CANTxFrame *frame);
+msg_t PostTxFrame(CANTxFrame *frame, CanTxClass eClass = CanTxClass::Control);
+msg_t PostTxFrameI(const CANTxFrame *frame, CanTxClass eClass);
+msg_t PostTxFrameTimeout(CANTxFrame *frame, CanTxClass eClass, sysinterval_t timeout);
 msg_t PostTxUsbFrame(CANTxFrame *frame);
-msg_t FetchTxFrame(CANTxFrame *frame);
+msg_t PostTxUsbFrameI(const CANTxFrame *frame);
+msg_t PeekTxFrame(CANTxFrame *frame, CanTxClass eClass, rtcnt_t *pEnqueueTime = nullptr);
+msg_t FetchTxFrame(CANTxFrame *frame, CanTxClass eClass);
 msg_t FetchTxUsbFrame(CANTxFrame *frame);
 msg_t PostRxFrame(CANRxFrame *frame);
-msg_t FetchRxFrame(CANRxFrame *frame);
-bool RxFramesEmpty();
\ No newline at end of file
+msg_t PostRxFrameI(const CANRxFrame *frame);
+msg_t FetchRxFrame(CANRxFrame *frame, sysinterval_t timeout = TIME_IMMEDIATE);
+bool RxFramesEmpty();
+uint32_t GetTxShedCount(CanTxClass eClass);
\ No newline at end of file
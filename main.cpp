@@ -7,6 +7,9 @@
 #include "lin.h"
 #include "enums.h"
 #include "mailbox.h"
+#include "xcp.h"
+#include "boot.h"
+#include "ttcan.h"
 
 /*
  * Application entry point.
@@ -19,6 +22,12 @@ int main(void)
 
   InitMailboxes();
 
+  InitXcp();
+
+  InitBoot();
+
+  InitTtcan();
+
   palClearLine(LINE_CAN_STANDBY); //Enable CAN transceiver
 
   InitCan(CanBitrate::Bitrate_500K, false);
@@ -52,7 +61,7 @@ int main(void)
     stMsg.data8[7] = 8;
     stMsg.IDE = CAN_IDE_STD;
     stMsg.RTR = CAN_RTR_DATA;
-    PostTxFrame(&stMsg);
+    PostTxFrame(&stMsg, CanTxClass::Debug);
 
     chThdSleepMilliseconds(50);
   }
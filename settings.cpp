@@ -0,0 +1,607 @@
+#include "settings.h"
+#include "mailbox.h"
+#include "txbudget.h"
+#include "txlatency.h"
+#include "ttcan.h"
+#include "usb.h"
+#include "lin.h"
+#include "lincache.h"
+#include "linslave.h"
+#include "linframe.h"
+#include "linschedule.h"
+#include "linmonitor.h"
+#include "lintp.h"
+#include "linbaud.h"
+#include "linpower.h"
+#include "linstats.h"
+#include "linboard_config.h"
+#include <cstring>
+
+typedef SettingsStatus (*SettingsHandler)(const uint8_t *args, uint8_t *reply, uint8_t *pReplyLength);
+
+typedef struct {
+    SettingsHandler handler;
+    uint8_t nArgLength; // Bytes after the opcode
+} stSettingsCommand;
+
+static uint16_t GetU16(const uint8_t *data)
+{
+    return data[0] | (data[1] << 8);
+}
+
+static uint32_t GetU32(const uint8_t *data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static void PutU16(uint8_t *data, uint16_t nValue)
+{
+    data[0] = nValue & 0xFF;
+    data[1] = nValue >> 8;
+}
+
+static void PutU32(uint8_t *data, uint32_t nValue)
+{
+    for (uint8_t i = 0; i < 4; i++)
+        data[i] = (nValue >> (i * 8)) & 0xFF;
+}
+
+static SettingsStatus GetVersion(const uint8_t *, uint8_t *reply, uint8_t *pReplyLength)
+{
+    reply[0] = MAJOR_VERSION;
+    reply[1] = MINOR_VERSION;
+    reply[2] = BUILD;
+    *pReplyLength = 3;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus GetLinPeriodCmd(const uint8_t *, uint8_t *reply, uint8_t *pReplyLength)
+{
+    PutU16(reply, GetLinPeriod());
+    *pReplyLength = 2;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus SetLinPeriodCmd(const uint8_t *args, uint8_t *, uint8_t *)
+{
+    const uint16_t nPeriod = GetU16(args);
+    if ((nPeriod < LIN_PERIOD_MIN_MS) || (nPeriod > LIN_PERIOD_MAX_MS))
+        return SettingsStatus::OutOfRange;
+
+    SetLinPeriod(nPeriod);
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus GetLinSlotStatsCmd(const uint8_t *args, uint8_t *reply, uint8_t *pReplyLength)
+{
+    stLinSlotStats stats;
+    if (!GetLinSlotStats(static_cast<LinScheduleId>(args[0]), args[1], &stats) || (args[2] > 4))
+        return SettingsStatus::OutOfRange;
+
+    const uint32_t fields[] = {stats.nCount, stats.nOverruns, stats.nLastUs, stats.nMinUs, stats.nMaxUs};
+    PutU32(reply, fields[args[2]]);
+    *pReplyLength = 4;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus GetTxBudgetCmd(const uint8_t *args, uint8_t *reply, uint8_t *pReplyLength)
+{
+    if (args[0] >= CAN_TX_CLASS_COUNT)
+        return SettingsStatus::OutOfRange;
+
+    stTxClassBudget budget;
+    GetTxClassBudget(static_cast<CanTxClass>(args[0]), &budget);
+
+    PutU16(&reply[0], budget.nFramesPerSec);
+    PutU16(&reply[2], budget.nBurstFrames);
+    reply[4] = budget.nSharePct;
+    reply[5] = budget.bShed;
+    *pReplyLength = 6;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus SetTxBudgetCmd(const uint8_t *args, uint8_t *, uint8_t *)
+{
+    if ((args[0] >= CAN_TX_CLASS_COUNT) || (args[5] > 100) || (args[6] > 1))
+        return SettingsStatus::OutOfRange;
+
+    stTxClassBudget budget;
+    budget.nFramesPerSec = GetU16(&args[1]);
+    budget.nBurstFrames = GetU16(&args[3]);
+    budget.nSharePct = args[5];
+    budget.bShed = args[6];
+
+    if ((budget.nFramesPerSec == 0) || (budget.nBurstFrames == 0))
+        return SettingsStatus::OutOfRange;
+
+    SetTxClassBudget(static_cast<CanTxClass>(args[0]), &budget);
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus GetTxBusBudgetCmd(const uint8_t *, uint8_t *reply, uint8_t *pReplyLength)
+{
+    reply[0] = GetTxBusBudget();
+    *pReplyLength = 1;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus SetTxBusBudgetCmd(const uint8_t *args, uint8_t *, uint8_t *)
+{
+    if ((args[0] == 0) || (args[0] > 100))
+        return SettingsStatus::OutOfRange;
+
+    SetTxBusBudget(args[0]);
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus GetTxClassStatsCmd(const uint8_t *args, uint8_t *reply, uint8_t *pReplyLength)
+{
+    if ((args[0] >= CAN_TX_CLASS_COUNT) || (args[1] > 2))
+        return SettingsStatus::OutOfRange;
+
+    stTxClassStats stats;
+    GetTxClassStats(static_cast<CanTxClass>(args[0]), &stats);
+
+    const uint32_t counts[] = {stats.nSent, stats.nDeferred, stats.nShed};
+    PutU32(reply, counts[args[1]]);
+    *pReplyLength = 4;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus GetTxLatencyCmd(const uint8_t *args, uint8_t *reply, uint8_t *pReplyLength)
+{
+    stTxLatency latency;
+
+    if (args[0] & 0x80)
+    {
+        if (!GetTxLatencyById(args[0] & 0x7F, &latency))
+            return SettingsStatus::OutOfRange;
+    }
+    else
+    {
+        if (args[0] >= CAN_TX_CLASS_COUNT)
+            return SettingsStatus::OutOfRange;
+        GetTxLatencyByClass(static_cast<CanTxClass>(args[0]), &latency);
+    }
+
+    const uint32_t fields[] = {latency.nId, latency.nCount, latency.nArbLost, latency.nFailed, latency.nMaxUs};
+    const uint8_t nFields = sizeof(fields) / sizeof(fields[0]);
+
+    if (args[1] < nFields)
+        PutU32(reply, fields[args[1]]);
+    else if (args[1] < nFields + TX_LATENCY_BUCKETS)
+        PutU32(reply, latency.nBuckets[args[1] - nFields]);
+    else
+        return SettingsStatus::OutOfRange;
+
+    *pReplyLength = 4;
+    return SettingsStatus::Ok;
+}
+
+// Slot configuration is only accepted while the schedule is stopped
+static SettingsStatus SetTtcanSlotIdCmd(const uint8_t *args, uint8_t *, uint8_t *)
+{
+    stTtcanSlot slot;
+    const uint32_t nId = GetU32(&args[1]);
+
+    if (!TtcanGetSlot(args[0], &slot))
+        return SettingsStatus::OutOfRange;
+    if (TtcanIsActive())
+        return SettingsStatus::Busy;
+
+    slot.bExtended = nId & 0x80000000;
+    slot.nId = nId & 0x1FFFFFFF;
+    slot.nDlc = args[5];
+
+    if ((!slot.bExtended && (slot.nId > 0x7FF)) || !TtcanSetSlot(args[0], &slot))
+        return SettingsStatus::OutOfRange;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus SetTtcanSlotTimeCmd(const uint8_t *args, uint8_t *, uint8_t *)
+{
+    stTtcanSlot slot;
+
+    if (!TtcanGetSlot(args[0], &slot) || (args[6] > 1))
+        return SettingsStatus::OutOfRange;
+    if (TtcanIsActive())
+        return SettingsStatus::Busy;
+
+    slot.nOffset = GetU16(&args[1]);
+    slot.nWindow = GetU16(&args[3]);
+    slot.nRepeat = args[5];
+    slot.bEnabled = args[6];
+
+    if (!TtcanSetSlot(args[0], &slot))
+        return SettingsStatus::OutOfRange;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus SetTtcanSlotDataCmd(const uint8_t *args, uint8_t *, uint8_t *)
+{
+    if (!TtcanSetSlotData(args[0], args[1], &args[2], 4))
+        return SettingsStatus::OutOfRange;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus StartTtcanCmd(const uint8_t *args, uint8_t *, uint8_t *)
+{
+    if (args[0] > static_cast<uint8_t>(TtcanMode::Reference))
+        return SettingsStatus::OutOfRange;
+
+    if (args[0] == static_cast<uint8_t>(TtcanMode::Off))
+    {
+        TtcanStop();
+        return SettingsStatus::Ok;
+    }
+
+    // Fails on windows that overlap or run past the cycle
+    if (!TtcanStart(static_cast<TtcanMode>(args[0]), GetU16(&args[1]), GetU32(&args[3])))
+        return SettingsStatus::OutOfRange;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus GetTtcanSlotStatsCmd(const uint8_t *args, uint8_t *reply, uint8_t *pReplyLength)
+{
+    stTtcanSlotStats stats;
+    if (!GetTtcanSlotStats(args[0], &stats) || (args[1] > 4))
+        return SettingsStatus::OutOfRange;
+
+    const uint32_t fields[] = {stats.nSent, stats.nLate, stats.nMissed, stats.nMinPeriod, stats.nMaxPeriod};
+    PutU32(reply, fields[args[1]]);
+    *pReplyLength = 4;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus GetUsbFilterCmd(const uint8_t *args, uint8_t *reply, uint8_t *pReplyLength)
+{
+    stUsbFilter filter;
+    if (!GetUsbFilter(args[0], &filter))
+        return SettingsStatus::OutOfRange;
+
+    reply[0] = filter.bEnabled;
+    PutU32(&reply[1], filter.nId);
+    *pReplyLength = 5;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus SetUsbFilterCmd(const uint8_t *args, uint8_t *, uint8_t *)
+{
+    stUsbFilter filter;
+    if (!GetUsbFilter(args[0], &filter) || (args[1] > 1))
+        return SettingsStatus::OutOfRange;
+
+    filter.bEnabled = args[1];
+    filter.nId = GetU32(&args[2]);
+    SetUsbFilter(args[0], &filter);
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus GetUsbFilterMaskCmd(const uint8_t *args, uint8_t *reply, uint8_t *pReplyLength)
+{
+    stUsbFilter filter;
+    if (!GetUsbFilter(args[0], &filter))
+        return SettingsStatus::OutOfRange;
+
+    PutU32(reply, filter.nMask);
+    *pReplyLength = 4;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus SetUsbFilterMaskCmd(const uint8_t *args, uint8_t *, uint8_t *)
+{
+    stUsbFilter filter;
+    if (!GetUsbFilter(args[0], &filter))
+        return SettingsStatus::OutOfRange;
+
+    filter.nMask = GetU32(&args[1]);
+    SetUsbFilter(args[0], &filter);
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus GetRtrMapCmd(const uint8_t *args, uint8_t *reply, uint8_t *pReplyLength)
+{
+    stLinRtrMap map;
+    if (!GetLinRtrMap(args[0], &map))
+        return SettingsStatus::OutOfRange;
+
+    reply[0] = map.bEnabled;
+    reply[1] = map.nLinId;
+    PutU32(&reply[2], map.nCanId);
+    *pReplyLength = 6;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus SetRtrMapCmd(const uint8_t *args, uint8_t *, uint8_t *)
+{
+    stLinRtrMap map;
+    map.bEnabled = args[1] & 0x80;
+    map.nLinId = args[1] & 0x7F;
+    map.nCanId = GetU32(&args[2]);
+
+    if (!SetLinRtrMap(args[0], &map))
+        return SettingsStatus::OutOfRange;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus GetLinModeCmd(const uint8_t *, uint8_t *reply, uint8_t *pReplyLength)
+{
+    reply[0] = static_cast<uint8_t>(GetLinMode());
+    *pReplyLength = 1;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus SetLinModeCmd(const uint8_t *args, uint8_t *, uint8_t *)
+{
+    if (args[0] > static_cast<uint8_t>(LinMode::Monitor))
+        return SettingsStatus::OutOfRange;
+
+    SetLinMode(static_cast<LinMode>(args[0]));
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus SetLinSlaveCmd(const uint8_t *args, uint8_t *, uint8_t *)
+{
+    const LinDirection eDir = (args[1] & 0x02) ? LinDirection::Publish : LinDirection::Subscribe;
+
+    if (!SetLinSlaveEntry(args[0], args[1] & 0x01, eDir))
+        return SettingsStatus::OutOfRange;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus SetLinSlaveDataCmd(const uint8_t *args, uint8_t *, uint8_t *)
+{
+    if (!SetLinSlaveData(args[0], args[1], &args[2], 4))
+        return SettingsStatus::OutOfRange;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus GetLinSlaveDataCmd(const uint8_t *args, uint8_t *reply, uint8_t *pReplyLength)
+{
+    stLinSlaveEntry entry;
+    if (!GetLinSlaveEntry(args[0], &entry) || (args[1] > 4))
+        return SettingsStatus::OutOfRange;
+
+    for (uint8_t i = 0; i < 4; i++)
+        reply[i] = entry.nData[args[1] + i];
+    *pReplyLength = 4;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus GetLinMonitorCanCmd(const uint8_t *, uint8_t *reply, uint8_t *pReplyLength)
+{
+    reply[0] = GetLinMonitorCan();
+    *pReplyLength = 1;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus SetLinMonitorCanCmd(const uint8_t *args, uint8_t *, uint8_t *)
+{
+    if (args[0] > 1)
+        return SettingsStatus::OutOfRange;
+
+    SetLinMonitorCan(args[0]);
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus GetLinFrameCmd(const uint8_t *args, uint8_t *reply, uint8_t *pReplyLength)
+{
+    if (args[0] >= LIN_FRAME_IDS)
+        return SettingsStatus::OutOfRange;
+
+    const stLinFrameDesc *desc = GetLinFrameDesc(args[0]);
+    reply[0] = desc->nLength;
+    reply[1] = (desc->eDir == LinDirection::Publish ? 0x01 : 0) |
+               (desc->eChecksum == LinChecksumModel::Enhanced ? 0x02 : 0);
+    *pReplyLength = 2;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus SetLinFrameCmd(const uint8_t *args, uint8_t *, uint8_t *)
+{
+    stLinFrameDesc desc;
+    desc.nLength = args[1];
+    desc.eDir = (args[2] & 0x01) ? LinDirection::Publish : LinDirection::Subscribe;
+    desc.eChecksum = (args[2] & 0x02) ? LinChecksumModel::Enhanced : LinChecksumModel::Classic;
+
+    if (!SetLinFrameDesc(args[0], &desc))
+        return SettingsStatus::OutOfRange;
+    return SettingsStatus::Ok;
+}
+
+// Diagnostic request staged and run for the settings protocol, answered
+// by polling since requests take several schedule slots
+static stLinTpRequest diagRequest = {};
+
+static SettingsStatus SetLinDiagDataCmd(const uint8_t *args, uint8_t *, uint8_t *)
+{
+    if (diagRequest.eStatus == LinTpStatus::Pending)
+        return SettingsStatus::Busy;
+    if (args[0] > LIN_TP_MAX_PDU - 5)
+        return SettingsStatus::OutOfRange;
+
+    memcpy(&diagRequest.req.nData[args[0]], &args[1], 5);
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus StartLinDiagCmd(const uint8_t *args, uint8_t *, uint8_t *)
+{
+    if (diagRequest.eStatus == LinTpStatus::Pending)
+        return SettingsStatus::Busy;
+    if ((args[1] == 0) || (args[1] > LIN_TP_MAX_PDU))
+        return SettingsStatus::OutOfRange;
+
+    diagRequest.req.nNad = args[0];
+    diagRequest.req.nLength = args[1];
+    diagRequest.cb = nullptr;
+
+    if (!LinTpPost(&diagRequest))
+        return SettingsStatus::Busy;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus GetLinDiagCmd(const uint8_t *args, uint8_t *reply, uint8_t *pReplyLength)
+{
+    if (args[0] > LIN_TP_MAX_PDU - 4)
+        return SettingsStatus::OutOfRange;
+
+    const LinTpStatus eStatus = diagRequest.eStatus;
+    reply[0] = static_cast<uint8_t>(eStatus);
+    reply[1] = (eStatus == LinTpStatus::Pending) ? 0 : diagRequest.resp.nLength;
+    memcpy(&reply[2], &diagRequest.resp.nData[args[0]], 4);
+    *pReplyLength = 6;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus GetLinAutoBaudCmd(const uint8_t *, uint8_t *reply, uint8_t *pReplyLength)
+{
+    reply[0] = GetLinAutoBaud();
+    PutU16(&reply[1], GetLinBaud());
+    *pReplyLength = 3;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus SetLinAutoBaudCmd(const uint8_t *args, uint8_t *, uint8_t *)
+{
+    if (args[0] > 1)
+        return SettingsStatus::OutOfRange;
+
+    SetLinAutoBaud(args[0]);
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus GetLinBaudStatsCmd(const uint8_t *args, uint8_t *reply, uint8_t *pReplyLength)
+{
+    stLinBaudStats stats;
+    if (!GetLinBaudStats(args[0], &stats))
+        return SettingsStatus::OutOfRange;
+
+    PutU16(&reply[0], stats.nBaud);
+    PutU16(&reply[2], stats.nMinDeviation);
+    PutU16(&reply[4], stats.nMaxDeviation);
+    *pReplyLength = 6;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus GetLinSleepCmd(const uint8_t *, uint8_t *reply, uint8_t *pReplyLength)
+{
+    reply[0] = static_cast<uint8_t>(GetLinPowerState());
+    PutU32(&reply[1], GetLinSleepIdle());
+    *pReplyLength = 5;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus SetLinSleepCmd(const uint8_t *args, uint8_t *, uint8_t *)
+{
+    const uint32_t nIdleMs = GetU32(args);
+    if (nIdleMs > LIN_SLEEP_IDLE_MAX_MS)
+        return SettingsStatus::OutOfRange;
+
+    SetLinSleepIdle(nIdleMs);
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus GetLinErrorsCmd(const uint8_t *args, uint8_t *reply, uint8_t *pReplyLength)
+{
+    stLinFrameStats stats;
+    if ((args[1] >= static_cast<uint8_t>(LinResult::Count)) || !GetLinFrameStats(args[0], &stats))
+        return SettingsStatus::OutOfRange;
+
+    PutU32(reply, args[1] == 0 ? stats.nFrames : stats.nErrors[args[1]]);
+    *pReplyLength = 4;
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus GetLinResponseCmd(const uint8_t *args, uint8_t *reply, uint8_t *pReplyLength)
+{
+    stLinFrameStats stats;
+    if ((args[1] >= LIN_RESPONSE_BUCKETS) || !GetLinFrameStats(args[0], &stats))
+        return SettingsStatus::OutOfRange;
+
+    for (uint8_t i = 0; (i < 3) && (args[1] + i < LIN_RESPONSE_BUCKETS); i++)
+    {
+        PutU16(&reply[i * 2], stats.nBuckets[args[1] + i]);
+        *pReplyLength = (i + 1) * 2;
+    }
+    return SettingsStatus::Ok;
+}
+
+static SettingsStatus ResetLinStatsCmd(const uint8_t *, uint8_t *, uint8_t *)
+{
+    ResetLinFrameStats();
+    return SettingsStatus::Ok;
+}
+
+// Indexed by opcode
+static const stSettingsCommand commands[SETTINGS_OPCODE_COUNT] = {
+    {GetVersion, 0},
+    {GetLinPeriodCmd, 0},
+    {SetLinPeriodCmd, 2},
+    {GetTxBudgetCmd, 1},
+    {SetTxBudgetCmd, 7},
+    {GetTxBusBudgetCmd, 0},
+    {SetTxBusBudgetCmd, 1},
+    {GetUsbFilterCmd, 1},
+    {SetUsbFilterCmd, 6},
+    {GetUsbFilterMaskCmd, 1},
+    {SetUsbFilterMaskCmd, 5},
+    {GetRtrMapCmd, 1},
+    {SetRtrMapCmd, 6},
+    {GetLinModeCmd, 0},
+    {SetLinModeCmd, 1},
+    {SetLinSlaveCmd, 2},
+    {SetLinSlaveDataCmd, 6},
+    {GetLinSlaveDataCmd, 2},
+    {GetLinMonitorCanCmd, 0},
+    {SetLinMonitorCanCmd, 1},
+    {GetLinFrameCmd, 1},
+    {SetLinFrameCmd, 3},
+    {SetLinDiagDataCmd, 6},
+    {StartLinDiagCmd, 2},
+    {GetLinDiagCmd, 1},
+    {GetLinAutoBaudCmd, 0},
+    {SetLinAutoBaudCmd, 1},
+    {GetLinBaudStatsCmd, 1},
+    {GetLinSleepCmd, 0},
+    {SetLinSleepCmd, 4},
+    {GetLinErrorsCmd, 2},
+    {GetLinResponseCmd, 2},
+    {ResetLinStatsCmd, 0},
+    {GetTxClassStatsCmd, 2},
+    {GetTxLatencyCmd, 2},
+    {SetTtcanSlotIdCmd, 6},
+    {SetTtcanSlotTimeCmd, 7},
+    {SetTtcanSlotDataCmd, 6},
+    {StartTtcanCmd, 7},
+    {GetTtcanSlotStatsCmd, 2},
+    {GetLinSlotStatsCmd, 3},
+};
+
+// Called from the CAN Rx thread for frames on CAN_BASE_ID - 1
+void SettingsReceive(const CANRxFrame *frame)
+{
+    if (frame->DLC == 0)
+        return;
+
+    const uint8_t nOpcode = frame->data8[0];
+    uint8_t nReplyLength = 0;
+    SettingsStatus eStatus;
+
+    CANTxFrame msg;
+    msg.SID = CAN_BASE_ID;
+    msg.IDE = CAN_IDE_STD;
+    msg.RTR = CAN_RTR_DATA;
+
+    if (nOpcode >= SETTINGS_OPCODE_COUNT)
+        eStatus = SettingsStatus::UnknownOpcode;
+    else if (frame->DLC < 1 + commands[nOpcode].nArgLength)
+        eStatus = SettingsStatus::BadLength;
+    else
+        eStatus = commands[nOpcode].handler(&frame->data8[1], &msg.data8[2], &nReplyLength);
+
+    msg.data8[0] = nOpcode;
+    msg.data8[1] = static_cast<uint8_t>(eStatus);
+    msg.DLC = 2 + nReplyLength;
+
+    PostTxFrame(&msg, CanTxClass::Control);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include "hal.h"
+
+/*
+ * Binary settings protocol. Requests on CAN_BASE_ID - 1 (also reached from
+ * USB, hex encoded after 's' or raw in lines that are not USB commands),
+ * byte 0 the opcode followed by its
+ * arguments, little endian. Every request is answered on CAN_BASE_ID with
+ * the opcode, a SettingsStatus and up to 6 bytes of data.
+ */
+#define SETTINGS_GET_VERSION 0x00        // -> major, minor, build
+#define SETTINGS_GET_LIN_PERIOD 0x01     // -> period ms u16
+#define SETTINGS_SET_LIN_PERIOD 0x02     // period ms u16
+#define SETTINGS_GET_TX_BUDGET 0x03      // class -> frames/s u16, burst u16, share %, shed
+#define SETTINGS_SET_TX_BUDGET 0x04      // class, frames/s u16, burst u16, share %, shed
+#define SETTINGS_GET_TX_BUS_BUDGET 0x05  // -> share %
+#define SETTINGS_SET_TX_BUS_BUDGET 0x06  // share %
+#define SETTINGS_GET_USB_FILTER 0x07     // index -> enabled, id u32
+#define SETTINGS_SET_USB_FILTER 0x08     // index, enabled, id u32
+#define SETTINGS_GET_USB_FILTER_MASK 0x09 // index -> mask u32
+#define SETTINGS_SET_USB_FILTER_MASK 0x0A // index, mask u32
+#define SETTINGS_GET_RTR_MAP 0x0B      // index -> enabled, LIN id, CAN id u32
+#define SETTINGS_SET_RTR_MAP 0x0C      // index, LIN id (bit 7 enable), CAN id u32 (bit 31 extended)
+#define SETTINGS_GET_LIN_MODE 0x0D     // -> mode (0 master, 1 slave, 2 monitor)
+#define SETTINGS_SET_LIN_MODE 0x0E     // mode
+#define SETTINGS_SET_LIN_SLAVE 0x0F    // LIN id, flags (bit 0 enable, bit 1 respond, as master send in sporadic slots)
+#define SETTINGS_SET_LIN_SLAVE_DATA 0x10 // LIN id, offset, 4 data bytes, sets the update flag of a sporadic frame
+#define SETTINGS_GET_LIN_SLAVE_DATA 0x11 // LIN id, offset -> 4 data bytes
+#define SETTINGS_GET_LIN_MONITOR_CAN 0x12 // -> forwarding enabled
+#define SETTINGS_SET_LIN_MONITOR_CAN 0x13 // forward monitored LIN frames to CAN
+#define SETTINGS_GET_LIN_FRAME 0x14    // LIN id -> length, flags
+#define SETTINGS_SET_LIN_FRAME 0x15    // LIN id, length (0 unknown), flags (bit 0 master publishes, bit 1 enhanced checksum)
+#define SETTINGS_SET_LIN_DIAG_DATA 0x16 // offset, 5 request bytes
+#define SETTINGS_START_LIN_DIAG 0x17    // NAD, request length, queues the staged request
+#define SETTINGS_GET_LIN_DIAG 0x18      // offset -> LinTpStatus, response length, 4 response bytes
+#define SETTINGS_GET_LIN_AUTOBAUD 0x19 // -> enabled, rate on the wire u16
+#define SETTINGS_SET_LIN_AUTOBAUD 0x1A // enabled, measure the sync field as slave or monitor
+#define SETTINGS_GET_LIN_BAUD_STATS 0x1B // LIN id -> last rate u16, min and max deviation i16 in 0.1%
+#define SETTINGS_GET_LIN_SLEEP 0x1C    // -> power state (0 awake, 1 asleep), idle ms u32
+#define SETTINGS_SET_LIN_SLEEP 0x1D    // CAN and LIN idle ms u32 before the bus sleeps, 0 never
+#define SETTINGS_GET_LIN_ERRORS 0x1E   // LIN id, LinResult (0 for good frames) -> count u32
+#define SETTINGS_GET_LIN_RESPONSE 0x1F // LIN id, first bucket -> 3 response space bucket counts u16
+#define SETTINGS_RESET_LIN_STATS 0x20  // clears the LIN error counters and response histograms
+#define SETTINGS_GET_TX_CLASS_STATS 0x21 // class, counter (0 sent, 1 deferred, 2 shed) -> count u32
+#define SETTINGS_GET_TX_LATENCY 0x22   // class or 0x80 | ID index, field (0 ID, 1 count, 2 arb lost, 3 failed, 4 max us, 5+ buckets) -> u32
+#define SETTINGS_SET_TTCAN_SLOT_ID 0x23 // slot, CAN id u32 (bit 31 extended), DLC
+#define SETTINGS_SET_TTCAN_SLOT_TIME 0x24 // slot, window offset u16, window length u16 in ticks, repeat, enabled
+#define SETTINGS_SET_TTCAN_SLOT_DATA 0x25 // slot, offset, 4 data bytes
+#define SETTINGS_START_TTCAN 0x26      // TtcanMode (0 stops), cycle ticks u16, reference CAN id u32
+#define SETTINGS_GET_TTCAN_SLOT_STATS 0x27 // slot, field (0 sent, 1 late, 2 missed, 3 min and 4 max period in bit times) -> u32
+#define SETTINGS_GET_LIN_SLOT_STATS 0x28 // schedule table, slot, field (0 starts, 1 overruns, 2 last, 3 min and 4 max start delay us) -> u32
+#define SETTINGS_OPCODE_COUNT 0x29
+
+enum class SettingsStatus : uint8_t
+{
+    Ok,
+    UnknownOpcode,
+    BadLength,
+    OutOfRange,
+    Busy
+};
+
+void SettingsReceive(const CANRxFrame *frame);
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include "enums.h"
+
+/*
+ * Bit level signal codec for LIN and CAN payloads. Layout is given as
+ * template parameters so every access compiles down to fixed shifts and
+ * masks on the bytes the signal spans.
+ *
+ * Start bit numbering follows the DBC/LDF convention. Intel signals start
+ * at their LSB, bit 0 being the LSB of byte 0. Motorola signals start at
+ * their MSB, bit n being bit n % 8 of byte n / 8, and continue into the
+ * following bytes.
+ */
+template <uint8_t nStartBit, uint8_t nLength, ByteOrder eOrder = ByteOrder::Intel, bool bSigned = false>
+struct Signal
+{
+    static_assert((nLength > 0) && (nLength <= 64), "Signal length out of range");
+
+    using Raw = std::conditional_t<(nLength > 32), uint64_t, uint32_t>;
+    using Value = std::conditional_t<bSigned, std::make_signed_t<Raw>, Raw>;
+
+    static constexpr ByteOrder kOrder = eOrder;
+    static constexpr uint64_t kMask = (nLength == 64) ? ~0ULL : ((1ULL << nLength) - 1);
+
+    // LSB position counted from the LSB of a little endian load of the 8
+    // byte payload (Intel), or of a big endian load (Motorola)
+    static constexpr uint8_t kLsb = (eOrder == ByteOrder::Intel) ?
+        nStartBit :
+        (7 - nStartBit / 8) * 8 + nStartBit % 8 - (nLength - 1);
+
+    // Bytes the signal spans, in payload order
+    static constexpr uint8_t kFirstByte = nStartBit / 8;
+    static constexpr uint8_t kLastByte = (eOrder == ByteOrder::Intel) ?
+        (nStartBit + nLength - 1) / 8 :
+        7 - kLsb / 8;
+    static constexpr uint8_t kBytes = kLastByte - kFirstByte + 1;
+
+    static_assert((eOrder == ByteOrder::Intel) ?
+                      (nStartBit + nLength <= 64) :
+                      ((7 - nStartBit / 8) * 8 + nStartBit % 8 + 1 >= nLength),
+                  "Signal does not fit in 8 bytes");
+
+    static constexpr uint8_t kShift = kLsb % 8;
+
+    static constexpr Value Get(const uint8_t *data)
+    {
+        return FromRaw(static_cast<Raw>((Load(data, std::make_index_sequence<kBytes>{}) >> kShift) & kMask));
+    }
+
+    static constexpr void Set(uint8_t *data, Value value)
+    {
+        Store(data, (static_cast<uint64_t>(value) & kMask) << kShift, std::make_index_sequence<kBytes>{});
+    }
+
+    // Value positioned in a whole payload load, used by SignalFrame
+    static constexpr Value FromPayload(uint64_t nLe, uint64_t nBe)
+    {
+        const uint64_t nWord = (eOrder == ByteOrder::Intel) ? nLe : nBe;
+        return FromRaw(static_cast<Raw>((nWord >> kLsb) & kMask));
+    }
+
+    static constexpr uint64_t ToPayload(Value value)
+    {
+        return (static_cast<uint64_t>(value) & kMask) << kLsb;
+    }
+
+private:
+    static constexpr Value FromRaw(Raw nRaw)
+    {
+        if constexpr (bSigned && (nLength < 64))
+        {
+            constexpr Raw nSign = static_cast<Raw>(1) << (nLength - 1);
+            return static_cast<Value>((nRaw ^ nSign) - nSign);
+        }
+        else
+        {
+            return static_cast<Value>(nRaw);
+        }
+    }
+
+    // Shift of payload byte kFirstByte + i inside the spanned word
+    static constexpr uint8_t ByteShift(uint8_t i)
+    {
+        return (eOrder == ByteOrder::Intel) ? i * 8 : (kBytes - 1 - i) * 8;
+    }
+
+    template <std::size_t... i>
+    static constexpr uint64_t Load(const uint8_t *data, std::index_sequence<i...>)
+    {
+        return ((static_cast<uint64_t>(data[kFirstByte + i]) << ByteShift(i)) | ...);
+    }
+
+    template <std::size_t... i>
+    static constexpr void Store(uint8_t *data, uint64_t nBits, std::index_sequence<i...>)
+    {
+        constexpr uint64_t nFieldMask = kMask << kShift;
+        ((data[kFirstByte + i] = (data[kFirstByte + i] & ~static_cast<uint8_t>(nFieldMask >> ByteShift(i))) |
+                                 static_cast<uint8_t>(nBits >> ByteShift(i))), ...);
+    }
+};
+
+/*
+ * Whole payload access for a set of signals. The payload is loaded or
+ * stored once, each byte touched a single time, and every signal is a
+ * shift and mask of that word. Encode clears bits no signal covers.
+ */
+template <uint8_t nBytes, typename... Signals>
+struct SignalFrame
+{
+    static_assert((nBytes > 0) && (nBytes <= 8), "Payload length out of range");
+    static_assert(((Signals::kLastByte < nBytes) && ...), "Signal outside the payload");
+
+    static constexpr void Decode(const uint8_t *data, typename Signals::Value &...values)
+    {
+        const uint64_t nLe = Load(data, std::make_index_sequence<nBytes>{});
+        const uint64_t nBe = __builtin_bswap64(nLe);
+        ((values = Signals::FromPayload(nLe, nBe)), ...);
+    }
+
+    static constexpr void Encode(uint8_t *data, typename Signals::Value... values)
+    {
+        uint64_t nLe = 0;
+        uint64_t nBe = 0;
+        (((Signals::kOrder == ByteOrder::Intel ? nLe : nBe) |= Signals::ToPayload(values)), ...);
+        nLe |= __builtin_bswap64(nBe);
+        Store(data, nLe, std::make_index_sequence<nBytes>{});
+    }
+
+private:
+    template <std::size_t... i>
+    static constexpr uint64_t Load(const uint8_t *data, std::index_sequence<i...>)
+    {
+        return ((static_cast<uint64_t>(data[i]) << (i * 8)) | ...);
+    }
+
+    template <std::size_t... i>
+    static constexpr void Store(uint8_t *data, uint64_t nLe, std::index_sequence<i...>)
+    {
+        ((data[i] = static_cast<uint8_t>(nLe >> (i * 8))), ...);
+    }
+};
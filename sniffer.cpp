@@ -0,0 +1,183 @@
+#include "sniffer.h"
+#include "port.h"
+
+typedef struct {
+    rtcnt_t nTime;
+    uint32_t nId;
+    uint8_t nDlc;
+    uint8_t nFlags;
+    uint8_t nData[8];
+} stSnifferRecord;
+
+static stSnifferRecord ring[SNIFFER_RING_SIZE];
+static volatile uint16_t nHead; // Written by the CAN interrupt
+static volatile uint16_t nTail; // Written by the USB thread
+
+static volatile bool bActive = false;
+static volatile uint32_t nLost;
+static volatile uint32_t nOverruns;
+static volatile uint32_t nLastEsr;
+static volatile bool bErrorPending;
+static volatile bool bLossPending;
+
+// Reported totals, the USB side emits a status record when they move
+static uint32_t nLostReported;
+static uint32_t nOverrunsReported;
+
+// Microsecond timestamp extended from the cycle counter, which wraps
+// every minute at 72MHz
+static rtcnt_t nLastCycles;
+static uint32_t nTimeUs;
+static uint32_t nCycleRemainder;
+
+static uint32_t ToUs(rtcnt_t nCycles)
+{
+    const uint32_t nDelta = nCycles - nLastCycles + nCycleRemainder;
+    nLastCycles = nCycles;
+    nTimeUs += nDelta / RT_TICKS_PER_US;
+    nCycleRemainder = nDelta % RT_TICKS_PER_US;
+    return nTimeUs;
+}
+
+static uint8_t *PutU32(uint8_t *buf, uint32_t nValue)
+{
+    for (uint8_t i = 0; i < 4; i++)
+        *buf++ = (nValue >> (i * 8)) & 0xFF;
+    return buf;
+}
+
+static uint8_t *PutStatus(uint8_t *buf, uint8_t nType, uint32_t nValue)
+{
+    *buf++ = SNIFFER_STATUS_SYNC;
+    *buf++ = nType;
+    buf = PutU32(buf, nTimeUs); // Time of the last frame, keeps the stream monotonic
+    return PutU32(buf, nValue);
+}
+
+void InitSniffer(void)
+{
+    nHead = 0;
+    nTail = 0;
+    nLost = 0;
+    nOverruns = 0;
+    nLostReported = 0;
+    nOverrunsReported = 0;
+    bErrorPending = false;
+    bLossPending = false;
+    nLastCycles = chSysGetRealtimeCounterX();
+    nTimeUs = 0;
+    nCycleRemainder = 0;
+}
+
+void SetSnifferActive(bool bNewActive)
+{
+    if (bNewActive && !bActive)
+        InitSniffer();
+    bActive = bNewActive;
+}
+
+bool SnifferIsActive(void)
+{
+    return bActive;
+}
+
+// Called from the CAN RX interrupt for every frame
+void SnifferRecordI(const CANRxFrame *frame)
+{
+    if (!bActive)
+        return;
+
+    const uint16_t nNext = (nHead + 1) & (SNIFFER_RING_SIZE - 1);
+    if (nNext == nTail)
+    {
+        nLost++;
+        bLossPending = true;
+        return;
+    }
+
+    stSnifferRecord *r = &ring[nHead];
+    r->nTime = chSysGetRealtimeCounterX();
+    r->nId = (frame->IDE == CAN_IDE_EXT) ? (frame->EID | 0x80000000) : frame->SID;
+    if (frame->RTR == CAN_RTR_REMOTE)
+        r->nId |= 0x40000000;
+    r->nDlc = frame->DLC;
+    r->nFlags = 0;
+    if (CAND1.can->ESR & (CAN_ESR_EPVF | CAN_ESR_BOFF))
+        r->nFlags |= SNIFFER_FLAG_ERROR_PASSIVE;
+    if (bLossPending)
+    {
+        r->nFlags |= SNIFFER_FLAG_LOSS_BEFORE;
+        bLossPending = false;
+    }
+    for (uint8_t i = 0; i < 8; i++)
+        r->nData[i] = frame->data8[i];
+
+    nHead = nNext;
+}
+
+// Called from the CAN error interrupt, high 16 bits hold ESR
+void SnifferErrorI(uint32_t nFlags)
+{
+    if (!bActive)
+        return;
+
+    if (nFlags & CAN_OVERFLOW_ERROR)
+    {
+        nOverruns++;
+        bLossPending = true;
+    }
+
+    if (nFlags & (CAN_LIMIT_WARNING | CAN_LIMIT_ERROR | CAN_BUS_OFF_ERROR | CAN_FRAMING_ERROR))
+    {
+        nLastEsr = CAND1.can->ESR;
+        bErrorPending = true;
+    }
+}
+
+// Fills buf with as many whole records as fit, called from the USB thread
+size_t SnifferEncode(uint8_t *buf, size_t nSize)
+{
+    uint8_t *p = buf;
+    uint8_t *pEnd = buf + nSize;
+
+    // Keep the time base moving while the bus is idle, the counter is read
+    // first so frames queued after the check are never older than it
+    const rtcnt_t nNow = chSysGetRealtimeCounterX();
+    if (nTail == nHead)
+        ToUs(nNow);
+
+    // Status first so a loss is reported ahead of the frames that follow it
+    if ((nLost != nLostReported) && (p + SNIFFER_RECORD_MAX <= pEnd))
+    {
+        nLostReported = nLost;
+        p = PutStatus(p, SNIFFER_STATUS_LOST, nLostReported);
+    }
+    if ((nOverruns != nOverrunsReported) && (p + SNIFFER_RECORD_MAX <= pEnd))
+    {
+        nOverrunsReported = nOverruns;
+        p = PutStatus(p, SNIFFER_STATUS_OVERRUN, nOverrunsReported);
+    }
+    if (bErrorPending && (p + SNIFFER_RECORD_MAX <= pEnd))
+    {
+        bErrorPending = false;
+        p = PutStatus(p, SNIFFER_STATUS_ERROR, nLastEsr);
+    }
+
+    uint16_t nIndex = nTail;
+    while ((nIndex != nHead) && (p + SNIFFER_RECORD_MAX <= pEnd))
+    {
+        const stSnifferRecord *r = &ring[nIndex];
+
+        *p++ = SNIFFER_FRAME_SYNC;
+        *p++ = r->nDlc | (r->nFlags << 4);
+        p = PutU32(p, ToUs(r->nTime));
+        p = PutU32(p, r->nId);
+        for (uint8_t i = 0; (i < r->nDlc) && (i < 8); i++)
+            *p++ = r->nData[i];
+
+        nIndex = (nIndex + 1) & (SNIFFER_RING_SIZE - 1);
+    }
+    nTail = nIndex;
+
+    return p - buf;
+}
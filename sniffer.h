@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include "hal.h"
+
+// Power of two, records buffered between the CAN interrupt and USB
+#define SNIFFER_RING_SIZE 128
+
+/*
+ * Binary stream written to USB while the sniffer runs, little endian.
+ * Frame:  0xA5, DLC | flags << 4, time us u32, ID u32 (bit 31 extended,
+ *         bit 30 remote), DLC data bytes
+ * Status: 0x5A, type, time us u32, value u32
+ * Frame flags are SNIFFER_FLAG_*, status types SNIFFER_STATUS_*.
+ */
+#define SNIFFER_FRAME_SYNC 0xA5
+#define SNIFFER_STATUS_SYNC 0x5A
+
+#define SNIFFER_FLAG_ERROR_PASSIVE 0x01 // Controller was error passive or worse
+#define SNIFFER_FLAG_LOSS_BEFORE 0x02   // Frames were lost just before this one
+
+#define SNIFFER_STATUS_LOST 0x01    // Total frames dropped, ring full
+#define SNIFFER_STATUS_OVERRUN 0x02 // Total hardware FIFO overruns
+#define SNIFFER_STATUS_ERROR 0x03   // Bus error, value is the ESR register
+
+// Largest encoded record
+#define SNIFFER_RECORD_MAX 18
+
+void InitSniffer(void);
+void SetSnifferActive(bool bActive);
+bool SnifferIsActive(void);
+void SnifferRecordI(const CANRxFrame *frame);
+void SnifferErrorI(uint32_t nFlags);
+size_t SnifferEncode(uint8_t *buf, size_t nSize);
@@ -0,0 +1,74 @@
+/*
+ * Application image for the resident loader, runs on the build host.
+ *
+ *   bootimage input.bin output.bin
+ *
+ * Pads the linked application to the application region and appends its
+ * record, the output is flashed at BOOT_APP_START over SWD so the loader
+ * starts it without a CAN update. Updates over CAN send the plain binary,
+ * the board writes the record itself.
+ */
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include "bootflash.h"
+
+namespace {
+
+// Same polynomial as BootCrc32, bitwise since speed doesn't matter here
+uint32_t Crc32(const std::vector<uint8_t> &data)
+{
+    uint32_t nCrc = 0xFFFFFFFF;
+    for (uint8_t b : data)
+    {
+        nCrc ^= b;
+        for (int i = 0; i < 8; i++)
+            nCrc = (nCrc >> 1) ^ (0xEDB88320 & (0 - (nCrc & 1)));
+    }
+    return ~nCrc;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s input.bin output.bin\n", argv[0]);
+        return 2;
+    }
+
+    std::ifstream in(argv[1], std::ios::binary);
+    if (!in)
+    {
+        fprintf(stderr, "%s: cannot open\n", argv[1]);
+        return 1;
+    }
+    std::vector<uint8_t> image((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    if (image.empty() || image.size() > BOOT_IMAGE_MAX)
+    {
+        fprintf(stderr, "%s: %zu bytes, application region holds %u\n", argv[1], image.size(), BOOT_IMAGE_MAX);
+        return 1;
+    }
+
+    const stBootRecord record = BootMakeRecord(image.size(), Crc32(image));
+
+    image.resize(BOOT_APP_RECORD - BOOT_APP_START, 0xFF);
+    const uint8_t *r = reinterpret_cast<const uint8_t *>(&record);
+    image.insert(image.end(), r, r + sizeof(record));
+
+    std::ofstream out(argv[2], std::ios::binary);
+    out.write(reinterpret_cast<const char *>(image.data()), image.size());
+    if (!out)
+    {
+        fprintf(stderr, "%s: write failed\n", argv[2]);
+        return 1;
+    }
+
+    printf("%s: %u bytes, CRC %08X\n", argv[2], record.nSize, record.nCrc);
+    return 0;
+}
@@ -0,0 +1,178 @@
+// Host check of lincodec.h against the LIN functions it replaced, and a
+// benchmark of both. Exits non-zero on any mismatch.
+
+#include "lincodec.h"
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+// Reference implementations, as they were in lin.cpp
+static uint8_t RefProtectedId(uint8_t id)
+{
+    uint8_t p0 = (id >> 0) ^ (id >> 1) ^ (id >> 2) ^ (id >> 4);
+    uint8_t p1 = ~((id >> 1) ^ (id >> 3) ^ (id >> 4) ^ (id >> 5));
+
+    return id | ((p0 & 1) << 6) | ((p1 & 1) << 7);
+}
+
+static uint8_t RefChecksum2x(uint8_t protected_id, const uint8_t *data, size_t length)
+{
+    uint16_t sum = protected_id;
+
+    for (uint8_t i = 0; i < length; i++)
+        sum += data[i];
+
+    while (sum >> 8)
+        sum = (sum & 0xFF) + (sum >> 8);
+
+    return ~sum & 0xFF;
+}
+
+static uint8_t RefChecksum1x(const uint8_t *data, size_t length)
+{
+    uint16_t sum = 0;
+
+    for (uint8_t i = 0; i < length; i++)
+        sum += data[i];
+
+    while (sum >> 8)
+        sum = (sum & 0xFF) + (sum >> 8);
+
+    return ~sum & 0xFF;
+}
+
+static uint64_t nCases;
+static uint64_t nErrors;
+
+static void CheckFrame(uint8_t nPid, const uint8_t *data, size_t nLength)
+{
+    const uint8_t nEnhanced = LinCalculateChecksum(LinChecksumModel::Enhanced, nPid, data, nLength);
+    const uint8_t nClassic = LinCalculateChecksum(LinChecksumModel::Classic, nPid, data, nLength);
+
+    // Byte at a time, as the UART interrupt adds them
+    LinChecksum sum(LinChecksumModel::Enhanced, nPid);
+    for (size_t i = 0; i < nLength; i++)
+        sum.Add(data[i]);
+
+    const LinResult eExpected = LinPidValid(nPid) ? LinResult::Ok : LinResult::Parity;
+
+    nCases++;
+    if ((nEnhanced != RefChecksum2x(nPid, data, nLength)) ||
+        (nClassic != RefChecksum1x(data, nLength)) ||
+        (sum.Value() != nEnhanced) || !sum.Check(nEnhanced) ||
+        (LinCheckFrame(LinChecksumModel::Enhanced, nPid, data, nLength, nEnhanced) != eExpected))
+    {
+        if (nErrors++ < 10)
+            printf("mismatch PID %02X length %zu\n", nPid, nLength);
+    }
+
+    if (LinPidValid(nPid) && (nLength > 0) &&
+        (LinCheckFrame(LinChecksumModel::Enhanced, nPid, data, nLength, nEnhanced ^ 0x01) != LinResult::Checksum))
+        nErrors++;
+}
+
+static void CheckPids(void)
+{
+    for (unsigned nId = 0; nId < 256; nId++)
+    {
+        nCases++;
+        if (LinPid(nId) != RefProtectedId(nId & 0x3F))
+            nErrors++;
+        if (LinPidValid(nId) != (RefProtectedId(nId & 0x3F) == nId))
+            nErrors++;
+    }
+}
+
+// Every PID with every payload of up to 2 bytes, every 3 byte payload
+static void CheckExhaustive(void)
+{
+    uint8_t data[8];
+
+    for (unsigned nPid = 0; nPid < 256; nPid++)
+    {
+        CheckFrame(nPid, data, 0);
+        for (unsigned a = 0; a < 256; a++)
+        {
+            data[0] = a;
+            CheckFrame(nPid, data, 1);
+            for (unsigned b = 0; b < 256; b++)
+            {
+                data[1] = b;
+                CheckFrame(nPid, data, 2);
+            }
+        }
+    }
+
+    for (unsigned a = 0; a < 256; a++)
+    {
+        for (unsigned b = 0; b < 256; b++)
+        {
+            for (unsigned c = 0; c < 256; c++)
+            {
+                data[0] = a;
+                data[1] = b;
+                data[2] = c;
+                CheckFrame(0x30, data, 3);
+            }
+        }
+    }
+}
+
+// Random frames of up to 8 bytes, every other one all 0xFF for the
+// largest carries
+static void CheckRandom(uint32_t nCount)
+{
+    std::mt19937 rng(1);
+    uint8_t data[8];
+
+    for (uint32_t n = 0; n < nCount; n++)
+    {
+        const size_t nLength = rng() % 9;
+        const uint8_t nPid = rng();
+        for (size_t i = 0; i < nLength; i++)
+            data[i] = (n & 1) ? 0xFF : rng();
+        CheckFrame(nPid, data, nLength);
+    }
+}
+
+static void Benchmark(void)
+{
+    static uint8_t buf[1 << 16];
+    std::mt19937 rng(2);
+    for (uint8_t &b : buf)
+        b = rng();
+
+    const int nRounds = 2000;
+    volatile uint8_t nSink = 0;
+
+    // 8 byte enhanced frames, PID and checksum of each
+    const auto t0 = std::chrono::steady_clock::now();
+    for (int r = 0; r < nRounds; r++)
+        for (size_t i = 0; i + 9 <= sizeof(buf); i += 9)
+            nSink += RefChecksum2x(RefProtectedId(buf[i] & 0x3F), &buf[i + 1], 8);
+    const auto t1 = std::chrono::steady_clock::now();
+    for (int r = 0; r < nRounds; r++)
+        for (size_t i = 0; i + 9 <= sizeof(buf); i += 9)
+            nSink += LinCalculateChecksum(LinChecksumModel::Enhanced, LinPid(buf[i]), &buf[i + 1], 8);
+    const auto t2 = std::chrono::steady_clock::now();
+
+    using std::chrono::duration_cast;
+    using std::chrono::milliseconds;
+    printf("8 byte frames: reference %lld ms, codec %lld ms\n",
+           static_cast<long long>(duration_cast<milliseconds>(t1 - t0).count()),
+           static_cast<long long>(duration_cast<milliseconds>(t2 - t1).count()));
+}
+
+int main()
+{
+    CheckPids();
+    CheckExhaustive();
+    CheckRandom(20000000);
+
+    printf("lincodec: %llu cases, %llu errors\n",
+           static_cast<unsigned long long>(nCases), static_cast<unsigned long long>(nErrors));
+
+    Benchmark();
+
+    return nErrors == 0 ? 0 : 1;
+}
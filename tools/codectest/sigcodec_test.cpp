@@ -0,0 +1,207 @@
+// Host check of sigcodec.h against a bit at a time reference, and a
+// benchmark against hand written shifts. Every start bit is tried with
+// lengths either side of the byte and word boundaries, in both byte orders, signed and unsigned. Values of
+// up to 16 bits are round-tripped exhaustively, wider ones at random.
+// Exits non-zero on any mismatch.
+
+#include "sigcodec.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+static std::mt19937_64 rng(1);
+static uint64_t nCases;
+static uint64_t nErrors;
+
+// Next bit of a Motorola signal walking from its MSB towards its LSB
+static int RefNextMotorolaBit(int nBit)
+{
+    return (nBit % 8 == 0) ? nBit + 15 : nBit - 1;
+}
+
+static uint64_t RefGet(const uint8_t *data, int nStart, int nLength, ByteOrder eOrder)
+{
+    uint64_t nValue = 0;
+
+    if (eOrder == ByteOrder::Intel)
+    {
+        for (int i = 0; i < nLength; i++)
+        {
+            const int nBit = nStart + i;
+            nValue |= static_cast<uint64_t>((data[nBit / 8] >> (nBit % 8)) & 1) << i;
+        }
+    }
+    else
+    {
+        int nBit = nStart;
+        for (int i = nLength - 1; i >= 0; i--)
+        {
+            nValue |= static_cast<uint64_t>((data[nBit / 8] >> (nBit % 8)) & 1) << i;
+            nBit = RefNextMotorolaBit(nBit);
+        }
+    }
+
+    return nValue;
+}
+
+static void RefSet(uint8_t *data, int nStart, int nLength, ByteOrder eOrder, uint64_t nValue)
+{
+    int nBit = nStart;
+
+    for (int i = 0; i < nLength; i++)
+    {
+        const int nSrc = (eOrder == ByteOrder::Intel) ? i : nLength - 1 - i;
+        const uint8_t nMask = 1 << (nBit % 8);
+
+        if ((nValue >> nSrc) & 1)
+            data[nBit / 8] |= nMask;
+        else
+            data[nBit / 8] &= ~nMask;
+
+        nBit = (eOrder == ByteOrder::Intel) ? nBit + 1 : RefNextMotorolaBit(nBit);
+    }
+}
+
+static void Fail(const char *sWhat, int nStart, int nLength, ByteOrder eOrder, bool bSigned)
+{
+    if (nErrors++ < 10)
+        printf("%s: start %d length %d %s %s\n", sWhat, nStart, nLength,
+               eOrder == ByteOrder::Intel ? "Intel" : "Motorola", bSigned ? "signed" : "unsigned");
+}
+
+template <uint8_t nStart, uint8_t nLength, ByteOrder eOrder, bool bSigned>
+static void CheckValue(const uint8_t *payload, uint64_t nRaw)
+{
+    using Sig = Signal<nStart, nLength, eOrder, bSigned>;
+    using Value = typename Sig::Value;
+
+    uint8_t expected[8];
+    uint8_t data[8];
+
+    memcpy(expected, payload, 8);
+    RefSet(expected, nStart, nLength, eOrder, nRaw);
+
+    // Set leaves the other bits alone, Get reads back what the reference wrote
+    memcpy(data, payload, 8);
+    Sig::Set(data, static_cast<Value>(nRaw));
+    nCases++;
+    if (memcmp(data, expected, 8) != 0)
+        Fail("Set", nStart, nLength, eOrder, bSigned);
+
+    const Value value = Sig::Get(expected);
+    if ((static_cast<uint64_t>(value) & Sig::kMask) != RefGet(expected, nStart, nLength, eOrder))
+        Fail("Get", nStart, nLength, eOrder, bSigned);
+
+    // Signed values are sign extended from the top bit of the signal
+    if constexpr (bSigned && (nLength < 64))
+    {
+        if ((value < 0) != static_cast<bool>((nRaw >> (nLength - 1)) & 1))
+            Fail("sign", nStart, nLength, eOrder, bSigned);
+    }
+
+    // Whole payload path
+    Value decoded;
+    SignalFrame<8, Sig>::Decode(expected, decoded);
+    if (decoded != value)
+        Fail("Decode", nStart, nLength, eOrder, bSigned);
+
+    uint8_t encoded[8] = {};
+    uint8_t only[8] = {};
+    SignalFrame<8, Sig>::Encode(encoded, value);
+    RefSet(only, nStart, nLength, eOrder, nRaw);
+    if (memcmp(encoded, only, 8) != 0)
+        Fail("Encode", nStart, nLength, eOrder, bSigned);
+}
+
+template <uint8_t nStart, uint8_t nLength, ByteOrder eOrder, bool bSigned>
+static void CheckSignal()
+{
+    uint8_t payload[8];
+    for (uint8_t &b : payload)
+        b = rng();
+
+    if constexpr (nLength <= 16)
+    {
+        for (uint64_t nRaw = 0; nRaw < (1ULL << nLength); nRaw++)
+            CheckValue<nStart, nLength, eOrder, bSigned>(payload, nRaw);
+    }
+    else
+    {
+        const uint64_t nMask = Signal<nStart, nLength, eOrder, bSigned>::kMask;
+        for (int n = 0; n < 4096; n++)
+            CheckValue<nStart, nLength, eOrder, bSigned>(payload, rng() & nMask);
+    }
+}
+
+static constexpr uint8_t kLengths[] = {1, 2, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64};
+static constexpr size_t kLengthCount = sizeof(kLengths) / sizeof(kLengths[0]);
+
+template <size_t n>
+static void CheckCombination()
+{
+    constexpr uint8_t nStart = n / kLengthCount;
+    constexpr uint8_t nLength = kLengths[n % kLengthCount];
+
+    if constexpr (nStart + nLength <= 64)
+    {
+        CheckSignal<nStart, nLength, ByteOrder::Intel, false>();
+        CheckSignal<nStart, nLength, ByteOrder::Intel, true>();
+    }
+    if constexpr ((7 - nStart / 8) * 8 + nStart % 8 + 1 >= nLength)
+    {
+        CheckSignal<nStart, nLength, ByteOrder::Motorola, false>();
+        CheckSignal<nStart, nLength, ByteOrder::Motorola, true>();
+    }
+}
+
+template <size_t... n>
+static void CheckAll(std::index_sequence<n...>)
+{
+    (CheckCombination<n>(), ...);
+}
+
+// Wiper status layout from linboard.ldf, codec against the shifts it replaced
+static void Benchmark(void)
+{
+    using Status = SignalFrame<5, Signal<8, 8>, Signal<29, 1>>;
+
+    const int nRounds = 100000000;
+    uint8_t data[8] = {1, 2, 3, 0x20, 5, 6, 7, 8};
+    volatile uint32_t nSink = 0;
+
+    const auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < nRounds; i++)
+    {
+        data[1] = i;
+        nSink = nSink + data[1] + ((data[3] >> 5) & 1);
+    }
+    const auto t1 = std::chrono::steady_clock::now();
+    for (int i = 0; i < nRounds; i++)
+    {
+        data[1] = i;
+        uint32_t nPos;
+        uint32_t nMoving;
+        Status::Decode(data, nPos, nMoving);
+        nSink = nSink + nPos + nMoving;
+    }
+    const auto t2 = std::chrono::steady_clock::now();
+
+    using std::chrono::duration_cast;
+    using std::chrono::milliseconds;
+    printf("wiper status decode: hand written %lld ms, codec %lld ms\n",
+           static_cast<long long>(duration_cast<milliseconds>(t1 - t0).count()),
+           static_cast<long long>(duration_cast<milliseconds>(t2 - t1).count()));
+}
+
+int main()
+{
+    CheckAll(std::make_index_sequence<64 * kLengthCount>{});
+
+    printf("sigcodec: %llu cases, %llu errors\n",
+           static_cast<unsigned long long>(nCases), static_cast<unsigned long long>(nErrors));
+
+    Benchmark();
+
+    return nErrors == 0 ? 0 : 1;
+}
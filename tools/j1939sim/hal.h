@@ -0,0 +1,87 @@
+#pragma once
+
+// Just enough of the ChibiOS HAL for j1939.cpp to build on the host. The
+// simulation provides the system time and PostTxFrameTimeout.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+typedef int32_t msg_t;
+typedef uint32_t systime_t;
+typedef uint32_t sysinterval_t;
+typedef uint32_t rtcnt_t;
+
+#define MSG_OK 0
+#define MSG_TIMEOUT -1
+#define MSG_RESET -2
+
+#define TIME_IMMEDIATE ((sysinterval_t)0)
+
+// 1 ms ticks
+#define TIME_I2MS(n) (n)
+
+#define CAN_IDE_STD 0
+#define CAN_IDE_EXT 1
+#define CAN_RTR_DATA 0
+#define CAN_RTR_REMOTE 1
+
+#define STM32_HCLK 72000000U
+
+#define STM32_TIMINGR_PRESC(n) ((n) << 28)
+#define STM32_TIMINGR_SCLDEL(n) ((n) << 20)
+#define STM32_TIMINGR_SDADEL(n) ((n) << 16)
+#define STM32_TIMINGR_SCLH(n) ((n) << 8)
+#define STM32_TIMINGR_SCLL(n) (n)
+
+typedef struct {
+    uint8_t DLC:4;
+    uint8_t RTR:1;
+    uint8_t IDE:1;
+    union {
+        uint32_t SID:11;
+        uint32_t EID:29;
+    };
+    union {
+        uint8_t data8[8];
+        uint32_t data32[2];
+    };
+} CANTxFrame;
+
+typedef struct {
+    uint8_t FMI;
+    uint16_t TIME;
+    uint8_t DLC:4;
+    uint8_t RTR:1;
+    uint8_t IDE:1;
+    union {
+        uint32_t SID:11;
+        uint32_t EID:29;
+    };
+    union {
+        uint8_t data8[8];
+        uint32_t data32[2];
+    };
+} CANRxFrame;
+
+typedef struct {
+    uint32_t mcr;
+    uint32_t btr;
+} CANConfig;
+
+typedef struct {
+    uint32_t timingr;
+    uint32_t cr1;
+    uint32_t cr2;
+} I2CConfig;
+
+systime_t chVTGetSystemTimeX(void);
+
+// Single threaded, the mutex only checks locks and unlocks pair up
+typedef struct {
+    bool bLocked;
+} mutex_t;
+
+inline void chMtxObjectInit(mutex_t *mp) { mp->bLocked = false; }
+inline void chMtxLock(mutex_t *mp) { if (mp->bLocked) abort(); mp->bLocked = true; }
+inline void chMtxUnlock(mutex_t *mp) { if (!mp->bLocked) abort(); mp->bLocked = false; }
@@ -0,0 +1,388 @@
+// Host run of j1939.cpp against a simulated peer on the same bus. The
+// peer answers the board's RTS/CTS/EOMA traffic the way a J1939-21 node
+// would, and also sends malformed sessions that must be refused without
+// touching memory past the announced size. Exits non-zero on any failure.
+
+#include "j1939.h"
+#include "mailbox.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+
+#define PEER_ADDRESS 0x22
+#define PEER_PGN 0xEF00
+
+// TP.CM control bytes and abort reasons, as in j1939.cpp
+#define TP_CM_RTS 16
+#define TP_CM_CTS 17
+#define TP_CM_EOMA 19
+#define TP_CM_BAM 32
+#define TP_CM_ABORT 255
+#define TP_ABORT_RESOURCES 2
+#define TP_ABORT_TIMEOUT 3
+
+static uint32_t nNow;
+static std::deque<CANTxFrame> busFrames;
+static size_t nQueueDepth = SIZE_MAX; // Frames the TX queue takes before refusing
+static uint32_t nFailures;
+
+// Last message handed to the application
+static uint32_t nRxCount;
+static uint32_t nRxPgn;
+static uint16_t nRxLength;
+static uint8_t rxData[J1939_TP_BUFFER_SIZE];
+
+systime_t chVTGetSystemTimeX(void)
+{
+    return nNow;
+}
+
+msg_t PostTxFrameTimeout(CANTxFrame *frame, CanTxClass, sysinterval_t)
+{
+    if (busFrames.size() >= nQueueDepth)
+        return MSG_TIMEOUT;
+    busFrames.push_back(*frame);
+    return MSG_OK;
+}
+
+static void Check(bool bOk, const char *sWhat)
+{
+    if (!bOk)
+    {
+        printf("FAIL: %s\n", sWhat);
+        nFailures++;
+    }
+}
+
+static void RxHandler(uint32_t nPgn, uint8_t, uint8_t, const uint8_t *data, uint16_t nLength)
+{
+    nRxCount++;
+    nRxPgn = nPgn;
+    nRxLength = nLength;
+    memcpy(rxData, data, nLength < sizeof(rxData) ? nLength : sizeof(rxData));
+}
+
+static void PeerSend(uint32_t nPgn, uint8_t nDa, const uint8_t *data)
+{
+    CANRxFrame frame = {};
+    frame.IDE = CAN_IDE_EXT;
+    frame.RTR = CAN_RTR_DATA;
+    frame.EID = J1939EncodeId(7, nPgn, nDa, PEER_ADDRESS);
+    frame.DLC = 8;
+    memcpy(frame.data8, data, 8);
+    J1939Receive(&frame);
+}
+
+static void PeerSendTpCm(uint8_t nControl, uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4, uint32_t nPgn)
+{
+    const uint8_t data[8] = {nControl, b1, b2, b3, b4, (uint8_t)nPgn, (uint8_t)(nPgn >> 8), (uint8_t)(nPgn >> 16)};
+    PeerSend(J1939_PGN_TP_CM, nControl == TP_CM_BAM ? J1939_ADDR_GLOBAL : GetJ1939Address(), data);
+}
+
+static void PeerSendDt(uint8_t nDa, uint8_t nSeq, const uint8_t *message, uint16_t nSize)
+{
+    uint8_t data[8] = {nSeq};
+    for (uint8_t i = 0; i < 7; i++)
+    {
+        const uint16_t nOffset = (nSeq - 1) * 7 + i;
+        data[1 + i] = nOffset < nSize ? message[nOffset] : 0xFF;
+    }
+    PeerSend(J1939_PGN_TP_DT, nDa, data);
+}
+
+// Next frame the board put on the bus, false if there is none
+static bool NextBoardFrame(stJ1939Id *id, uint8_t *data)
+{
+    if (busFrames.empty())
+        return false;
+
+    const CANTxFrame frame = busFrames.front();
+    busFrames.pop_front();
+    J1939DecodeId(frame.EID, id);
+    memcpy(data, frame.data8, 8);
+    return true;
+}
+
+// Expects a TP.CM from the board with the given control byte
+static bool ExpectTpCm(uint8_t nControl, uint8_t *data)
+{
+    stJ1939Id id;
+    return NextBoardFrame(&id, data) && (id.nPgn == J1939_PGN_TP_CM) && (data[0] == nControl);
+}
+
+static void Run(uint32_t nMs)
+{
+    for (uint32_t i = 0; i < nMs; i++)
+    {
+        nNow++;
+        J1939Periodic();
+    }
+}
+
+static void FillMessage(uint8_t *data, uint16_t nSize, uint8_t nSeed)
+{
+    for (uint16_t i = 0; i < nSize; i++)
+        data[i] = nSeed + i * 7;
+}
+
+static void TestAddressClaim(void)
+{
+    InitJ1939(J1939_NAME, J1939_PREFERRED_ADDRESS);
+    J1939SetRxHandler(RxHandler);
+
+    stJ1939Id id;
+    uint8_t data[8];
+    Check(NextBoardFrame(&id, data) && (id.nPgn == J1939_PGN_ADDRESS_CLAIMED) && (id.nSa == J1939_PREFERRED_ADDRESS),
+          "address claim sent");
+
+    // A lower NAME on our address wins, we move to the first free dynamic address
+    const uint8_t lower[8] = {};
+    CANRxFrame frame = {};
+    frame.IDE = CAN_IDE_EXT;
+    frame.EID = J1939EncodeId(6, J1939_PGN_ADDRESS_CLAIMED, J1939_ADDR_GLOBAL, J1939_PREFERRED_ADDRESS);
+    frame.DLC = 8;
+    memcpy(frame.data8, lower, 8);
+    J1939Receive(&frame);
+    Check(NextBoardFrame(&id, data) && (id.nPgn == J1939_PGN_ADDRESS_CLAIMED) && (id.nSa != J1939_PREFERRED_ADDRESS),
+          "new address claimed after losing");
+
+    Run(300);
+    Check(GetJ1939AddrState() == J1939AddrState::Claimed, "claim completes");
+    busFrames.clear();
+}
+
+static void TestBamReceive(void)
+{
+    uint8_t message[20];
+    FillMessage(message, sizeof(message), 1);
+    nRxCount = 0;
+
+    PeerSendTpCm(TP_CM_BAM, sizeof(message), 0, 3, 0xFF, PEER_PGN);
+    for (uint8_t nSeq = 1; nSeq <= 3; nSeq++)
+    {
+        Run(50);
+        PeerSendDt(J1939_ADDR_GLOBAL, nSeq, message, sizeof(message));
+    }
+
+    Check((nRxCount == 1) && (nRxPgn == PEER_PGN) && (nRxLength == sizeof(message)) &&
+          (memcmp(rxData, message, sizeof(message)) == 0), "BAM reassembled");
+    Check(busFrames.empty(), "BAM not answered");
+}
+
+static void TestCmdtReceive(void)
+{
+    uint8_t message[100];
+    FillMessage(message, sizeof(message), 3);
+    nRxCount = 0;
+
+    // 15 packets, at most 4 per CTS
+    PeerSendTpCm(TP_CM_RTS, sizeof(message), 0, 15, 4, PEER_PGN);
+
+    uint8_t data[8];
+    while (true)
+    {
+        stJ1939Id id;
+        if (!NextBoardFrame(&id, data) || (id.nPgn != J1939_PGN_TP_CM) ||
+            ((data[0] != TP_CM_CTS) && (data[0] != TP_CM_EOMA)))
+        {
+            Check(false, "CMDT receive answered with CTS or EOMA");
+            return;
+        }
+        if (data[0] == TP_CM_EOMA)
+            break;
+
+        Check((data[1] > 0) && (data[1] <= 4), "CTS window within the RTS limit");
+        for (uint8_t nSeq = data[2]; nSeq < data[2] + data[1]; nSeq++)
+            PeerSendDt(GetJ1939Address(), nSeq, message, sizeof(message));
+    }
+
+    Check((data[1] | (data[2] << 8)) == sizeof(message) && (data[3] == 15), "EOMA size and packets");
+    Check((nRxCount == 1) && (nRxLength == sizeof(message)) && (memcmp(rxData, message, sizeof(message)) == 0),
+          "CMDT reassembled");
+}
+
+static void TestCmdtSend(void)
+{
+    uint8_t message[30];
+    uint8_t received[35];
+    FillMessage(message, sizeof(message), 5);
+    memset(received, 0, sizeof(received));
+
+    Check(J1939Send(PEER_PGN, PEER_ADDRESS, message, sizeof(message)) == MSG_OK, "CMDT send accepted");
+
+    uint8_t data[8];
+    Check(ExpectTpCm(TP_CM_RTS, data) && ((data[1] | (data[2] << 8)) == sizeof(message)) && (data[3] == 5) &&
+          (data[4] == MAILBOX_SIZE), "RTS size, packets and window");
+
+    // Two packets per CTS, the peer holds once in between
+    uint8_t nNextSeq = 1;
+    while (nNextSeq <= 5)
+    {
+        if (nNextSeq == 3)
+        {
+            PeerSendTpCm(TP_CM_CTS, 0, 0xFF, 0xFF, 0xFF, PEER_PGN);
+            Run(100);
+            Check(busFrames.empty(), "nothing sent while held");
+        }
+
+        const uint8_t nCount = nNextSeq == 5 ? 1 : 2;
+        PeerSendTpCm(TP_CM_CTS, nCount, nNextSeq, 0xFF, 0xFF, PEER_PGN);
+        Run(1);
+
+        stJ1939Id id;
+        for (uint8_t i = 0; i < nCount; i++)
+        {
+            if (!NextBoardFrame(&id, data) || (id.nPgn != J1939_PGN_TP_DT) || (data[0] != nNextSeq))
+            {
+                Check(false, "TP.DT in sequence");
+                return;
+            }
+            memcpy(&received[(nNextSeq - 1) * 7], &data[1], 7);
+            nNextSeq++;
+        }
+        Check(busFrames.empty(), "no TP.DT past the CTS window");
+    }
+
+    Check(memcmp(received, message, sizeof(message)) == 0, "CMDT data");
+    Check(received[30] == 0xFF, "last packet padded");
+
+    PeerSendTpCm(TP_CM_EOMA, sizeof(message), 0, 5, 0xFF, PEER_PGN);
+    Check(!J1939TxBusy(), "idle after EOMA");
+}
+
+// A peer granting more than the TX queue holds gets the window in queue
+// sized pieces, none of it dropped
+static void TestCmdtSendPaced(void)
+{
+    uint8_t message[7 * 40];
+    FillMessage(message, sizeof(message), 11);
+    nQueueDepth = MAILBOX_SIZE;
+
+    uint8_t data[8];
+    Check(J1939Send(PEER_PGN, PEER_ADDRESS, message, sizeof(message)) == MSG_OK, "paced send accepted");
+    Check(ExpectTpCm(TP_CM_RTS, data) && (data[3] == 40), "paced RTS");
+
+    // Fill the queue with other traffic, single frames are refused
+    for (size_t i = 0; i < MAILBOX_SIZE; i++)
+        busFrames.push_back(CANTxFrame());
+    Check(J1939Send(PEER_PGN, PEER_ADDRESS, message, 8) != MSG_OK, "single frame refused on a full queue");
+    busFrames.clear();
+
+    PeerSendTpCm(TP_CM_CTS, 40, 1, 0xFF, 0xFF, PEER_PGN);
+
+    uint8_t nNextSeq = 1;
+    for (uint32_t nPass = 0; (nPass < 10) && (nNextSeq <= 40); nPass++)
+    {
+        Run(1);
+        Check(busFrames.size() <= MAILBOX_SIZE, "queue never overfilled");
+
+        // The bus drains the queue between passes
+        stJ1939Id id;
+        while (NextBoardFrame(&id, data))
+        {
+            if ((id.nPgn != J1939_PGN_TP_DT) || (data[0] != nNextSeq))
+            {
+                Check(false, "paced TP.DT in sequence");
+                nQueueDepth = SIZE_MAX;
+                return;
+            }
+            Check(memcmp(&data[1], &message[(nNextSeq - 1) * 7], 7) == 0, "paced TP.DT data");
+            nNextSeq++;
+        }
+    }
+    Check(nNextSeq == 41, "whole window sent");
+
+    PeerSendTpCm(TP_CM_EOMA, sizeof(message) & 0xFF, sizeof(message) >> 8, 40, 0xFF, PEER_PGN);
+    Check(!J1939TxBusy(), "idle after paced EOMA");
+    nQueueDepth = SIZE_MAX;
+}
+
+// The packet count must agree with the size, otherwise the sequence
+// numbers would take TP.DT offsets past the message and the buffer
+static void TestBadPacketCount(void)
+{
+    uint8_t message[7 * 255];
+    FillMessage(message, sizeof(message), 7);
+    nRxCount = 0;
+
+    uint8_t data[8];
+    static const uint8_t packetCounts[] = {2, 4, 255};
+    for (uint8_t nPackets : packetCounts)
+    {
+        PeerSendTpCm(TP_CM_RTS, 20, 0, nPackets, 0xFF, PEER_PGN);
+        Check(ExpectTpCm(TP_CM_ABORT, data) && (data[1] == TP_ABORT_RESOURCES), "RTS with wrong packet count aborted");
+
+        for (uint16_t nSeq = 1; nSeq <= nPackets; nSeq++)
+            PeerSendDt(GetJ1939Address(), nSeq, message, sizeof(message));
+        Check(busFrames.empty(), "TP.DT without a session ignored");
+
+        // BAM is refused silently
+        PeerSendTpCm(TP_CM_BAM, 20, 0, nPackets, 0xFF, PEER_PGN);
+        for (uint16_t nSeq = 1; nSeq <= nPackets; nSeq++)
+            PeerSendDt(J1939_ADDR_GLOBAL, nSeq, message, sizeof(message));
+        Check(busFrames.empty(), "BAM with wrong packet count ignored");
+    }
+
+    // Larger than the buffer, with a packet count to match
+    PeerSendTpCm(TP_CM_RTS, sizeof(message) & 0xFF, sizeof(message) >> 8, 255, 0xFF, PEER_PGN);
+    Check(ExpectTpCm(TP_CM_ABORT, data) && (data[1] == TP_ABORT_RESOURCES), "oversized RTS aborted");
+
+    PeerSendTpCm(TP_CM_RTS, 0, 0, 0, 0xFF, PEER_PGN);
+    Check(ExpectTpCm(TP_CM_ABORT, data), "empty RTS aborted");
+
+    Check(nRxCount == 0, "nothing delivered from refused sessions");
+}
+
+static void TestBadSequence(void)
+{
+    uint8_t message[20];
+    FillMessage(message, sizeof(message), 9);
+    nRxCount = 0;
+
+    uint8_t data[8];
+    PeerSendTpCm(TP_CM_RTS, sizeof(message), 0, 3, 0xFF, PEER_PGN);
+    Check(ExpectTpCm(TP_CM_CTS, data), "CTS");
+
+    PeerSendDt(GetJ1939Address(), 1, message, sizeof(message));
+    PeerSendDt(GetJ1939Address(), 3, message, sizeof(message));
+    Check(ExpectTpCm(TP_CM_ABORT, data), "out of order TP.DT aborted");
+
+    PeerSendDt(GetJ1939Address(), 2, message, sizeof(message));
+    Check(busFrames.empty() && (nRxCount == 0), "session gone after abort");
+}
+
+static void TestTimeout(void)
+{
+    uint8_t data[8];
+    PeerSendTpCm(TP_CM_RTS, 20, 0, 3, 0xFF, PEER_PGN);
+    Check(ExpectTpCm(TP_CM_CTS, data), "CTS");
+
+    Run(1200);
+    Check(busFrames.empty(), "no abort before T2");
+    Run(100);
+    Check(ExpectTpCm(TP_CM_ABORT, data) && (data[1] == TP_ABORT_TIMEOUT), "abort after T2");
+
+    // Sender side, the peer never answers the RTS
+    const uint8_t message[20] = {};
+    J1939Send(PEER_PGN, PEER_ADDRESS, message, sizeof(message));
+    Check(ExpectTpCm(TP_CM_RTS, data), "RTS");
+    Run(1300);
+    Check(ExpectTpCm(TP_CM_ABORT, data) && (data[1] == TP_ABORT_TIMEOUT) && !J1939TxBusy(), "abort after T3");
+}
+
+int main()
+{
+    TestAddressClaim();
+    TestBamReceive();
+    TestCmdtReceive();
+    TestCmdtSend();
+    TestCmdtSendPaced();
+    TestBadPacketCount();
+    TestBadSequence();
+    TestTimeout();
+
+    printf("j1939sim: %u failures\n", (unsigned)nFailures);
+
+    return nFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,844 @@
+/*
+ * LIN description file compiler, runs on the build host.
+ *
+ *   ldfgen input.ldf output.h
+ *
+ * Reads the node, signal, frame, sporadic and event triggered frame,
+ * diagnostic frame and schedule table sections of an LDF and writes a
+ * header of constexpr frame descriptors, signal layouts and schedule tables
+ * for the firmware. Other sections are skipped. Frames use the classic
+ * checksum for protocol versions before 2.0 and the enhanced one after,
+ * diagnostic frames always classic.
+ */
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Token {
+    enum Type { Ident, Number, String, Punct, End } eType;
+    std::string sText;
+    int nLine;
+};
+
+struct Signal {
+    std::string sName;
+    int nSize = 0;
+    uint32_t nInit = 0;
+    std::string sPublisher;
+    std::string sFrame; // Frame carrying the signal
+    int nOffset = -1;
+};
+
+// Frames behind an event triggered or sporadic frame, LIN_ASSOCIATED_MAX
+constexpr size_t kMaxAssociated = 8;
+
+struct Frame {
+    std::string sName;
+    int nId = 0;
+    std::string sPublisher;
+    int nLength = 0;
+    bool bDiagnostic = false;
+    bool bEvent = false;
+    std::vector<std::pair<std::string, int>> signals;
+    std::vector<std::string> associated; // Event triggered frames only
+    int nLine = 0;
+};
+
+// Slot that carries the first of its frames with updated data
+struct Sporadic {
+    std::string sName;
+    std::vector<std::string> associated; // By priority, highest first
+    int nLine = 0;
+};
+
+struct Slot {
+    std::string sFrame;
+    int nDelayMs;
+    int nLine;
+};
+
+struct Schedule {
+    std::string sName;
+    std::vector<Slot> slots;
+};
+
+struct Ldf {
+    std::string sProtocol;
+    int nBaudrate = 19200;
+    std::string sMaster;
+    std::vector<std::string> slaves;
+    std::vector<Signal> signals;
+    std::vector<Frame> frames;
+    std::vector<Sporadic> sporadics;
+    std::vector<Schedule> schedules;
+};
+
+std::string sFileName;
+
+[[noreturn]] void Fail(int nLine, const std::string &sMessage)
+{
+    std::fprintf(stderr, "%s:%d: error: %s\n", sFileName.c_str(), nLine, sMessage.c_str());
+    std::exit(1);
+}
+
+class Lexer {
+public:
+    explicit Lexer(const std::string &sText) : src(sText) {}
+
+    std::vector<Token> Run()
+    {
+        std::vector<Token> tokens;
+        while (true)
+        {
+            SkipSpace();
+            if (nPos >= src.size())
+                break;
+
+            const char c = src[nPos];
+            const size_t nStart = nPos;
+
+            if (std::isalpha(static_cast<unsigned char>(c)) || (c == '_'))
+            {
+                while ((nPos < src.size()) && (std::isalnum(static_cast<unsigned char>(src[nPos])) || (src[nPos] == '_')))
+                    nPos++;
+                tokens.push_back({Token::Ident, src.substr(nStart, nPos - nStart), nLine});
+            }
+            else if (std::isdigit(static_cast<unsigned char>(c)))
+            {
+                while ((nPos < src.size()) && (std::isalnum(static_cast<unsigned char>(src[nPos])) || (src[nPos] == '.')))
+                    nPos++;
+                tokens.push_back({Token::Number, src.substr(nStart, nPos - nStart), nLine});
+            }
+            else if (c == '"')
+            {
+                nPos++;
+                while ((nPos < src.size()) && (src[nPos] != '"'))
+                    nPos++;
+                if (nPos >= src.size())
+                    Fail(nLine, "unterminated string");
+                tokens.push_back({Token::String, src.substr(nStart + 1, nPos - nStart - 1), nLine});
+                nPos++;
+            }
+            else
+            {
+                tokens.push_back({Token::Punct, std::string(1, c), nLine});
+                nPos++;
+            }
+        }
+        tokens.push_back({Token::End, "", nLine});
+        return tokens;
+    }
+
+private:
+    void SkipSpace()
+    {
+        while (nPos < src.size())
+        {
+            if (src[nPos] == '\n')
+            {
+                nLine++;
+                nPos++;
+            }
+            else if (std::isspace(static_cast<unsigned char>(src[nPos])))
+            {
+                nPos++;
+            }
+            else if (src.compare(nPos, 2, "//") == 0)
+            {
+                while ((nPos < src.size()) && (src[nPos] != '\n'))
+                    nPos++;
+            }
+            else if (src.compare(nPos, 2, "/*") == 0)
+            {
+                const size_t nEnd = src.find("*/", nPos + 2);
+                if (nEnd == std::string::npos)
+                    Fail(nLine, "unterminated comment");
+                for (size_t i = nPos; i < nEnd; i++)
+                    if (src[i] == '\n')
+                        nLine++;
+                nPos = nEnd + 2;
+            }
+            else
+            {
+                break;
+            }
+        }
+    }
+
+    const std::string &src;
+    size_t nPos = 0;
+    int nLine = 1;
+};
+
+class Parser {
+public:
+    explicit Parser(std::vector<Token> t) : tokens(std::move(t)) {}
+
+    Ldf Run()
+    {
+        while (Peek().eType != Token::End)
+        {
+            const Token name = Expect(Token::Ident);
+
+            if (name.sText == "LIN_description_file")
+                Expect(";");
+            else if (name.sText == "LIN_protocol_version")
+                ldf.sProtocol = Assignment().sText;
+            else if (name.sText == "LIN_speed")
+                ParseSpeed();
+            else if (name.sText == "Nodes")
+                ParseNodes();
+            else if (name.sText == "Signals")
+                ParseSignals();
+            else if (name.sText == "Frames")
+                ParseFrames();
+            else if (name.sText == "Sporadic_frames")
+                ParseSporadicFrames();
+            else if (name.sText == "Event_triggered_frames")
+                ParseEventFrames();
+            else if (name.sText == "Diagnostic_frames")
+                ParseDiagnosticFrames();
+            else if (name.sText == "Schedule_tables")
+                ParseSchedules();
+            else
+                SkipSection();
+        }
+        return ldf;
+    }
+
+private:
+    const Token &Peek() const { return tokens[nPos]; }
+
+    Token Next()
+    {
+        const Token t = tokens[nPos];
+        if (t.eType != Token::End)
+            nPos++;
+        return t;
+    }
+
+    // Next() stays on End, skip loops would never finish there
+    void Skip()
+    {
+        if (Peek().eType == Token::End)
+            Fail(Peek().nLine, "unexpected end of file");
+        nPos++;
+    }
+
+    bool Accept(const char *sPunct)
+    {
+        if ((Peek().eType == Token::Punct) && (Peek().sText == sPunct))
+        {
+            nPos++;
+            return true;
+        }
+        return false;
+    }
+
+    void Expect(const char *sPunct)
+    {
+        if (!Accept(sPunct))
+            Fail(Peek().nLine, std::string("expected '") + sPunct + "' before '" + Peek().sText + "'");
+    }
+
+    Token Expect(Token::Type eType)
+    {
+        if (Peek().eType != eType)
+            Fail(Peek().nLine, "unexpected '" + Peek().sText + "'");
+        return Next();
+    }
+
+    long Number()
+    {
+        const Token t = Expect(Token::Number);
+        char *pEnd;
+        const long n = std::strtol(t.sText.c_str(), &pEnd, 0);
+        if (*pEnd != '\0')
+            Fail(t.nLine, "bad integer '" + t.sText + "'");
+        return n;
+    }
+
+    double Real()
+    {
+        const Token t = Expect(Token::Number);
+        return std::strtod(t.sText.c_str(), nullptr);
+    }
+
+    Token Assignment()
+    {
+        Expect("=");
+        const Token t = Next();
+        Expect(";");
+        return t;
+    }
+
+    // Unknown "name = ...;" or "name { ... }" sections
+    void SkipSection()
+    {
+        if (Accept("="))
+        {
+            while (!Accept(";"))
+                Skip();
+            return;
+        }
+
+        while (!Accept("{"))
+            Skip();
+        SkipBlock();
+    }
+
+    // After the opening brace, up to and including the matching close
+    void SkipBlock()
+    {
+        int nDepth = 1;
+        while (nDepth > 0)
+        {
+            if (Accept("{"))
+                nDepth++;
+            else if (Accept("}"))
+                nDepth--;
+            else
+                Skip();
+        }
+    }
+
+    void ParseSpeed()
+    {
+        Expect("=");
+        const double kbps = Real();
+        Expect(Token::Ident); // kbps
+        Expect(";");
+        ldf.nBaudrate = static_cast<int>(kbps * 1000.0 + 0.5);
+    }
+
+    void ParseNodes()
+    {
+        Expect("{");
+        while (!Accept("}"))
+        {
+            const Token kind = Expect(Token::Ident);
+            Expect(":");
+            if (kind.sText == "Master")
+            {
+                ldf.sMaster = Expect(Token::Ident).sText;
+                while (!Accept(";"))
+                    Skip(); // Time base and jitter
+            }
+            else if (kind.sText == "Slaves")
+            {
+                do
+                    ldf.slaves.push_back(Expect(Token::Ident).sText);
+                while (Accept(","));
+                Expect(";");
+            }
+            else
+            {
+                Fail(kind.nLine, "unknown node kind '" + kind.sText + "'");
+            }
+        }
+    }
+
+    void ParseSignals()
+    {
+        Expect("{");
+        while (!Accept("}"))
+        {
+            Signal sig;
+            const Token name = Expect(Token::Ident);
+            sig.sName = name.sText;
+            Expect(":");
+            sig.nSize = Number();
+            Expect(",");
+            if (Accept("{"))
+            {
+                // Byte array initial value, only the size is kept
+                SkipBlock();
+            }
+            else
+            {
+                sig.nInit = Number();
+            }
+            Expect(",");
+            sig.sPublisher = Expect(Token::Ident).sText;
+            while (Accept(","))
+                Expect(Token::Ident); // Subscribers
+            Expect(";");
+
+            if ((sig.nSize < 1) || (sig.nSize > 64))
+                Fail(name.nLine, "signal '" + sig.sName + "' size out of range");
+            if (FindSignal(sig.sName) != nullptr)
+                Fail(name.nLine, "signal '" + sig.sName + "' defined twice");
+
+            ldf.signals.push_back(sig);
+        }
+    }
+
+    void ParseFrames()
+    {
+        Expect("{");
+        while (!Accept("}"))
+        {
+            Frame frame;
+            const Token name = Expect(Token::Ident);
+            frame.sName = name.sText;
+            Expect(":");
+            frame.nId = Number();
+            Expect(",");
+            frame.sPublisher = Expect(Token::Ident).sText;
+            Expect(",");
+            frame.nLength = Number();
+            Expect("{");
+            while (!Accept("}"))
+            {
+                const std::string sSignal = Expect(Token::Ident).sText;
+                Expect(",");
+                const int nOffset = Number();
+                Expect(";");
+                frame.signals.push_back({sSignal, nOffset});
+            }
+
+            AddFrame(frame, name.nLine);
+        }
+    }
+
+    void ParseSporadicFrames()
+    {
+        Expect("{");
+        while (!Accept("}"))
+        {
+            Sporadic sporadic;
+            const Token name = Expect(Token::Ident);
+            sporadic.sName = name.sText;
+            sporadic.nLine = name.nLine;
+            Expect(":");
+            do
+                sporadic.associated.push_back(Expect(Token::Ident).sText);
+            while (Accept(","));
+            Expect(";");
+
+            ldf.sporadics.push_back(sporadic);
+        }
+    }
+
+    // LIN 2.0 "name: id, frames;" or 2.1 "name: table, id, frames;", the
+    // firmware resolves collisions by polling the associated frames so the
+    // collision resolving table is not used
+    void ParseEventFrames()
+    {
+        Expect("{");
+        while (!Accept("}"))
+        {
+            Frame frame;
+            const Token name = Expect(Token::Ident);
+            frame.sName = name.sText;
+            frame.bEvent = true;
+            Expect(":");
+            if (Peek().eType == Token::Ident)
+            {
+                Next();
+                Expect(",");
+            }
+            frame.nId = Number();
+            while (Accept(","))
+                frame.associated.push_back(Expect(Token::Ident).sText);
+            Expect(";");
+
+            // Length and checks once the associated frames are known
+            frame.nLength = 8;
+            AddFrame(frame, name.nLine);
+        }
+    }
+
+    void ParseDiagnosticFrames()
+    {
+        Expect("{");
+        while (!Accept("}"))
+        {
+            Frame frame;
+            const Token name = Expect(Token::Ident);
+            frame.sName = name.sText;
+            Expect(":");
+            frame.nId = Number();
+            frame.nLength = 8;
+            frame.bDiagnostic = true;
+            frame.sPublisher = (frame.nId == 0x3C) ? ldf.sMaster : "";
+            Expect("{");
+            SkipBlock();
+
+            if ((frame.nId != 0x3C) && (frame.nId != 0x3D))
+                Fail(name.nLine, "diagnostic frame '" + frame.sName + "' must use 0x3C or 0x3D");
+
+            AddFrame(frame, name.nLine);
+        }
+    }
+
+    void ParseSchedules()
+    {
+        Expect("{");
+        while (!Accept("}"))
+        {
+            Schedule schedule;
+            schedule.sName = Expect(Token::Ident).sText;
+            Expect("{");
+            while (!Accept("}"))
+            {
+                Slot slot;
+                const Token frame = Expect(Token::Ident);
+                slot.sFrame = frame.sText;
+                slot.nLine = frame.nLine;
+
+                const Token delay = Expect(Token::Ident);
+                if (delay.sText != "delay")
+                    Fail(delay.nLine, "only frame slots are supported, found '" + delay.sText + "'");
+
+                slot.nDelayMs = static_cast<int>(Real() + 0.5);
+                Expect(Token::Ident); // ms
+                Expect(";");
+                schedule.slots.push_back(slot);
+            }
+            ldf.schedules.push_back(schedule);
+        }
+    }
+
+    void AddFrame(const Frame &frame, int nLine)
+    {
+        if ((frame.nId < 0) || (frame.nId > 0x3F))
+            Fail(nLine, "frame '" + frame.sName + "' ID out of range");
+        if ((frame.nLength < 1) || (frame.nLength > 8))
+            Fail(nLine, "frame '" + frame.sName + "' length out of range");
+
+        for (const Frame &other : ldf.frames)
+        {
+            if (other.nId == frame.nId)
+                Fail(nLine, "frame '" + frame.sName + "' reuses the ID of '" + other.sName + "'");
+            if (other.sName == frame.sName)
+                Fail(nLine, "frame '" + frame.sName + "' defined twice");
+        }
+
+        ldf.frames.push_back(frame);
+        ldf.frames.back().nLine = nLine;
+    }
+
+    Signal *FindSignal(const std::string &sName)
+    {
+        for (Signal &sig : ldf.signals)
+            if (sig.sName == sName)
+                return &sig;
+        return nullptr;
+    }
+
+    std::vector<Token> tokens;
+    size_t nPos = 0;
+    Ldf ldf;
+};
+
+// Places signals in their frames and checks the references between sections
+void Resolve(Ldf &ldf)
+{
+    if (ldf.sMaster.empty())
+        Fail(1, "no master node");
+
+    for (Frame &frame : ldf.frames)
+    {
+        if (frame.bDiagnostic || frame.bEvent)
+            continue;
+
+        if ((frame.sPublisher != ldf.sMaster) &&
+            (std::find(ldf.slaves.begin(), ldf.slaves.end(), frame.sPublisher) == ldf.slaves.end()))
+            Fail(frame.nLine, "frame '" + frame.sName + "' published by unknown node '" + frame.sPublisher + "'");
+
+        uint64_t nUsedBits = 0;
+        for (const auto &[sName, nOffset] : frame.signals)
+        {
+            Signal *sig = nullptr;
+            for (Signal &s : ldf.signals)
+                if (s.sName == sName)
+                    sig = &s;
+
+            if (sig == nullptr)
+                Fail(frame.nLine, "frame '" + frame.sName + "' carries unknown signal '" + sName + "'");
+            if (!sig->sFrame.empty())
+                Fail(frame.nLine, "signal '" + sName + "' is in more than one frame");
+            if (nOffset + sig->nSize > frame.nLength * 8)
+                Fail(frame.nLine, "signal '" + sName + "' does not fit in frame '" + frame.sName + "'");
+            if (sig->sPublisher != frame.sPublisher)
+                Fail(frame.nLine, "signal '" + sName + "' is not published by the publisher of '" + frame.sName + "'");
+
+            const uint64_t nMask = ((sig->nSize == 64) ? ~0ULL : ((1ULL << sig->nSize) - 1)) << nOffset;
+            if (nUsedBits & nMask)
+                Fail(frame.nLine, "signal '" + sName + "' overlaps another signal in '" + frame.sName + "'");
+            nUsedBits |= nMask;
+
+            sig->sFrame = frame.sName;
+            sig->nOffset = nOffset;
+        }
+    }
+
+    auto findUnconditional = [&ldf](const std::string &sName) -> const Frame * {
+        for (const Frame &frame : ldf.frames)
+            if ((frame.sName == sName) && !frame.bDiagnostic && !frame.bEvent)
+                return &frame;
+        return nullptr;
+    };
+
+    // Associated frames carry the PID of the frame in their first byte
+    // and are published by slaves
+    for (Frame &frame : ldf.frames)
+    {
+        if (!frame.bEvent)
+            continue;
+
+        if (frame.associated.empty() || (frame.associated.size() > kMaxAssociated))
+            Fail(frame.nLine, "event triggered frame '" + frame.sName + "' needs 1 to 8 frames");
+
+        for (const std::string &sName : frame.associated)
+        {
+            const Frame *assoc = findUnconditional(sName);
+            if (assoc == nullptr)
+                Fail(frame.nLine, "event triggered frame '" + frame.sName + "' uses unknown frame '" + sName + "'");
+            if (assoc->sPublisher == ldf.sMaster)
+                Fail(frame.nLine, "frame '" + sName + "' of '" + frame.sName + "' is published by the master");
+            if ((sName != frame.associated[0]) && (assoc->nLength != frame.nLength))
+                Fail(frame.nLine, "frames of '" + frame.sName + "' differ in length");
+            for (const auto &[sSignal, nOffset] : assoc->signals)
+                if (nOffset < 8)
+                    Fail(frame.nLine, "signal '" + sSignal + "' uses the PID byte of '" + sName + "'");
+
+            frame.nLength = assoc->nLength;
+        }
+    }
+
+    for (const Sporadic &sporadic : ldf.sporadics)
+    {
+        if (sporadic.associated.size() > kMaxAssociated)
+            Fail(sporadic.nLine, "sporadic frame '" + sporadic.sName + "' has more than 8 frames");
+
+        for (const Frame &frame : ldf.frames)
+            if (frame.sName == sporadic.sName)
+                Fail(sporadic.nLine, "sporadic frame '" + sporadic.sName + "' reuses a frame name");
+
+        for (const std::string &sName : sporadic.associated)
+        {
+            const Frame *assoc = findUnconditional(sName);
+            if (assoc == nullptr)
+                Fail(sporadic.nLine, "sporadic frame '" + sporadic.sName + "' uses unknown frame '" + sName + "'");
+            if (assoc->sPublisher != ldf.sMaster)
+                Fail(sporadic.nLine, "frame '" + sName + "' of '" + sporadic.sName + "' is not published by the master");
+        }
+    }
+    if (ldf.sporadics.size() > 0x3F)
+        Fail(1, "too many sporadic frames");
+
+    for (const Schedule &schedule : ldf.schedules)
+    {
+        if (schedule.slots.empty())
+            Fail(1, "schedule table '" + schedule.sName + "' is empty");
+
+        for (const Slot &slot : schedule.slots)
+        {
+            bool bFound = false;
+            for (const Frame &frame : ldf.frames)
+                bFound |= (frame.sName == slot.sFrame);
+            for (const Sporadic &sporadic : ldf.sporadics)
+                bFound |= (sporadic.sName == slot.sFrame);
+            if (!bFound)
+                Fail(slot.nLine, "schedule table '" + schedule.sName + "' uses unknown frame '" + slot.sFrame + "'");
+            if ((slot.nDelayMs < 1) || (slot.nDelayMs > 0xFFFF))
+                Fail(slot.nLine, "slot delay out of range");
+        }
+    }
+}
+
+// WiperCmd -> WIPER_CMD
+std::string ToMacroName(const std::string &sName)
+{
+    std::string s;
+    for (size_t i = 0; i < sName.size(); i++)
+    {
+        const char c = sName[i];
+        if ((i > 0) && std::isupper(static_cast<unsigned char>(c)) &&
+            (std::islower(static_cast<unsigned char>(sName[i - 1])) ||
+             ((i + 1 < sName.size()) && std::islower(static_cast<unsigned char>(sName[i + 1])))) &&
+            (sName[i - 1] != '_'))
+            s += '_';
+        s += static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    }
+    return s;
+}
+
+std::string Hex(int n)
+{
+    char buf[8];
+    std::snprintf(buf, sizeof(buf), "0x%02X", n);
+    return buf;
+}
+
+const Frame &FindFrame(const Ldf &ldf, const std::string &sName)
+{
+    for (const Frame &frame : ldf.frames)
+        if (frame.sName == sName)
+            return frame;
+    std::abort();
+}
+
+// Frame ID constant, or sporadic slot constant, of a schedule entry
+std::string SlotName(const Ldf &ldf, const std::string &sName)
+{
+    for (const Sporadic &sporadic : ldf.sporadics)
+        if (sporadic.sName == sName)
+            return "LDF_SLOT_" + ToMacroName(sName);
+    return "LDF_ID_" + ToMacroName(FindFrame(ldf, sName).sName);
+}
+
+// ID list of associated frames
+std::string IdList(const std::vector<std::string> &names)
+{
+    std::string s;
+    for (const std::string &sName : names)
+        s += (s.empty() ? "LDF_ID_" : ", LDF_ID_") + ToMacroName(sName);
+    return s;
+}
+
+std::string Generate(const Ldf &ldf, const std::string &sSource)
+{
+    const bool bEnhanced = !ldf.sProtocol.empty() && (ldf.sProtocol[0] >= '2');
+    std::ostringstream out;
+
+    out << "// Generated by tools/ldfgen from " << sSource << ", do not edit\n"
+        << "#pragma once\n\n"
+        << "#include <cstdint>\n"
+        << "#include \"linframe.h\"\n"
+        << "#include \"linschedule.h\"\n\n"
+        << "#define LDF_BAUDRATE " << ldf.nBaudrate << "\n\n";
+
+    out << "// Frame IDs\n";
+    for (const Frame &frame : ldf.frames)
+        out << "constexpr uint8_t LDF_ID_" << ToMacroName(frame.sName) << " = " << Hex(frame.nId) << ";\n";
+
+    out << "\n// Frame lengths\n";
+    for (const Frame &frame : ldf.frames)
+        out << "constexpr uint8_t LDF_LENGTH_" << ToMacroName(frame.sName) << " = " << frame.nLength << ";\n";
+
+    out << "\n// Frame descriptors\n"
+        << "constexpr stLdfFrame LDF_FRAMES[] = {\n";
+    for (const Frame &frame : ldf.frames)
+    {
+        const bool bPublish = frame.sPublisher == ldf.sMaster;
+        const bool bFrameEnhanced = bEnhanced && !frame.bDiagnostic;
+        out << "    {LDF_ID_" << ToMacroName(frame.sName) << ", {" << frame.nLength
+            << (bPublish ? ", LinDirection::Publish" : ", LinDirection::Subscribe")
+            << (bFrameEnhanced ? ", LinChecksumModel::Enhanced" : ", LinChecksumModel::Classic") << "}},\n";
+    }
+    out << "};\n"
+        << "constexpr uint8_t LDF_FRAME_COUNT = " << ldf.frames.size() << ";\n";
+
+    out << "\n// Signal layouts, frame ID, bit offset, size in bits and initial value\n";
+    for (const Signal &sig : ldf.signals)
+    {
+        if (sig.sFrame.empty())
+            continue; // Not carried by any frame
+
+        out << "constexpr stLinSignal LDF_SIGNAL_" << ToMacroName(sig.sName) << " = {LDF_ID_"
+            << ToMacroName(sig.sFrame) << ", " << sig.nOffset << ", " << sig.nSize << ", " << sig.nInit << "};\n";
+    }
+
+    size_t nEvents = 0;
+    for (const Frame &frame : ldf.frames)
+        nEvents += frame.bEvent;
+
+    // Empty tables are null, the firmware only indexes them below the count
+    out << "\n// Event triggered frames, ID and associated unconditional frames\n";
+    if (nEvents == 0)
+    {
+        out << "constexpr const stLdfEventFrame *LDF_EVENT_FRAMES = nullptr;\n";
+    }
+    else
+    {
+        out << "constexpr stLdfEventFrame LDF_EVENT_FRAMES[] = {\n";
+        for (const Frame &frame : ldf.frames)
+            if (frame.bEvent)
+                out << "    {LDF_ID_" << ToMacroName(frame.sName) << ", " << frame.associated.size()
+                    << ", {" << IdList(frame.associated) << "}},\n";
+        out << "};\n";
+    }
+    out << "constexpr uint8_t LDF_EVENT_FRAME_COUNT = " << nEvents << ";\n";
+
+    out << "\n// Sporadic frames, slot constants and associated frames by priority\n";
+    for (size_t i = 0; i < ldf.sporadics.size(); i++)
+        out << "constexpr uint8_t LDF_SLOT_" << ToMacroName(ldf.sporadics[i].sName)
+            << " = LIN_SLOT_SPORADIC | " << i << ";\n";
+    if (ldf.sporadics.empty())
+    {
+        out << "constexpr const stLdfSporadicFrame *LDF_SPORADIC_FRAMES = nullptr;\n";
+    }
+    else
+    {
+        out << "constexpr stLdfSporadicFrame LDF_SPORADIC_FRAMES[] = {\n";
+        for (const Sporadic &sporadic : ldf.sporadics)
+            out << "    {" << sporadic.associated.size() << ", {" << IdList(sporadic.associated) << "}},\n";
+        out << "};\n";
+    }
+    out << "constexpr uint8_t LDF_SPORADIC_FRAME_COUNT = " << ldf.sporadics.size() << ";\n";
+
+    for (const Schedule &schedule : ldf.schedules)
+    {
+        const std::string sMacro = ToMacroName(schedule.sName);
+        out << "\n// Schedule table " << schedule.sName << "\n"
+            << "constexpr stLinSlot LDF_SCHEDULE_" << sMacro << "[] = {\n";
+        for (const Slot &slot : schedule.slots)
+            out << "    {" << SlotName(ldf, slot.sFrame) << ", " << slot.nDelayMs << "},\n";
+        out << "};\n"
+            << "constexpr uint8_t LDF_SCHEDULE_" << sMacro << "_COUNT = " << schedule.slots.size() << ";\n";
+    }
+
+    return out.str();
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        std::fprintf(stderr, "usage: %s input.ldf output.h\n", argv[0]);
+        return 2;
+    }
+
+    sFileName = argv[1];
+    std::ifstream in(sFileName);
+    if (!in)
+    {
+        std::fprintf(stderr, "%s: cannot open\n", sFileName.c_str());
+        return 1;
+    }
+
+    std::stringstream text;
+    text << in.rdbuf();
+    const std::string sText = text.str();
+
+    Lexer lexer(sText);
+    Parser parser(lexer.Run());
+    Ldf ldf = parser.Run();
+    Resolve(ldf);
+
+    // Source name without directories, keeps the output reproducible
+    const std::string sSource = sFileName.substr(sFileName.find_last_of('/') + 1);
+
+    std::ofstream out(argv[2]);
+    out << Generate(ldf, sSource);
+    if (!out)
+    {
+        std::fprintf(stderr, "%s: cannot write\n", argv[2]);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,331 @@
+#include "ttcan.h"
+
+#include <cstring>
+
+// Mailbox register index and TSR bits of the reserved mailbox
+#define MB (TTCAN_MAILBOX - 1)
+#define TSR_TME CAN_TSR_TME2
+#define TSR_ABRQ CAN_TSR_ABRQ2
+
+typedef struct {
+    stTtcanSlot cfg;
+    uint8_t data[8];
+} stSlotEntry;
+
+typedef struct {
+    stTtcanSlotStats stats;
+    uint16_t nLastStamp;
+    bool bHaveStamp;
+} stSlotRuntime;
+
+static stSlotEntry slots[TTCAN_SLOTS];
+static stSlotRuntime runtime[TTCAN_SLOTS];
+
+// Enabled slots sorted by offset, built at start
+static uint8_t order[TTCAN_SLOTS];
+static uint8_t nOrderCount;
+
+static volatile TtcanMode eMode = TtcanMode::Off;
+static uint16_t nCycleTicks;
+static uint32_t nRefId;
+
+static uint16_t nTick;
+static uint8_t nCycle;
+static uint8_t nNextPos;   // Next entry of order[] in this cycle
+static int8_t nLoaded = -1; // Slot sitting in the mailbox without TXRQ
+static int8_t nActive = -1; // Slot requested and inside its window
+static uint16_t nActiveEnd;
+static int8_t nLastFired = -1;
+
+static void TtcanTickCb(GPTDriver *);
+
+static const GPTConfig gptConfig = {
+    .frequency = 1000000U,
+    .callback = TtcanTickCb,
+    .cr2 = 0,
+    .dier = 0
+};
+
+static bool FiresThisCycle(const stTtcanSlot *slot)
+{
+    return (nCycle & (slot->nRepeat - 1)) == 0;
+}
+
+// Writes ID and data so the window start only has to set TXRQ
+static void PreloadI(uint8_t nSlot)
+{
+    CAN_TxMailBox_TypeDef *mb = &CAND1.can->sTxMailBox[MB];
+    const stSlotEntry *s = &slots[nSlot];
+
+    if (s->cfg.bExtended)
+        mb->TIR = (s->cfg.nId << 3) | CAN_TI0R_IDE;
+    else
+        mb->TIR = s->cfg.nId << 21;
+    mb->TDTR = s->cfg.nDlc;
+    mb->TDLR = s->data[0] | (s->data[1] << 8) | (s->data[2] << 16) | ((uint32_t)s->data[3] << 24);
+    mb->TDHR = s->data[4] | (s->data[5] << 8) | (s->data[6] << 16) | ((uint32_t)s->data[7] << 24);
+}
+
+// Next slot of this cycle whose window has not started yet, windows
+// already passed are counted as missed
+static int8_t NextSlotI()
+{
+    while (nNextPos < nOrderCount)
+    {
+        const uint8_t s = order[nNextPos];
+
+        if (!FiresThisCycle(&slots[s].cfg))
+        {
+            nNextPos++;
+            continue;
+        }
+
+        if (slots[s].cfg.nOffset < nTick)
+        {
+            runtime[s].stats.nMissed++;
+            runtime[s].bHaveStamp = false;
+            nNextPos++;
+            continue;
+        }
+
+        return s;
+    }
+    return -1;
+}
+
+static void TtcanTickCb(GPTDriver *)
+{
+    CAN_TypeDef *can = CAND1.can;
+
+    osalSysLockFromISR();
+
+    if (++nTick >= nCycleTicks)
+    {
+        nTick = 0;
+        nCycle++;
+        nNextPos = 0;
+    }
+
+    // Window end, whatever has not gone yet is pulled back
+    if ((nActive >= 0) && (nTick == nActiveEnd))
+    {
+        if (!(can->TSR & TSR_TME))
+        {
+            can->TSR = TSR_ABRQ;
+            runtime[nActive].stats.nLate++;
+            runtime[nActive].bHaveStamp = false;
+        }
+        nActive = -1;
+    }
+
+    if ((nLoaded < 0) && (can->TSR & TSR_TME))
+    {
+        nLoaded = NextSlotI();
+        if (nLoaded >= 0)
+            PreloadI(nLoaded);
+    }
+
+    if ((nLoaded >= 0) && (slots[nLoaded].cfg.nOffset == nTick))
+    {
+        can->sTxMailBox[MB].TIR |= CAN_TI0R_TXRQ;
+
+        nActive = nLoaded;
+        nActiveEnd = (nTick + slots[nLoaded].cfg.nWindow) % nCycleTicks;
+        nLastFired = nLoaded;
+        nLoaded = -1;
+        nNextPos++;
+    }
+
+    osalSysUnlockFromISR();
+}
+
+void InitTtcan(void)
+{
+    for (uint8_t i = 0; i < TTCAN_SLOTS; i++)
+    {
+        slots[i] = {};
+        runtime[i] = {};
+    }
+}
+
+bool TtcanSetSlot(uint8_t nSlot, const stTtcanSlot *slot)
+{
+    if ((nSlot >= TTCAN_SLOTS) || (eMode != TtcanMode::Off))
+        return false;
+
+    // Timing is only checked once enabled, so a slot can be set up in parts
+    if ((slot->nDlc > 8) || (slot->bEnabled && ((slot->nWindow == 0) ||
+        (slot->nRepeat == 0) || (slot->nRepeat & (slot->nRepeat - 1)))))
+        return false;
+
+    slots[nSlot].cfg = *slot;
+    return true;
+}
+
+bool TtcanGetSlot(uint8_t nSlot, stTtcanSlot *slot)
+{
+    if (nSlot >= TTCAN_SLOTS)
+        return false;
+
+    *slot = slots[nSlot].cfg;
+    return true;
+}
+
+// Takes effect the next time the slot is loaded into the mailbox
+bool TtcanSetSlotData(uint8_t nSlot, uint8_t nOffset, const uint8_t *data, uint8_t nLength)
+{
+    if ((nSlot >= TTCAN_SLOTS) || (nOffset + nLength > 8))
+        return false;
+
+    chSysLock();
+    memcpy(&slots[nSlot].data[nOffset], data, nLength);
+    chSysUnlock();
+
+    return true;
+}
+
+bool TtcanStart(TtcanMode eNewMode, uint16_t nNewCycleTicks, uint32_t nNewRefId)
+{
+    if ((eNewMode == TtcanMode::Off) || (nNewCycleTicks == 0))
+        return false;
+
+    TtcanStop();
+
+    // Insertion sort of the enabled slots by window start
+    nOrderCount = 0;
+    for (uint8_t i = 0; i < TTCAN_SLOTS; i++)
+    {
+        if (!slots[i].cfg.bEnabled)
+            continue;
+
+        if (slots[i].cfg.nOffset + slots[i].cfg.nWindow > nNewCycleTicks)
+            return false;
+
+        uint8_t j = nOrderCount++;
+        while ((j > 0) && (slots[order[j - 1]].cfg.nOffset > slots[i].cfg.nOffset))
+        {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    // Overlapping windows would share the mailbox
+    for (uint8_t i = 1; i < nOrderCount; i++)
+    {
+        const stTtcanSlot *prev = &slots[order[i - 1]].cfg;
+        if (prev->nOffset + prev->nWindow > slots[order[i]].cfg.nOffset)
+            return false;
+    }
+
+    for (uint8_t i = 0; i < TTCAN_SLOTS; i++)
+        runtime[i] = {};
+
+    nCycleTicks = nNewCycleTicks;
+    nRefId = nNewRefId;
+    nTick = nCycleTicks - 1;
+    nCycle = 0xFF;
+    nNextPos = 0;
+    nLoaded = -1;
+    nActive = -1;
+    nLastFired = -1;
+
+    eMode = eNewMode;
+
+    gptStart(&GPTD6, &gptConfig);
+    gptStartContinuous(&GPTD6, TTCAN_TICK_US);
+
+    return true;
+}
+
+void TtcanStop(void)
+{
+    if (eMode == TtcanMode::Off)
+        return;
+
+    gptStopTimer(&GPTD6);
+    gptStop(&GPTD6);
+
+    chSysLock();
+    CAND1.can->TSR = TSR_ABRQ;
+    eMode = TtcanMode::Off;
+    chSysUnlock();
+}
+
+bool TtcanIsActive(void)
+{
+    return eMode != TtcanMode::Off;
+}
+
+// Called from the CAN RX interrupt for every frame, the end of the
+// reference message is the start of the cycle. The first data byte
+// carries the master's cycle count so repeat slots line up across nodes.
+void TtcanReferenceI(const CANRxFrame *frame)
+{
+    if (eMode != TtcanMode::Reference)
+        return;
+
+    const uint32_t nId = (frame->IDE == CAN_IDE_EXT) ? frame->EID : frame->SID;
+    if (nId != nRefId)
+        return;
+
+    gptStopTimerI(&GPTD6);
+    gptStartContinuousI(&GPTD6, TTCAN_TICK_US);
+
+    nTick = 0;
+    nCycle = (frame->DLC > 0) ? frame->data8[0] : nCycle + 1;
+    nNextPos = 0;
+
+    // A slot preloaded for the old cycle is picked again from the new one
+    nLoaded = -1;
+}
+
+// Called from the CAN TX interrupt with the driver flags, the SOF
+// timestamp of each sent frame gives the real period of its slot
+void TtcanCompleteI(uint32_t nFlags)
+{
+    const uint32_t nMask = CAN_MAILBOX_TO_MASK(TTCAN_MAILBOX);
+
+    if ((eMode == TtcanMode::Off) || (nLastFired < 0))
+        return;
+
+    if (nFlags & (nMask << 16))
+    {
+        runtime[nLastFired].bHaveStamp = false;
+        nLastFired = -1;
+        return;
+    }
+
+    if (!(nFlags & nMask))
+        return;
+
+    stSlotRuntime *r = &runtime[nLastFired];
+    const uint16_t nStamp = CAND1.can->sTxMailBox[MB].TDTR >> CAN_TDT0R_TIME_Pos;
+
+    r->stats.nSent++;
+
+    if (r->bHaveStamp)
+    {
+        const uint16_t nPeriod = nStamp - r->nLastStamp;
+        if ((r->stats.nMinPeriod == 0) || (nPeriod < r->stats.nMinPeriod))
+            r->stats.nMinPeriod = nPeriod;
+        if (nPeriod > r->stats.nMaxPeriod)
+            r->stats.nMaxPeriod = nPeriod;
+    }
+    r->nLastStamp = nStamp;
+    r->bHaveStamp = true;
+
+    nLastFired = -1;
+}
+
+bool GetTtcanSlotStats(uint8_t nSlot, stTtcanSlotStats *stats)
+{
+    if (nSlot >= TTCAN_SLOTS)
+        return false;
+
+    chSysLock();
+    *stats = runtime[nSlot].stats;
+    chSysUnlock();
+
+    return true;
+}
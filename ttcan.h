@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include "hal.h"
+
+// Schedule resolution, slot offsets and windows are in ticks of this length
+#define TTCAN_TICK_US 100
+#define TTCAN_SLOTS 16
+
+// Hardware mailbox (1 to CAN_TX_MAILBOXES) reserved for scheduled frames
+#define TTCAN_MAILBOX 3
+
+enum class TtcanMode : uint8_t
+{
+    Off,
+    Local,     // Cycle runs from the local timer
+    Reference  // Cycle restarts at the end of every reference message
+};
+
+typedef struct {
+    bool bEnabled;
+    uint32_t nId;
+    bool bExtended;
+    uint8_t nDlc;
+    uint16_t nOffset;  // Window start, ticks from cycle start
+    uint16_t nWindow;  // Window length in ticks, the frame is aborted if it has not gone by then
+    uint8_t nRepeat;   // Sent every nRepeat cycles, power of two
+} stTtcanSlot;
+
+typedef struct {
+    uint32_t nSent;
+    uint32_t nLate;    // Aborted at window end
+    uint32_t nMissed;  // Window passed with the mailbox still busy
+    uint16_t nMinPeriod; // Between consecutive SOF timestamps, in bit times
+    uint16_t nMaxPeriod;
+} stTtcanSlotStats;
+
+void InitTtcan(void);
+bool TtcanSetSlot(uint8_t nSlot, const stTtcanSlot *slot);
+bool TtcanGetSlot(uint8_t nSlot, stTtcanSlot *slot);
+bool TtcanSetSlotData(uint8_t nSlot, uint8_t nOffset, const uint8_t *data, uint8_t nLength);
+bool TtcanStart(TtcanMode eMode, uint16_t nCycleTicks, uint32_t nRefId = 0);
+void TtcanStop(void);
+bool TtcanIsActive(void);
+void TtcanReferenceI(const CANRxFrame *frame);
+void TtcanCompleteI(uint32_t nFlags);
+bool GetTtcanSlotStats(uint8_t nSlot, stTtcanSlotStats *stats);
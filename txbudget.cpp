@@ -0,0 +1,196 @@
+#include "txbudget.h"
+#include "mailbox.h"
+#include "port.h"
+#include "linboard_config.h"
+
+// Token buckets are refilled from the cycle counter, cap the elapsed time so
+// a stalled caller cannot overflow the arithmetic below
+#define MAX_REFILL_US 1000000
+
+// Longest possible frame, extended ID with 8 data bytes and worst case stuffing
+#define MAX_FRAME_BITS 160
+
+static stTxClassBudget budgets[CAN_TX_CLASS_COUNT] = {
+    // Control
+    {.nFramesPerSec = 2000, .nBurstFrames = 32, .nSharePct = 15, .bShed = false},
+    // Gateway
+    {.nFramesPerSec = 1000, .nBurstFrames = 16, .nSharePct = 10, .bShed = false},
+    // Telemetry
+    {.nFramesPerSec = 200, .nBurstFrames = 8, .nSharePct = 4, .bShed = true},
+    // Debug
+    {.nFramesPerSec = 50, .nBurstFrames = 4, .nSharePct = 1, .bShed = true},
+    // Daq, a 1ms DAQ list with one ODT is 1000 frames/s and 27% of 500k,
+    // the burst covers all 16 ODTs XCP allows on one event
+    {.nFramesPerSec = 2000, .nBurstFrames = 16, .nSharePct = 30, .bShed = true}
+};
+
+static stTxClassStats stats[CAN_TX_CLASS_COUNT];
+
+// Frame tokens are kept in 1/1000 of a frame so slow rates still accumulate
+static uint32_t nFrameTokens[CAN_TX_CLASS_COUNT];
+static uint32_t nBitTokens[CAN_TX_CLASS_COUNT];
+static uint32_t nBusBitTokens;
+
+static uint8_t nBusBudgetPct = CAN_TX_BUS_BUDGET_PCT;
+static uint32_t nBitrate;
+static rtcnt_t nLastRefill;
+
+static uint32_t BitrateFromEnum(CanBitrate eBitrate)
+{
+    switch (eBitrate)
+    {
+    case CanBitrate::Bitrate_1000K:
+        return 1000000;
+    case CanBitrate::Bitrate_500K:
+        return 500000;
+    case CanBitrate::Bitrate_250K:
+        return 250000;
+    case CanBitrate::Bitrate_125K:
+        return 125000;
+    default:
+        return 500000;
+    }
+}
+
+static uint32_t BitRate(uint8_t nPct)
+{
+    return (nBitrate / 100) * nPct;
+}
+
+static uint32_t BitDepth(uint8_t nPct)
+{
+    uint32_t nDepth = (BitRate(nPct) / 1000) * CAN_TX_BUDGET_BURST_MS;
+
+    // Low shares must still be able to hold one whole frame
+    return nDepth < MAX_FRAME_BITS ? MAX_FRAME_BITS : nDepth;
+}
+
+static uint32_t Refill(uint32_t nTokens, uint32_t nRate, uint32_t nElapsedUs, uint32_t nDepth)
+{
+    // Rate is per second, elapsed time in us
+    uint64_t nNew = nTokens + ((uint64_t)nRate * nElapsedUs) / 1000000;
+    return nNew > nDepth ? nDepth : (uint32_t)nNew;
+}
+
+void TxBudgetRefill(void)
+{
+    rtcnt_t nNow = chSysGetRealtimeCounterX();
+    uint32_t nElapsedUs = (nNow - nLastRefill) / RT_TICKS_PER_US;
+    if (nElapsedUs == 0)
+        return;
+
+    // Only advance by the time actually converted to tokens
+    nLastRefill += nElapsedUs * RT_TICKS_PER_US;
+
+    if (nElapsedUs > MAX_REFILL_US)
+        nElapsedUs = MAX_REFILL_US;
+
+    for (uint8_t c = 0; c < CAN_TX_CLASS_COUNT; c++)
+    {
+        nFrameTokens[c] = Refill(nFrameTokens[c], budgets[c].nFramesPerSec * 1000U, nElapsedUs,
+                                 budgets[c].nBurstFrames * 1000U);
+        nBitTokens[c] = Refill(nBitTokens[c], BitRate(budgets[c].nSharePct), nElapsedUs,
+                               BitDepth(budgets[c].nSharePct));
+    }
+
+    nBusBitTokens = Refill(nBusBitTokens, BitRate(nBusBudgetPct), nElapsedUs, BitDepth(nBusBudgetPct));
+}
+
+void InitTxBudget(CanBitrate eBitrate)
+{
+    nBitrate = BitrateFromEnum(eBitrate);
+
+    // Start with full buckets so the first burst after boot is not delayed
+    for (uint8_t c = 0; c < CAN_TX_CLASS_COUNT; c++)
+    {
+        nFrameTokens[c] = budgets[c].nBurstFrames * 1000U;
+        nBitTokens[c] = BitDepth(budgets[c].nSharePct);
+    }
+    nBusBitTokens = BitDepth(nBusBudgetPct);
+
+    nLastRefill = chSysGetRealtimeCounterX();
+}
+
+// Worst case length including stuff bits, interframe space and ACK
+uint32_t CanFrameBits(const CANTxFrame *frame)
+{
+    uint32_t nDataBits = (frame->RTR == CAN_RTR_REMOTE) ? 0 : 8U * frame->DLC;
+
+    if (frame->IDE == CAN_IDE_EXT)
+        return nDataBits + 67 + (54 + nDataBits - 1) / 4;
+
+    return nDataBits + 47 + (34 + nDataBits - 1) / 4;
+}
+
+bool TxBudgetAvailable(CanTxClass eClass, uint32_t nBits)
+{
+    const uint8_t c = static_cast<uint8_t>(eClass);
+
+    return (nFrameTokens[c] >= 1000U) &&
+           (nBitTokens[c] >= nBits) &&
+           (nBusBitTokens >= nBits);
+}
+
+void TxBudgetConsume(CanTxClass eClass, uint32_t nBits)
+{
+    const uint8_t c = static_cast<uint8_t>(eClass);
+
+    nFrameTokens[c] = nFrameTokens[c] >= 1000U ? nFrameTokens[c] - 1000U : 0;
+    nBitTokens[c] = nBitTokens[c] >= nBits ? nBitTokens[c] - nBits : 0;
+    nBusBitTokens = nBusBitTokens >= nBits ? nBusBitTokens - nBits : 0;
+
+    stats[c].nSent++;
+}
+
+void TxBudgetCountDeferred(CanTxClass eClass)
+{
+    stats[static_cast<uint8_t>(eClass)].nDeferred++;
+}
+
+void TxBudgetCountShed(CanTxClass eClass)
+{
+    stats[static_cast<uint8_t>(eClass)].nShed++;
+}
+
+void SetTxClassBudget(CanTxClass eClass, const stTxClassBudget *budget)
+{
+    const uint8_t c = static_cast<uint8_t>(eClass);
+
+    budgets[c] = *budget;
+
+    // Don't let a lowered limit keep tokens from the old one
+    if (nFrameTokens[c] > budgets[c].nBurstFrames * 1000U)
+        nFrameTokens[c] = budgets[c].nBurstFrames * 1000U;
+    if (nBitTokens[c] > BitDepth(budgets[c].nSharePct))
+        nBitTokens[c] = BitDepth(budgets[c].nSharePct);
+}
+
+void GetTxClassBudget(CanTxClass eClass, stTxClassBudget *budget)
+{
+    *budget = budgets[static_cast<uint8_t>(eClass)];
+}
+
+void SetTxBusBudget(uint8_t nPct)
+{
+    if (nPct > 100)
+        nPct = 100;
+
+    nBusBudgetPct = nPct;
+
+    if (nBusBitTokens > BitDepth(nBusBudgetPct))
+        nBusBitTokens = BitDepth(nBusBudgetPct);
+}
+
+uint8_t GetTxBusBudget(void)
+{
+    return nBusBudgetPct;
+}
+
+void GetTxClassStats(CanTxClass eClass, stTxClassStats *classStats)
+{
+    const uint8_t c = static_cast<uint8_t>(eClass);
+
+    *classStats = stats[c];
+    // Queue overflows are counted where the frame is posted
+    classStats->nShed += GetTxShedCount(eClass);
+}
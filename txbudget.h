@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include "hal.h"
+#include "enums.h"
+
+typedef struct {
+    uint16_t nFramesPerSec; // Token rate, frames per second
+    uint16_t nBurstFrames;  // Bucket depth, frames
+    uint8_t nSharePct;      // Cap on share of the bus bitrate
+    bool bShed;             // Drop frames instead of deferring them when over budget
+} stTxClassBudget;
+
+typedef struct {
+    uint32_t nSent;
+    uint32_t nDeferred; // Frames held in the queue at least once for lack of tokens
+    uint32_t nShed;     // Frames dropped, over budget or queue full
+} stTxClassStats;
+
+void InitTxBudget(CanBitrate eBitrate);
+uint32_t CanFrameBits(const CANTxFrame *frame);
+void TxBudgetRefill(void);
+bool TxBudgetAvailable(CanTxClass eClass, uint32_t nBits);
+void TxBudgetConsume(CanTxClass eClass, uint32_t nBits);
+void TxBudgetCountDeferred(CanTxClass eClass);
+void TxBudgetCountShed(CanTxClass eClass);
+void SetTxClassBudget(CanTxClass eClass, const stTxClassBudget *budget);
+void GetTxClassBudget(CanTxClass eClass, stTxClassBudget *budget);
+void SetTxBusBudget(uint8_t nPct);
+uint8_t GetTxBusBudget(void);
+void GetTxClassStats(CanTxClass eClass, stTxClassStats *stats);
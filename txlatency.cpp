@@ -0,0 +1,158 @@
+#include "txlatency.h"
+#include "port.h"
+#include "linboard_config.h"
+
+// Latency of bucket 0 upper bound, as a power of two in us
+#define FIRST_BUCKET_SHIFT 6
+
+typedef struct {
+    bool bPending;
+    bool bArbLost;
+    int8_t nIdIndex;    // -1 when the ID is not tracked individually
+    uint8_t nClass;
+    rtcnt_t nEnqueueTime;
+} stTxPending;
+
+static stTxLatency idLatency[TX_LATENCY_IDS];
+static uint8_t nIdCount;
+static stTxLatency classLatency[CAN_TX_CLASS_COUNT];
+
+// Indexed by hardware mailbox, 0 to CAN_TX_MAILBOXES - 1
+static stTxPending pending[CAN_TX_MAILBOXES];
+
+static const uint32_t nAlstMask[CAN_TX_MAILBOXES] = {CAN_TSR_ALST0, CAN_TSR_ALST1, CAN_TSR_ALST2};
+
+static int8_t FindOrAddId(uint32_t nId)
+{
+    for (uint8_t i = 0; i < nIdCount; i++)
+    {
+        if (idLatency[i].nId == nId)
+            return i;
+    }
+
+    if (nIdCount >= TX_LATENCY_IDS)
+        return -1;
+
+    idLatency[nIdCount].nId = nId;
+    return nIdCount++;
+}
+
+static uint8_t BucketIndex(uint32_t nUs)
+{
+    // Position of the highest set bit picks the power of two bucket
+    uint32_t nScaled = nUs >> FIRST_BUCKET_SHIFT;
+    if (nScaled == 0)
+        return 0;
+
+    uint8_t nBucket = 32 - __builtin_clz(nScaled);
+    return nBucket >= TX_LATENCY_BUCKETS ? TX_LATENCY_BUCKETS - 1 : nBucket;
+}
+
+static void Record(stTxLatency *latency, uint32_t nUs, bool bArbLost)
+{
+    latency->nCount++;
+    latency->nBuckets[BucketIndex(nUs)]++;
+    if (nUs > latency->nMaxUs)
+        latency->nMaxUs = nUs;
+    if (bArbLost)
+        latency->nArbLost++;
+}
+
+void InitTxLatency(void)
+{
+    nIdCount = 0;
+
+    for (uint8_t i = 0; i < TX_LATENCY_IDS; i++)
+        idLatency[i] = {};
+    for (uint8_t i = 0; i < CAN_TX_CLASS_COUNT; i++)
+        classLatency[i] = {};
+    for (uint8_t i = 0; i < CAN_TX_MAILBOXES; i++)
+        pending[i] = {};
+}
+
+// Must be called before the frame is handed to the mailbox, the ACK
+// interrupt can fire before canTransmitTimeout() returns
+void TxLatencyLoad(uint8_t nMailbox, const CANTxFrame *frame, CanTxClass eClass, rtcnt_t nEnqueueTime)
+{
+    stTxPending *p = &pending[nMailbox - 1];
+
+    p->nIdIndex = FindOrAddId(frame->IDE == CAN_IDE_EXT ? frame->EID : frame->SID);
+    p->nClass = static_cast<uint8_t>(eClass);
+    p->nEnqueueTime = nEnqueueTime;
+    p->bArbLost = false;
+    p->bPending = true;
+}
+
+void TxLatencyCancel(uint8_t nMailbox)
+{
+    pending[nMailbox - 1].bPending = false;
+}
+
+// With automatic retransmission the ACK interrupt only reports the final
+// attempt, so arbitration losses are sampled while the frame is pending
+void TxLatencyPoll(void)
+{
+    uint32_t nTsr = CAND1.can->TSR;
+
+    for (uint8_t i = 0; i < CAN_TX_MAILBOXES; i++)
+    {
+        if (pending[i].bPending && (nTsr & nAlstMask[i]))
+            pending[i].bArbLost = true;
+    }
+}
+
+// Called from the CAN TX interrupt, low 16 bits of nFlags flag mailboxes
+// that completed, high 16 bits those that were aborted or failed
+void TxLatencyCompleteI(uint32_t nFlags)
+{
+    rtcnt_t nNow = chSysGetRealtimeCounterX();
+
+    for (uint8_t i = 0; i < CAN_TX_MAILBOXES; i++)
+    {
+        stTxPending *p = &pending[i];
+        if (!p->bPending)
+            continue;
+
+        const uint32_t nMask = CAN_MAILBOX_TO_MASK(i + 1U);
+
+        if (nFlags & (nMask << 16))
+        {
+            classLatency[p->nClass].nFailed++;
+            if (p->nIdIndex >= 0)
+                idLatency[p->nIdIndex].nFailed++;
+            p->bPending = false;
+        }
+        else if (nFlags & nMask)
+        {
+            uint32_t nUs = (nNow - p->nEnqueueTime) / RT_TICKS_PER_US;
+
+            Record(&classLatency[p->nClass], nUs, p->bArbLost);
+            if (p->nIdIndex >= 0)
+                Record(&idLatency[p->nIdIndex], nUs, p->bArbLost);
+            p->bPending = false;
+        }
+    }
+}
+
+uint8_t GetTxLatencyIdCount(void)
+{
+    return nIdCount;
+}
+
+bool GetTxLatencyById(uint8_t nIndex, stTxLatency *latency)
+{
+    if (nIndex >= nIdCount)
+        return false;
+
+    chSysLock();
+    *latency = idLatency[nIndex];
+    chSysUnlock();
+    return true;
+}
+
+void GetTxLatencyByClass(CanTxClass eClass, stTxLatency *latency)
+{
+    chSysLock();
+    *latency = classLatency[static_cast<uint8_t>(eClass)];
+    chSysUnlock();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include "hal.h"
+#include "enums.h"
+
+// Bucket 0 is below 64us, each following bucket doubles, the last one
+// collects everything from 65.5ms up
+#define TX_LATENCY_BUCKETS 12
+// Number of IDs tracked individually, further IDs only count per class
+#define TX_LATENCY_IDS 16
+
+typedef struct {
+    uint32_t nId;
+    uint32_t nCount;    // Frames acknowledged
+    uint32_t nArbLost;  // Frames seen losing arbitration at least once
+    uint32_t nFailed;   // Frames aborted or in error
+    uint32_t nMaxUs;    // Longest enqueue to ACK time
+    uint32_t nBuckets[TX_LATENCY_BUCKETS];
+} stTxLatency;
+
+void InitTxLatency(void);
+void TxLatencyLoad(uint8_t nMailbox, const CANTxFrame *frame, CanTxClass eClass, rtcnt_t nEnqueueTime);
+void TxLatencyCancel(uint8_t nMailbox);
+void TxLatencyPoll(void);
+void TxLatencyCompleteI(uint32_t nFlags);
+uint8_t GetTxLatencyIdCount(void);
+bool GetTxLatencyById(uint8_t nIndex, stTxLatency *latency);
+void GetTxLatencyByClass(CanTxClass eClass, stTxLatency *latency);
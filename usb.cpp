@@ -3,6 +3,11 @@
 #include "port.h"
 #include "mailbox.h"
 #include "linboard_config.h"
+#include "analyzer.h"
+#include "sniffer.h"
+#include "can.h"
+#include "lin.h"
+#include "linmonitor.h"
 
 /*
  * Virtual serial port over USB.
@@ -397,6 +402,321 @@ const SerialUSBConfig serusbcfg = {
   USB_INTERRUPT_REQUEST_EP_A
 };
 
+// Both USB threads write to SDU1, keep their lines from interleaving
+static mutex_t usbWriteMtx;
+
+static stUsbFilter usbFilters[USB_FILTER_COUNT];
+static uint8_t nUsbFiltersEnabled;
+
+static bool UsbFilterPass(const CANTxFrame *frame)
+{
+    if (nUsbFiltersEnabled == 0)
+        return true;
+
+    const uint32_t nKey = (frame->IDE == CAN_IDE_EXT) ? (frame->EID | 0x80000000) : frame->SID;
+
+    for (uint8_t i = 0; i < USB_FILTER_COUNT; i++)
+    {
+        if (usbFilters[i].bEnabled && (((nKey ^ usbFilters[i].nId) & usbFilters[i].nMask) == 0))
+            return true;
+    }
+    return false;
+}
+
+// Fits a last value query for 15 IDs
+#define USB_LINE_SIZE 128
+#define USB_QUERY_MAX_IDS ((USB_LINE_SIZE - 1) / 8)
+#define USB_WRITE_TIMEOUT chTimeMS2I(10)
+// Longest a host frame waits for room in the CAN TX queue before it is refused
+#define USB_CAN_TX_TIMEOUT chTimeMS2I(100)
+
+static size_t UsbWrite(const uint8_t *data, size_t nLength, sysinterval_t timeout)
+{
+    chMtxLock(&usbWriteMtx);
+    size_t nWritten = chnWriteTimeout(&SDU1, data, nLength, timeout);
+    chMtxUnlock(&usbWriteMtx);
+
+    return nWritten;
+}
+
+// Write nDigits upper case hex characters, most significant first
+static uint8_t *PutHex(uint8_t *buf, uint32_t nValue, uint8_t nDigits)
+{
+    for (int8_t i = nDigits - 1; i >= 0; i--)
+    {
+        uint8_t nNibble = (nValue >> (i * 4)) & 0xF;
+        *buf++ = nNibble < 0xA ? nNibble + 0x30 : nNibble + 0x37;
+    }
+    return buf;
+}
+
+// Parse nDigits hex characters, returns false on a non hex character
+static bool GetHex(const uint8_t *buf, uint8_t nDigits, uint32_t *pValue)
+{
+    uint32_t nValue = 0;
+    for (uint8_t i = 0; i < nDigits; i++)
+    {
+        uint8_t c = buf[i];
+        if (c >= '0' && c <= '9')
+            c -= 0x30;
+        else if (c >= 'A' && c <= 'F')
+            c -= 0x37;
+        else if (c >= 'a' && c <= 'f')
+            c -= 0x57;
+        else
+            return false;
+        nValue = (nValue << 4) | c;
+    }
+    *pValue = nValue;
+    return true;
+}
+
+/*
+ * Analyzer dump, one line per observed ID:
+ * 'a' IIIIIIII L DDDDDDDDDDDDDDDD CCCCCCCC PPPPPPPP JJJJJJJJ '\r'
+ * ID (bit 31 = extended), DLC, last payload, frame count, mean period (us)
+ * and period jitter (us). Ends with 'A' NNNN OOOOOOOO '\r', the number of
+ * IDs and the frames of IDs that did not fit in the table.
+ */
+static void UsbDumpAnalyzer()
+{
+    stAnalyzerEntry entry;
+    uint8_t nLine[USB_LINE_SIZE];
+
+    for (uint16_t i = 0; i < ANALYZER_SIZE; i++)
+    {
+        if (!GetAnalyzerEntry(i, &entry))
+            continue;
+
+        uint8_t *p = nLine;
+        *p++ = 'a';
+        p = PutHex(p, entry.nId, 8);
+        p = PutHex(p, entry.nDlc, 1);
+        for (uint8_t j = 0; j < 8; j++)
+            p = PutHex(p, entry.nData[j], 2);
+        p = PutHex(p, entry.nCount, 8);
+        p = PutHex(p, entry.nMeanPeriodUs, 8);
+        p = PutHex(p, entry.nJitterUs, 8);
+        *p++ = '\r';
+
+        UsbWrite(nLine, p - nLine, USB_WRITE_TIMEOUT);
+    }
+
+    uint8_t *p = nLine;
+    *p++ = 'A';
+    p = PutHex(p, GetAnalyzerIdCount(), 4);
+    p = PutHex(p, GetAnalyzerOverflow(), 8);
+    *p++ = '\r';
+    UsbWrite(nLine, p - nLine, USB_WRITE_TIMEOUT);
+}
+
+/*
+ * 'L' switches CAN to listen only and USB to the binary sniffer stream
+ * described in sniffer.h, 'l' back to normal operation.
+ * 'M' puts LIN into monitor mode, frames are sent as described in
+ * linmonitor.h, 'm' returns to LIN master.
+ */
+
+/*
+ * Last value query, 'Q' followed by up to USB_QUERY_MAX_IDS IDs of 8 hex
+ * characters each (bit 31 = extended). All replies go out in one write:
+ * 'q' IIIIIIII L DDDDDDDDDDDDDDDD TTTTTTTT '\r' per ID, with the SYS_TIME
+ * of reception in ms, or 'q' IIIIIIII '\r' if the ID hasn't been seen.
+ * Remote frames don't change the value. The values are kept in the
+ * analyzer table, so 'a' clears them too, and IDs the table had no room
+ * for (the overflow count of the 'A' dump) read as not seen.
+ */
+static void UsbQueryLastValues(const uint8_t *ids, size_t nLength)
+{
+    static uint8_t nReply[USB_QUERY_MAX_IDS * 35];
+    stLastValue value;
+    uint8_t *p = nReply;
+
+    for (size_t n = 0; (n + 8) <= nLength; n += 8)
+    {
+        uint32_t nId;
+        if (!GetHex(&ids[n], 8, &nId))
+            break;
+
+        *p++ = 'q';
+        p = PutHex(p, nId, 8);
+        if (GetLastValue(nId, &value))
+        {
+            p = PutHex(p, value.nDlc, 1);
+            for (uint8_t j = 0; j < 8; j++)
+                p = PutHex(p, value.nData[j], 2);
+            p = PutHex(p, value.nTimeMs, 8);
+        }
+        *p++ = '\r';
+    }
+
+    if (p != nReply)
+        UsbWrite(nReply, p - nReply, USB_WRITE_TIMEOUT);
+}
+
+/*
+ * Host frames for the CAN bus, SLCAN style, frames sent by the board are
+ * reported to the host in the same syntax:
+ * 't' III L DD.. / 'T' IIIIIIII L DD.. data frames, standard / extended
+ * 'r' III L / 'R' IIIIIIII L remote frames
+ * Acknowledged with 'z' / 'Z' once queued, or BEL if malformed or the TX
+ * queue stayed full. The USB RX thread blocks while the queue is full,
+ * the host sees that as backpressure on the OUT endpoint.
+ */
+static uint8_t UsbSubmitFrame(const uint8_t *line, size_t nLength)
+{
+    const bool bExtended = (line[0] == 'T') || (line[0] == 'R');
+    const bool bRemote = (line[0] == 'r') || (line[0] == 'R');
+    const uint8_t nIdDigits = bExtended ? 8 : 3;
+    uint32_t nId;
+    uint32_t nDlc;
+    CANTxFrame msg;
+
+    if ((nLength < 2U + nIdDigits) ||
+        !GetHex(&line[1], nIdDigits, &nId) ||
+        !GetHex(&line[1 + nIdDigits], 1, &nDlc) || (nDlc > 8))
+        return '\a';
+
+    if (bExtended ? (nId > 0x1FFFFFFF) : (nId > 0x7FF))
+        return '\a';
+
+    const uint8_t *pData = &line[2 + nIdDigits];
+    if (!bRemote)
+    {
+        if (nLength < 2U + nIdDigits + nDlc * 2)
+            return '\a';
+
+        for (uint8_t i = 0; i < nDlc; i++)
+        {
+            uint32_t nByte;
+            if (!GetHex(&pData[i * 2], 2, &nByte))
+                return '\a';
+            msg.data8[i] = nByte;
+        }
+    }
+
+    msg.IDE = bExtended ? CAN_IDE_EXT : CAN_IDE_STD;
+    if (bExtended)
+        msg.EID = nId;
+    else
+        msg.SID = nId;
+    msg.RTR = bRemote ? CAN_RTR_REMOTE : CAN_RTR_DATA;
+    msg.DLC = nDlc;
+
+    if (PostTxFrameTimeout(&msg, CanTxClass::Gateway, USB_CAN_TX_TIMEOUT) != MSG_OK)
+        return '\a';
+
+    return bExtended ? 'Z' : 'z';
+}
+
+// Hands a settings request to the CAN RX thread as if it came from the bus
+static void UsbPostSettings(const uint8_t *data, size_t nLength)
+{
+    CANRxFrame msg;
+
+    msg.DLC = 0;
+    for (uint8_t i = 0; (i < nLength) && (i < 8); i++)
+    {
+        msg.data8[i] = data[i];
+        msg.DLC++;
+    }
+
+    msg.SID = CAN_BASE_ID - 1;
+    msg.IDE = CAN_IDE_STD;
+    msg.RTR = CAN_RTR_DATA;
+
+    PostRxFrame(&msg);
+    // TODO:What to do if mailbox is full?
+}
+
+/*
+ * Settings request, 's' followed by 1 to 8 bytes of 2 hex characters
+ * each, opcode first. Answered on CAN_BASE_ID like requests from the bus,
+ * or with BEL if malformed. Unlike raw binary lines it can carry 0x0D.
+ */
+static void UsbSettingsCommand(const uint8_t *hex, size_t nLength)
+{
+    uint8_t data[8];
+    const size_t nBytes = nLength / 2;
+    bool bValid = (nLength != 0) && (nLength % 2 == 0) && (nBytes <= sizeof(data));
+
+    for (size_t i = 0; bValid && (i < nBytes); i++)
+    {
+        uint32_t nByte;
+        bValid = GetHex(&hex[i * 2], 2, &nByte);
+        data[i] = nByte;
+    }
+
+    if (!bValid)
+    {
+        const uint8_t nBell = '\a';
+        UsbWrite(&nBell, 1, USB_WRITE_TIMEOUT);
+        return;
+    }
+
+    UsbPostSettings(data, nBytes);
+}
+
+// Returns false if the line is not a command
+static bool UsbHandleCommand(const uint8_t *line, size_t nLength)
+{
+    if (nLength == 0)
+        return false;
+
+    switch (line[0])
+    {
+    case 'A':
+        UsbDumpAnalyzer();
+        return true;
+    case 'a':
+        ClearAnalyzer();
+        return true;
+    case 'Q':
+        UsbQueryLastValues(&line[1], nLength - 1);
+        return true;
+    case 's':
+        UsbSettingsCommand(&line[1], nLength - 1);
+        return true;
+    case 'L':
+        SetCanListenOnly(true);
+        return true;
+    case 'l':
+        SetCanListenOnly(false);
+        return true;
+    case 'M':
+        SetLinMode(LinMode::Monitor);
+        return true;
+    case 'm':
+        SetLinMode(LinMode::Master);
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Binary or line stream of records taken off an encoder's ring
+static uint8_t nStream[2 * SERIAL_USB_BUFFERS_SIZE];
+static size_t nStreamLength;
+static size_t nStreamSent;
+
+// Writes the next part of a record stream. A write cut short by the
+// timeout is finished before anything new is encoded, the records are
+// already off the ring and a partial one would break the framing.
+// Returns false when there was nothing to send.
+static bool UsbStreamPoll(size_t (*encode)(uint8_t *buf, size_t nSize))
+{
+    if (nStreamSent == nStreamLength)
+    {
+        nStreamLength = encode(nStream, sizeof(nStream));
+        nStreamSent = 0;
+        if (nStreamLength == 0)
+            return false;
+    }
+
+    nStreamSent += UsbWrite(&nStream[nStreamSent], nStreamLength - nStreamSent, USB_WRITE_TIMEOUT);
+    return true;
+}
+
 static THD_WORKING_AREA(waUsbTxThread, 1024);
 void UsbTxThread(void *)
 {
@@ -408,50 +728,48 @@ void UsbTxThread(void *)
     {
         // Send all messages in the TX queue
         msg_t res;
-        if (usbGetDriverStateI(&USBD1) == USB_ACTIVE)
+        if ((usbGetDriverStateI(&USBD1) == USB_ACTIVE) && SnifferIsActive())
+        {
+            // Listen only, nothing of ours reaches the bus
+            while (FetchTxUsbFrame(&msg) == MSG_OK)
+                ;
+
+            // Whole buffers per write, no pacing, the ring absorbs USB stalls
+            if (!UsbStreamPoll(SnifferEncode))
+                chThdSleepMilliseconds(1);
+        }
+        else if (usbGetDriverStateI(&USBD1) == USB_ACTIVE)
         {
+            // CAN lines wait while the rest of a cut short record is due
             do
             {
+                if (nStreamSent != nStreamLength)
+                    break;
+
                 res = FetchTxUsbFrame(&msg);
-                if (res == MSG_OK)
+                if ((res == MSG_OK) && UsbFilterPass(&msg))
                 {
-                    uint8_t nData[22];
-                    nData[0] = 't';
-                    nData[1] = (msg.SID >> 8) & 0xF;
-                    nData[2] = (msg.SID >> 4) & 0xF;
-                    nData[3] = msg.SID & 0xF;
-                    nData[4] = (msg.DLC & 0xFF);
-                    nData[5] = (msg.data8[0] >> 4);
-                    nData[6] = (msg.data8[0] & 0x0F);
-                    nData[7] = (msg.data8[1] >> 4);
-                    nData[8] = (msg.data8[1] & 0x0F);
-                    nData[9] = (msg.data8[2] >> 4);
-                    nData[10] = (msg.data8[2] & 0x0F);
-                    nData[11] = (msg.data8[3] >> 4);
-                    nData[12] = (msg.data8[3] & 0x0F);
-                    nData[13] = (msg.data8[4] >> 4);
-                    nData[14] = (msg.data8[4] & 0x0F);
-                    nData[15] = (msg.data8[5] >> 4);
-                    nData[16] = (msg.data8[5] & 0x0F);
-                    nData[17] = (msg.data8[6] >> 4);
-                    nData[18] = (msg.data8[6] & 0x0F);
-                    nData[19] = (msg.data8[7] >> 4);
-                    nData[20] = (msg.data8[7] & 0x0F);
-                    nData[21] = '\r';
-
-                    // Shift the data to ASCII, except the first 't' and last '\r' 
-                    for (uint8_t i = 1; i <= 20; i++)
+                    // Same syntax as frames submitted by the host, data
+                    // bytes only up to the DLC and none for remote frames
+                    const bool bExtended = msg.IDE == CAN_IDE_EXT;
+                    const bool bRemote = msg.RTR == CAN_RTR_REMOTE;
+                    uint8_t nData[27];
+                    uint8_t *p = nData;
+
+                    if (bRemote)
+                        *p++ = bExtended ? 'R' : 'r';
+                    else
+                        *p++ = bExtended ? 'T' : 't';
+                    p = bExtended ? PutHex(p, msg.EID, 8) : PutHex(p, msg.SID, 3);
+                    p = PutHex(p, msg.DLC, 1);
+                    if (!bRemote)
                     {
-                        // Less than 0xA is a number
-                        // Shift up to ASCII numbers
-                        if (nData[i] < 0xA)
-                            nData[i] += 0x30;
-                        else
-                            nData[i] += 0x37;
+                        for (uint8_t i = 0; (i < msg.DLC) && (i < 8); i++)
+                            p = PutHex(p, msg.data8[i], 2);
                     }
+                    *p++ = '\r';
 
-                    
-                    size_t nWritten = chnWriteTimeout(&SDU1, (const uint8_t *)nData, sizeof(nData), TIME_IMMEDIATE);
+                    size_t nWritten = UsbWrite(nData, p - nData, TIME_IMMEDIATE);
                     if (nWritten == 0)
                         PostTxUsbFrame(&msg);
 
@@ -459,10 +777,15 @@ void UsbTxThread(void *)
                 }
             } while (res == MSG_OK);
 
+            UsbStreamPoll(LinMonitorEncode);
+
             chThdSleepMicroseconds(30);
         }
         else
         {
+            // Nobody left to read the rest of the stream
+            nStreamLength = 0;
+            nStreamSent = 0;
             chThdSleepMilliseconds(50);
         }
     }
@@ -473,32 +796,61 @@ void UsbRxThread(void *)
 {
     chRegSetThreadName("USB Rx");
 
-    CANRxFrame msg;
-    uint8_t buf[8];
+    uint8_t buf[USB_DATA_SIZE];
+    uint8_t line[USB_LINE_SIZE];
+    size_t nLineLength = 0;
+
+    // Frame acknowledgements of one read, sent in a single write
+    uint8_t acks[USB_DATA_SIZE];
+    size_t nAcks = 0;
 
     while (true)
     {
         if ((SDU1.state == SDU_READY) &&
              (usbGetDriverStateI(&USBD1) == USB_ACTIVE))
         {
-            size_t nRead = chnReadTimeout(&SDU1, buf, 8, TIME_IMMEDIATE);
-            if ((nRead != 0) && (nRead <= 8))
+            size_t nRead = chnReadTimeout(&SDU1, buf, sizeof(buf), TIME_IMMEDIATE);
+            for (size_t n = 0; n < nRead; n++)
             {
-                msg.DLC = 0;
-                for (uint8_t i = 0; i < nRead; i++)
+                if (buf[n] != '\r')
                 {
-                    msg.data8[i] = buf[i];
-                    msg.DLC++;
+                    // Overlong lines are cut, the rest is dropped up to the next '\r'
+                    if (nLineLength < sizeof(line))
+                        line[nLineLength++] = buf[n];
+                    continue;
                 }
 
-                msg.SID = CAN_BASE_ID - 1;
+                if ((nLineLength != 0) && ((line[0] == 't') || (line[0] == 'T') ||
+                                           (line[0] == 'r') || (line[0] == 'R')))
+                {
+                    acks[nAcks++] = UsbSubmitFrame(line, nLineLength);
+                    if (acks[nAcks - 1] != '\a')
+                        acks[nAcks++] = '\r';
+                    if (nAcks >= sizeof(acks) - 1)
+                    {
+                        UsbWrite(acks, nAcks, USB_WRITE_TIMEOUT);
+                        nAcks = 0;
+                    }
+                }
+                // Anything that isn't a command is passed on as a raw settings
+                // request, requests containing 0x0D need the 's' form
+                else if (!UsbHandleCommand(line, nLineLength) && (nLineLength != 0))
+                {
+                    UsbPostSettings(line, nLineLength);
+                }
 
-                PostRxFrame(&msg);
-                // TODO:What to do if mailbox is full?
+                nLineLength = 0;
             }
 
-            chThdSleepMicroseconds(30);
-            
+            if (nAcks != 0)
+            {
+                UsbWrite(acks, nAcks, USB_WRITE_TIMEOUT);
+                nAcks = 0;
+            }
+
+            // Keep reading while the host streams full packets
+            if (nRead < sizeof(buf))
+                chThdSleepMicroseconds(30);
         }
         else
         {
@@ -513,6 +865,8 @@ msg_t InitUsb()
 
     usbStop(serusbcfg.usbp);
 
+    chMtxObjectInit(&usbWriteMtx);
+
     sduObjectInit(&SDU1);
 
     ret = sduStart(&SDU1, &serusbcfg);
@@ -532,4 +886,31 @@ msg_t InitUsb()
 bool GetUsbConnected()
 {
     return usbGetDriverStateI(&USBD1) == USB_ACTIVE;
+}
+
+bool SetUsbFilter(uint8_t nIndex, const stUsbFilter *filter)
+{
+    if (nIndex >= USB_FILTER_COUNT)
+        return false;
+
+    chSysLock();
+    usbFilters[nIndex] = *filter;
+    nUsbFiltersEnabled = 0;
+    for (uint8_t i = 0; i < USB_FILTER_COUNT; i++)
+    {
+        if (usbFilters[i].bEnabled)
+            nUsbFiltersEnabled++;
+    }
+    chSysUnlock();
+
+    return true;
+}
+
+bool GetUsbFilter(uint8_t nIndex, stUsbFilter *filter)
+{
+    if (nIndex >= USB_FILTER_COUNT)
+        return false;
+
+    *filter = usbFilters[nIndex];
+    return true;
 }
\ No newline at end of file
@@ -1,6 +1,20 @@
 #pragma once
 
+#include <cstdint>
 #include "hal.h"
 
+#define USB_FILTER_COUNT 8
+
+// Stream filter, a frame passes when (key ^ nId) & nMask is 0 for any
+// enabled filter, key being the ID with bit 31 set for extended frames.
+// With no filter enabled every frame passes.
+typedef struct {
+    bool bEnabled;
+    uint32_t nId;
+    uint32_t nMask;
+} stUsbFilter;
+
 msg_t InitUsb();
-bool GetUsbConnected();
\ No newline at end of file
+bool GetUsbConnected();
+bool SetUsbFilter(uint8_t nIndex, const stUsbFilter *filter);
+bool GetUsbFilter(uint8_t nIndex, stUsbFilter *filter);
\ No newline at end of file
@@ -0,0 +1,583 @@
+#include "xcp.h"
+#include "mailbox.h"
+#include "txbudget.h"
+#include "linboard_config.h"
+
+#include <cstring>
+
+// Command codes
+#define CMD_CONNECT 0xFF
+#define CMD_DISCONNECT 0xFE
+#define CMD_GET_STATUS 0xFD
+#define CMD_SYNCH 0xFC
+#define CMD_SET_MTA 0xF6
+#define CMD_UPLOAD 0xF5
+#define CMD_SHORT_UPLOAD 0xF4
+#define CMD_DOWNLOAD 0xF0
+#define CMD_SET_DAQ_PTR 0xE2
+#define CMD_WRITE_DAQ 0xE1
+#define CMD_SET_DAQ_LIST_MODE 0xE0
+#define CMD_START_STOP_DAQ_LIST 0xDE
+#define CMD_START_STOP_SYNCH 0xDD
+#define CMD_GET_DAQ_PROCESSOR_INFO 0xDA
+#define CMD_FREE_DAQ 0xD6
+#define CMD_ALLOC_DAQ 0xD5
+#define CMD_ALLOC_ODT 0xD4
+#define CMD_ALLOC_ODT_ENTRY 0xD3
+
+// Packet identifiers
+#define PID_RES 0xFF
+#define PID_ERR 0xFE
+
+// Error codes
+#define ERR_CMD_SYNCH 0x00
+#define ERR_CMD_UNKNOWN 0x20
+#define ERR_CMD_SYNTAX 0x21
+#define ERR_OUT_OF_RANGE 0x22
+#define ERR_ACCESS_DENIED 0x24
+#define ERR_MODE_NOT_VALID 0x27
+#define ERR_SEQUENCE 0x29
+#define ERR_DAQ_CONFIG 0x2A
+#define ERR_MEMORY_OVERFLOW 0x30
+
+// Resources, CAL/PAG and DAQ
+#define RESOURCES 0x05
+
+#define MAX_CTO 8
+#define MAX_DTO 8
+
+// DAQ list mode bits
+#define DAQ_MODE_SELECTED 0x01
+#define DAQ_MODE_RUNNING 0x40
+
+// DAQ processor properties
+#define DAQ_CONFIG_DYNAMIC 0x01
+#define DAQ_OVERLOAD_MSB 0x40
+
+// Set in the PID of the first DTO of a list sent after DTOs were shed
+#define PID_OVERLOAD 0x80
+
+// Memory the master may access, writes are limited to RAM
+#define RAM_START 0x20000000U
+#define RAM_END (RAM_START + 40 * 1024)
+#define FLASH_START 0x08000000U
+#define FLASH_END (FLASH_START + 256 * 1024)
+
+typedef struct {
+    const uint8_t *pAddr;
+    uint8_t nSize;
+} stOdtEntry;
+
+typedef struct {
+    uint8_t nFirstEntry;
+    uint8_t nEntryCount;
+} stOdt;
+
+typedef struct {
+    uint8_t nFirstOdt;
+    uint8_t nOdtCount;
+    uint8_t nFirstPid;
+    uint8_t nMode;
+    uint16_t nEvent;
+    uint8_t nPrescaler;
+    uint8_t nPrescalerCount;
+    bool bOverload;
+} stDaqList;
+
+static mutex_t xcpMtx;
+
+static bool bConnected = false;
+static uint32_t nMta;
+
+static stDaqList daqLists[XCP_MAX_DAQ];
+static stOdt odts[XCP_MAX_ODT];
+static stOdtEntry odtEntries[XCP_MAX_ODT_ENTRIES];
+static uint8_t nDaqCount;
+static uint8_t nOdtCount;
+static uint8_t nEntryCount;
+
+// SET_DAQ_PTR position, WRITE_DAQ advances the entry
+static uint8_t nPtrDaq;
+static uint8_t nPtrOdt;
+static uint8_t nPtrEntry;
+
+// Shed count of the Daq class at the last event
+static uint32_t nDaqShedSeen;
+
+// Written so nAddr + nLength can't wrap around the address space
+static bool InRegion(uint32_t nAddr, uint32_t nLength, uint32_t nStart, uint32_t nEnd)
+{
+    return (nAddr >= nStart) && (nAddr <= nEnd) && (nLength <= nEnd - nAddr);
+}
+
+static bool AddressReadable(uint32_t nAddr, uint32_t nLength)
+{
+    return InRegion(nAddr, nLength, RAM_START, RAM_END) || InRegion(nAddr, nLength, FLASH_START, FLASH_END);
+}
+
+static bool AddressWritable(uint32_t nAddr, uint32_t nLength)
+{
+    return InRegion(nAddr, nLength, RAM_START, RAM_END);
+}
+
+static msg_t SendDto(const uint8_t *data, uint8_t nLength, CanTxClass eClass)
+{
+    CANTxFrame msg;
+    msg.SID = XCP_DTO_ID;
+    msg.IDE = CAN_IDE_STD;
+    msg.RTR = CAN_RTR_DATA;
+    msg.DLC = nLength;
+    memcpy(msg.data8, data, nLength);
+    return PostTxFrame(&msg, eClass);
+}
+
+static void SendResponse(const uint8_t *data, uint8_t nLength)
+{
+    SendDto(data, nLength, CanTxClass::Control);
+}
+
+static void SendError(uint8_t nError)
+{
+    uint8_t data[2] = {PID_ERR, nError};
+    SendResponse(data, 2);
+}
+
+static void SendOk()
+{
+    uint8_t data[1] = {PID_RES};
+    SendResponse(data, 1);
+}
+
+static uint32_t GetU32(const uint8_t *data)
+{
+    return data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static void FreeDaq()
+{
+    nDaqCount = 0;
+    nOdtCount = 0;
+    nEntryCount = 0;
+}
+
+static void Upload(uint8_t nLength)
+{
+    uint8_t data[MAX_CTO] = {PID_RES};
+
+    if ((nLength == 0) || (nLength > MAX_CTO - 1))
+    {
+        SendError(ERR_OUT_OF_RANGE);
+        return;
+    }
+    if (!AddressReadable(nMta, nLength))
+    {
+        SendError(ERR_ACCESS_DENIED);
+        return;
+    }
+
+    memcpy(&data[1], (const void *)(uintptr_t)nMta, nLength);
+    nMta += nLength;
+    SendResponse(data, 1 + nLength);
+}
+
+// DAQ commands, see ASAM MCD-1 XCP part 2
+static void HandleDaqCommand(const uint8_t *d, uint8_t nLength)
+{
+    switch (d[0])
+    {
+    case CMD_FREE_DAQ:
+        FreeDaq();
+        SendOk();
+        break;
+
+    case CMD_ALLOC_DAQ:
+    {
+        uint16_t nCount = d[2] | (d[3] << 8);
+        if ((nOdtCount != 0) || (nCount > XCP_MAX_DAQ))
+        {
+            SendError(nOdtCount != 0 ? ERR_SEQUENCE : ERR_MEMORY_OVERFLOW);
+            break;
+        }
+        for (uint8_t i = 0; i < nCount; i++)
+            daqLists[i] = {};
+        nDaqCount = nCount;
+        SendOk();
+        break;
+    }
+
+    case CMD_ALLOC_ODT:
+    {
+        uint16_t nDaq = d[2] | (d[3] << 8);
+        uint8_t nCount = d[4];
+        if ((nDaq >= nDaqCount) || (nEntryCount != 0) || (daqLists[nDaq].nOdtCount != 0))
+        {
+            SendError(ERR_SEQUENCE);
+            break;
+        }
+        if (nOdtCount + nCount > XCP_MAX_ODT)
+        {
+            SendError(ERR_MEMORY_OVERFLOW);
+            break;
+        }
+        // Absolute ODT numbers double as the DTO packet identifier
+        daqLists[nDaq].nFirstOdt = nOdtCount;
+        daqLists[nDaq].nFirstPid = nOdtCount;
+        daqLists[nDaq].nOdtCount = nCount;
+        for (uint8_t i = 0; i < nCount; i++)
+            odts[nOdtCount + i] = {};
+        nOdtCount += nCount;
+        SendOk();
+        break;
+    }
+
+    case CMD_ALLOC_ODT_ENTRY:
+    {
+        uint16_t nDaq = d[2] | (d[3] << 8);
+        uint8_t nOdt = d[4];
+        uint8_t nCount = d[5];
+        if ((nDaq >= nDaqCount) || (nOdt >= daqLists[nDaq].nOdtCount))
+        {
+            SendError(ERR_SEQUENCE);
+            break;
+        }
+        if (nEntryCount + nCount > XCP_MAX_ODT_ENTRIES)
+        {
+            SendError(ERR_MEMORY_OVERFLOW);
+            break;
+        }
+        stOdt *odt = &odts[daqLists[nDaq].nFirstOdt + nOdt];
+        odt->nFirstEntry = nEntryCount;
+        odt->nEntryCount = nCount;
+        for (uint8_t i = 0; i < nCount; i++)
+            odtEntries[nEntryCount + i] = {nullptr, 0};
+        nEntryCount += nCount;
+        SendOk();
+        break;
+    }
+
+    case CMD_SET_DAQ_PTR:
+    {
+        uint16_t nDaq = d[2] | (d[3] << 8);
+        if ((nDaq >= nDaqCount) || (d[4] >= daqLists[nDaq].nOdtCount) ||
+            (d[5] >= odts[daqLists[nDaq].nFirstOdt + d[4]].nEntryCount))
+        {
+            SendError(ERR_OUT_OF_RANGE);
+            break;
+        }
+        nPtrDaq = nDaq;
+        nPtrOdt = d[4];
+        nPtrEntry = d[5];
+        SendOk();
+        break;
+    }
+
+    case CMD_WRITE_DAQ:
+    {
+        // d[1] bit offset (bit stimulation not supported), d[2] size, d[3] extension
+        const uint8_t nSize = d[2];
+        const uint32_t nAddr = GetU32(&d[4]);
+        if ((nPtrDaq >= nDaqCount) || (nLength < 8))
+        {
+            SendError(ERR_SEQUENCE);
+            break;
+        }
+        stOdt *odt = &odts[daqLists[nPtrDaq].nFirstOdt + nPtrOdt];
+        if (nPtrEntry >= odt->nEntryCount)
+        {
+            SendError(ERR_OUT_OF_RANGE);
+            break;
+        }
+        if (!AddressReadable(nAddr, nSize))
+        {
+            SendError(ERR_ACCESS_DENIED);
+            break;
+        }
+
+        // The entries of one ODT must fit in a DTO after the PID
+        uint8_t nOdtSize = nSize;
+        for (uint8_t i = 0; i < odt->nEntryCount; i++)
+        {
+            if (i != nPtrEntry)
+                nOdtSize += odtEntries[odt->nFirstEntry + i].nSize;
+        }
+        if (nOdtSize > MAX_DTO - 1)
+        {
+            SendError(ERR_DAQ_CONFIG);
+            break;
+        }
+
+        odtEntries[odt->nFirstEntry + nPtrEntry] = {(const uint8_t *)(uintptr_t)nAddr, nSize};
+        nPtrEntry++;
+        SendOk();
+        break;
+    }
+
+    case CMD_SET_DAQ_LIST_MODE:
+    {
+        uint16_t nDaq = d[2] | (d[3] << 8);
+        uint16_t nEvent = d[4] | (d[5] << 8);
+        if ((nDaq >= nDaqCount) || (nEvent >= XCP_EVENT_COUNT))
+        {
+            SendError(ERR_OUT_OF_RANGE);
+            break;
+        }
+        // Only DAQ direction without timestamps is supported
+        if (d[1] & 0xF2)
+        {
+            SendError(ERR_MODE_NOT_VALID);
+            break;
+        }
+        daqLists[nDaq].nEvent = nEvent;
+        daqLists[nDaq].nPrescaler = d[6] ? d[6] : 1;
+        daqLists[nDaq].nPrescalerCount = 0;
+        SendOk();
+        break;
+    }
+
+    case CMD_START_STOP_DAQ_LIST:
+    {
+        uint16_t nDaq = d[2] | (d[3] << 8);
+        if (nDaq >= nDaqCount)
+        {
+            SendError(ERR_OUT_OF_RANGE);
+            break;
+        }
+        stDaqList *daq = &daqLists[nDaq];
+        if (d[1] == 0)
+            daq->nMode &= ~(DAQ_MODE_RUNNING | DAQ_MODE_SELECTED);
+        else if (d[1] == 1)
+            daq->nMode |= DAQ_MODE_RUNNING;
+        else if (d[1] == 2)
+            daq->nMode |= DAQ_MODE_SELECTED;
+        else
+        {
+            SendError(ERR_MODE_NOT_VALID);
+            break;
+        }
+        uint8_t data[2] = {PID_RES, daq->nFirstPid};
+        SendResponse(data, 2);
+        break;
+    }
+
+    case CMD_START_STOP_SYNCH:
+        for (uint8_t i = 0; i < nDaqCount; i++)
+        {
+            stDaqList *daq = &daqLists[i];
+            if (d[1] == 0)
+                daq->nMode &= ~(DAQ_MODE_RUNNING | DAQ_MODE_SELECTED);
+            else if ((d[1] == 1) && (daq->nMode & DAQ_MODE_SELECTED))
+                daq->nMode = (daq->nMode & ~DAQ_MODE_SELECTED) | DAQ_MODE_RUNNING;
+            else if ((d[1] == 2) && (daq->nMode & DAQ_MODE_SELECTED))
+                daq->nMode &= ~(DAQ_MODE_RUNNING | DAQ_MODE_SELECTED);
+        }
+        SendOk();
+        break;
+
+    case CMD_GET_DAQ_PROCESSOR_INFO:
+    {
+        // Dynamic DAQ config, absolute ODT number as identification field,
+        // shed DTOs flagged in the PID MSB
+        uint8_t data[8] = {PID_RES, DAQ_CONFIG_DYNAMIC | DAQ_OVERLOAD_MSB, 0, 0, XCP_EVENT_COUNT, 0, 0, 0};
+        data[2] = XCP_MAX_DAQ & 0xFF;
+        data[3] = XCP_MAX_DAQ >> 8;
+        SendResponse(data, 8);
+        break;
+    }
+
+    default:
+        SendError(ERR_CMD_UNKNOWN);
+        break;
+    }
+}
+
+// Drives the 1ms DAQ event, windowed sleep keeps the period free of drift
+static THD_WORKING_AREA(waXcpThread, 256);
+void XcpThread(void *)
+{
+    chRegSetThreadName("XCP");
+
+    systime_t nNext = chVTGetSystemTimeX();
+
+    while (true)
+    {
+        systime_t nPrev = nNext;
+        nNext = chTimeAddX(nPrev, TIME_MS2I(1));
+
+        XcpEvent(XCP_EVENT_1MS);
+
+        chThdSleepUntilWindowed(nPrev, nNext);
+    }
+}
+
+void InitXcp(void)
+{
+    chMtxObjectInit(&xcpMtx);
+    FreeDaq();
+
+    chThdCreateStatic(waXcpThread, sizeof(waXcpThread), NORMALPRIO + 2, XcpThread, nullptr);
+}
+
+// Command packets (CTO) on XCP_CRO_ID, called from the CAN Rx thread
+void XcpReceive(const CANRxFrame *frame)
+{
+    const uint8_t *d = frame->data8;
+    const uint8_t nLength = frame->DLC;
+
+    if (nLength == 0)
+        return;
+
+    chMtxLock(&xcpMtx);
+
+    if (d[0] == CMD_CONNECT)
+    {
+        bConnected = true;
+        // Byte granularity, Intel byte order, MAX_CTO 8, MAX_DTO 8, protocol and transport layer 1
+        uint8_t data[8] = {PID_RES, RESOURCES, 0x00, MAX_CTO, MAX_DTO, 0x00, 0x01, 0x01};
+        SendResponse(data, 8);
+        chMtxUnlock(&xcpMtx);
+        return;
+    }
+
+    // Only CONNECT is answered while disconnected
+    if (!bConnected)
+    {
+        chMtxUnlock(&xcpMtx);
+        return;
+    }
+
+    switch (d[0])
+    {
+    case CMD_DISCONNECT:
+        for (uint8_t i = 0; i < nDaqCount; i++)
+            daqLists[i].nMode = 0;
+        bConnected = false;
+        SendOk();
+        break;
+
+    case CMD_GET_STATUS:
+    {
+        uint8_t nStatus = 0;
+        for (uint8_t i = 0; i < nDaqCount; i++)
+        {
+            if (daqLists[i].nMode & DAQ_MODE_RUNNING)
+                nStatus = DAQ_MODE_RUNNING;
+        }
+        uint8_t data[6] = {PID_RES, nStatus, 0x00, 0x00, 0x00, 0x00};
+        SendResponse(data, 6);
+        break;
+    }
+
+    case CMD_SYNCH:
+        SendError(ERR_CMD_SYNCH);
+        break;
+
+    case CMD_SET_MTA:
+        if (nLength < 8)
+        {
+            SendError(ERR_CMD_SYNTAX);
+            break;
+        }
+        nMta = GetU32(&d[4]);
+        SendOk();
+        break;
+
+    case CMD_UPLOAD:
+        Upload(d[1]);
+        break;
+
+    case CMD_SHORT_UPLOAD:
+        if (nLength < 8)
+        {
+            SendError(ERR_CMD_SYNTAX);
+            break;
+        }
+        nMta = GetU32(&d[4]);
+        Upload(d[1]);
+        break;
+
+    case CMD_DOWNLOAD:
+    {
+        const uint8_t nCount = d[1];
+        if ((nCount == 0) || (nCount > MAX_CTO - 2) || (nLength < 2 + nCount))
+        {
+            SendError(ERR_OUT_OF_RANGE);
+            break;
+        }
+        if (!AddressWritable(nMta, nCount))
+        {
+            SendError(ERR_ACCESS_DENIED);
+            break;
+        }
+        memcpy((void *)(uintptr_t)nMta, &d[2], nCount);
+        nMta += nCount;
+        SendOk();
+        break;
+    }
+
+    default:
+        HandleDaqCommand(d, nLength);
+        break;
+    }
+
+    chMtxUnlock(&xcpMtx);
+}
+
+// Sample every running DAQ list bound to nEvent, the ODTs are resolved to
+// address/size pairs when configured so this is only a copy loop
+void XcpEvent(uint8_t nEvent)
+{
+    if (!bConnected)
+        return;
+
+    chMtxLock(&xcpMtx);
+
+    // DTOs are shed when the Daq queue is full or over budget, every running
+    // list is told as the count can't be traced back to one
+    stTxClassStats daqStats;
+    GetTxClassStats(CanTxClass::Daq, &daqStats);
+    if (daqStats.nShed != nDaqShedSeen)
+    {
+        nDaqShedSeen = daqStats.nShed;
+        for (uint8_t i = 0; i < nDaqCount; i++)
+        {
+            if (daqLists[i].nMode & DAQ_MODE_RUNNING)
+                daqLists[i].bOverload = true;
+        }
+    }
+
+    for (uint8_t i = 0; i < nDaqCount; i++)
+    {
+        stDaqList *daq = &daqLists[i];
+        if (!(daq->nMode & DAQ_MODE_RUNNING) || (daq->nEvent != nEvent))
+            continue;
+
+        if (++daq->nPrescalerCount < daq->nPrescaler)
+            continue;
+        daq->nPrescalerCount = 0;
+
+        for (uint8_t o = 0; o < daq->nOdtCount; o++)
+        {
+            const stOdt *odt = &odts[daq->nFirstOdt + o];
+            uint8_t data[MAX_DTO];
+            uint8_t *p = &data[1];
+
+            data[0] = (daq->nFirstPid + o) | (daq->bOverload ? PID_OVERLOAD : 0);
+            for (uint8_t e = 0; e < odt->nEntryCount; e++)
+            {
+                const stOdtEntry *entry = &odtEntries[odt->nFirstEntry + e];
+                memcpy(p, entry->pAddr, entry->nSize);
+                p += entry->nSize;
+            }
+
+            if (SendDto(data, p - data, CanTxClass::Daq) == MSG_OK)
+                daq->bOverload = false;
+        }
+    }
+
+    chMtxUnlock(&xcpMtx);
+}
+
+bool XcpIsConnected(void)
+{
+    return bConnected;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+#include "hal.h"
+
+// DAQ event channels
+#define XCP_EVENT_1MS 0
+#define XCP_EVENT_LIN_SLOT 1
+#define XCP_EVENT_COUNT 2
+
+// Dynamic DAQ memory
+#define XCP_MAX_DAQ 4
+#define XCP_MAX_ODT 16
+#define XCP_MAX_ODT_ENTRIES 64
+
+void InitXcp(void);
+void XcpReceive(const CANRxFrame *frame);
+void XcpEvent(uint8_t nEvent);
+bool XcpIsConnected(void);